@@ -4,6 +4,11 @@
 
 #include "audio_shared.h"
 #include "audio_codec_mad.h"
+#include "mp3_decoder.h"
+#include "mp3_header.h"
+#include "mp3_index.h"
+#include "pcm_convert.h"
+#include "utils.h"
 
 // TODO: remove logger from codecs
 #include "logger.h"
@@ -14,31 +19,173 @@
 
 static void *fdm;
 static struct stat file_stat;
+static struct mp3_decoder decoder;
 
-struct buffer {
-	unsigned char const *start;
-	unsigned long length;
+// first audio frame, ID3v2 and Xing/Info frame are skipped
+static size_t data_offset;
+
+// gapless playback - encoder delay and padding trimmed from output
+static unsigned long skip_samples;
+static unsigned long remaining_samples;
+static bool trim_end;
+
+/*
+ * Seeking.  Position is counted in samples after trimming, lead_samples
+ * are decoded before the first sample.  The decoder counts headers, so
+ * frames dropped by libmad are counted too and the frame number always
+ * matches the index.
+ */
+static unsigned int tag_frames;
+static unsigned long lead_samples;
+static unsigned long total_samples;
+static long first_output_frame;
+
+// synthesized frame, samples from pcm_pos to pcm_end are not returned yet
+static struct mad_pcm *pcm;
+static unsigned int pcm_pos, pcm_end;
+
+// output precision (16 or 24 bits) and TPDF dither
+int mad_output_bits = 16;
+bool mad_dither = false;
+
+static const char *const mad_libraries[] = {
+	"libmad.so.0",
+	"libmad.0.dylib",
+	"/opt/pkg/lib/libmad.0.dylib",
+	"/opt/local/lib/libmad.so.0",
+	"/usr/pkg/lib/libmad.so.0",
+	NULL
 };
 
-char *buf;
+static const char *const mad_extensions[] = {
+	"mp3",
+	NULL
+};
 
-static int set_audio_format_mad();
+/*
+ * Reads LAME encoder delay and padding from Xing/Info tag, frame count
+ * from Xing or VBRI tag.  Track duration is exact with a tag, estimated
+ * from the first frame bitrate without it.
+ */
+static void
+set_gapless_info(struct codec_info *info)
+{
+	const unsigned char *p = fdm;
+	size_t len = file_stat.st_size;
+	struct mp3_header hdr;
+	struct mp3_xing xing;
+	long offset;
+
+	data_offset = 0;
+	skip_samples = 0;
+	remaining_samples = 0;
+	trim_end = false;
+	tag_frames = 0;
+	lead_samples = 0;
+	total_samples = 0;
+
+	offset = mp3_find_frame(p, len, mp3_skip_id3v2(p, len), &hdr);
+	if (offset == -1)
+		return;
+	data_offset = offset;
+	if (hdr.bitrate > 0)
+		info->duration_ms = (unsigned long long)(len - offset) * 8 /
+			hdr.bitrate;
+
+	if (mp3_parse_xing(p + offset, len - offset, &hdr, &xing) == -1 &&
+			mp3_parse_vbri(p + offset, len - offset, &hdr, &xing) == -1)
+		return;
+
+	// tag frame contains no audio
+	data_offset += hdr.frame_len;
+	tag_frames = xing.frames;
+	info->duration_ms = (unsigned long long)xing.frames * hdr.samples *
+		1000 / hdr.samplerate;
+
+	if (!xing.has_lame || xing.frames == 0)
+		return;
+
+	skip_samples = xing.enc_delay + MP3_DECODER_DELAY;
+	remaining_samples = (unsigned long)xing.frames * hdr.samples;
+	if (remaining_samples <= xing.enc_delay + xing.enc_padding) {
+		skip_samples = 0;
+		return;
+	}
+	remaining_samples -= xing.enc_delay + xing.enc_padding;
+	trim_end = true;
+	lead_samples = skip_samples;
+	total_samples = remaining_samples;
+	info->frames = total_samples;
+	info->duration_ms = (unsigned long long)total_samples * 1000 /
+		hdr.samplerate;
+	logger("MAD: gapless delay %d padding %d samples %d\n",
+		xing.enc_delay, xing.enc_padding, (int)remaining_samples);
+}
 
-static enum mad_flow in_func(void *data, struct mad_stream *stream);
-static enum mad_flow hdr_func(void *data, struct mad_header const *header);
+/*
+ * Probes the first frame header, nothing is synthesized.
+ */
+static int
+set_audio_format_mad(struct codec_info *info)
+{
+	struct mad_header header;
 
-static enum mad_flow
-out_func(void *data, struct mad_header const *header, struct mad_pcm *pcm);
+	if (mp3_decoder_header(&decoder, &header) != 1) {
+		logger("MAD: no audio frame found\n");
+		return (-1);
+	}
+	logger("MAD: layer %d, mode %d, bitrate %ld, samplerate %d\n",
+		header.layer,
+		header.mode,
+		header.bitrate,
+		header.samplerate
+		);
 
-static enum mad_flow
-err_func(void *data, struct mad_stream *stream, struct mad_frame *frame);
+	switch (header.mode) {
+	case(MAD_MODE_SINGLE_CHANNEL):
+		info->channels = 1;
+		break;
+	case(MAD_MODE_DUAL_CHANNEL):
+		info->channels = 2;
+		break;
+	case(MAD_MODE_JOINT_STEREO):
+		info->channels = 2;
+		break;
+	case(MAD_MODE_STEREO):
+		info->channels = 2;
+		break;
+	default: // TODO
+		info->channels = 2;
+		;;
+	}
+	info->rate = header.samplerate;
+	// 24 bit samples are sent in 32 bit containers
+	info->bits = (mad_output_bits == 24) ? 32 : 16;
+
+	return (0);
+}
 
-int
-prepare_mad_codec()
+static void
+set_tags(struct codec_info *info)
+{
+	struct mp3_tags tags;
+
+	mp3_parse_tags(fdm, file_stat.st_size, &tags);
+	snprintf(info->title, sizeof (info->title), "%s", tags.title);
+	snprintf(info->artist, sizeof (info->artist), "%s", tags.artist);
+	snprintf(info->album, sizeof (info->album), "%s", tags.album);
+
+	if (info->duration_ms > 0)
+		info->bitrate = (unsigned long long)(file_stat.st_size -
+			data_offset) * 8 / info->duration_ms;
+}
+
+static int
+mad_open(const char *path, struct codec_info *info)
 {
 	int fd;
 
-	fd = open(current_filename, O_RDONLY);
+	fd = open(path, O_RDONLY);
 	if (fd == -1) {
 		logger("ERROR: can't open audio file\n");
 		logger("%s\n", strerror(errno));
@@ -67,221 +214,153 @@ prepare_mad_codec()
 	}
 	close(fd);
 
-	set_audio_format_mad();
-	if (open_audio_device() == -1)
-		return (-1);
-	return (0);
-}
-
-int
-cleanup_mad_codec()
-{
-	int err;
-
-	err = munmap(fdm, file_stat.st_size);
-	if (err == -1) {
+	memset(info, 0, sizeof (*info));
+	set_gapless_info(info);
+	set_tags(info);
+	mp3_decoder_init(&decoder, fdm, file_stat.st_size, data_offset);
+	if (set_audio_format_mad(info) == -1) {
+		mp3_decoder_finish(&decoder);
+		munmap(fdm, file_stat.st_size);
 		return (-1);
 	}
 
-	ao_close(device);
+	mp3_decoder_restart(&decoder, data_offset, 0);
+	first_output_frame = 0;
+	pcm_pos = pcm_end = 0;
+	// dither doesn't depend on files played before, output is repeatable
+	pcm_convert_seed(file_stat.st_ino ^ file_stat.st_size);
 	return (0);
 }
 
-exit_reason_t
-play_file_using_mad_codec()
+static void
+mad_close()
 {
-	int err;
-	unsigned int buf_len;
-	struct buffer mad_buffer;
-	struct mad_decoder decoder;
-	info_t status;
-
-	buf_len = format.bits/8 * format.channels * format.rate * 2;
-	buf = malloc(buf_len * sizeof (int));
-	if (buf == NULL) {
-		return (EXIT_REASON_ERROR);
-	}
-
-	mad_buffer.start  = fdm;
-	mad_buffer.length = file_stat.st_size;
-	mad_decoder_init(&decoder, &mad_buffer,
-		in_func, 0, 0, out_func, err_func, 0);
-
-	err = mad_decoder_run(&decoder, MAD_DECODER_MODE_SYNC);
-	logger("play_file: mad_decoder_run() returned %d\n", err);
-
-	// TODO: check status
-	pthread_mutex_lock(&audio_cmd_mutex);
-	status = audio_cmd;
-	pthread_mutex_unlock(&audio_cmd_mutex);
-	switch (status) {
-	case EXIT_REASON_STOP:
-		logger("status: EXIT_REASON_STOP\n");
-		break;
-	default:
-		logger("status: %d\n", status);
-	}
-
-	mad_decoder_finish(&decoder);
-	free(buf);
-	return (EXIT_REASON_EOF);
+	if (decoder.errors > 0)
+		logger("MAD: %lu decoding errors\n", decoder.errors);
+	mp3_decoder_finish(&decoder);
+	munmap(fdm, file_stat.st_size);
 }
 
-static enum mad_flow
-in_func(void *data, struct mad_stream *stream)
+/*
+ * Moves the position to target sample.  Decoding restarts MP3_SEEK_PRIME
+ * frames before the target frame to fill the bit reservoir, output of
+ * these frames is dropped.
+ */
+static long long
+mad_seek(unsigned long long target)
 {
-	struct buffer *mad_buffer = data;
-
-	if (!mad_buffer->length)
-		return MAD_FLOW_STOP;
+	struct mp3_index *idx;
+	unsigned long long decoded, start_us;
+	unsigned int frame, first;
+
+	idx = mp3_index_lookup(&file_stat);
+	if (idx == NULL) {
+		start_us = get_time_us();
+		idx = mp3_index_build(&file_stat, fdm, data_offset, tag_frames);
+		if (idx == NULL) {
+			logger("MAD: can't build seek index\n");
+			return (-1);
+		}
+		logger("MAD: indexed %u frames in %llu us\n", idx->frames,
+			get_time_us() - start_us);
+	}
 
-	mad_stream_buffer(stream, mad_buffer->start, mad_buffer->length);
+	if (trim_end && target > total_samples)
+		target = total_samples;
 
-	mad_buffer->length = 0;
+	decoded = target + lead_samples;
+	frame = mp3_index_frame(idx, decoded);
+	first = (frame > MP3_SEEK_PRIME) ? frame - MP3_SEEK_PRIME : 0;
 
-	return MAD_FLOW_CONTINUE;
+	mp3_decoder_restart(&decoder, idx->offsets[first], first);
+	first_output_frame = frame;
+	skip_samples = decoded - (unsigned long long)frame * idx->spf;
+	if (trim_end)
+		remaining_samples = total_samples - target;
+	pcm_pos = pcm_end = 0;
+	return (target);
 }
 
+/*
+ * Synthesizes the next frame with audio left after trimming of encoder
+ * delay and padding.  Frames priming the bit reservoir after a seek are
+ * not synthesized, except the last one which fills the synth filterbank.
+ * Returns 0 at the end of the file.
+ */
 static int
-set_audio_format_mad()
-{
-	struct buffer mad_buffer;
-	struct mad_decoder decoder;
-	int err;
-
-	mad_buffer.start  = fdm;
-	mad_buffer.length = file_stat.st_size;
-
-	logger("set_audio_format_mad()\n");
-	/* configure to get header information */
-	mad_decoder_init(&decoder, &mad_buffer,
-		in_func, hdr_func, 0, out_func, err_func, 0);
-
-	err = mad_decoder_run(&decoder, MAD_DECODER_MODE_SYNC);
-	logger("header: mad_decoder_run() returned %d\n", err);
-
-	mad_decoder_finish(&decoder);
-	return (0);
-}
-
-static enum mad_flow
-hdr_func(void *data, struct mad_header const *header)
+next_pcm()
 {
-	logger("MAD: hdr_func() layer %d, mode %d, bitrate %ld, samplerate %d\n",
-		header->layer,
-		header->mode,
-		header->bitrate,
-		header->samplerate
-		);
-
-	memset(&format, 0, sizeof (format));
-
-	switch (header->mode) {
-	case(MAD_MODE_SINGLE_CHANNEL):
-		format.channels = 1;
-		break;
-	case(MAD_MODE_DUAL_CHANNEL):
-		format.channels = 2;
-		break;
-	case(MAD_MODE_JOINT_STEREO):
-		format.channels = 2;
-		break;
-	case(MAD_MODE_STEREO):
-		format.channels = 2;
-		break;
-	default: // TODO
-		format.channels = 2;
-		;;
+	int ret;
+
+	for (;;) {
+		ret = mp3_decoder_frame(&decoder);
+		if (ret == -1)
+			logger("MAD: decoding error: %s\n",
+				mp3_decoder_error(&decoder));
+		if (ret != 1)
+			return (0);
+
+		if (decoder.frame_no < first_output_frame - 1)
+			continue;
+		pcm = mp3_decoder_synth(&decoder);
+		if (decoder.frame_no < first_output_frame)
+			continue;
+
+		pcm_pos = 0;
+		pcm_end = pcm->length;
+		if (skip_samples > 0) {
+			if (skip_samples >= pcm_end) {
+				skip_samples -= pcm_end;
+				continue;
+			}
+			pcm_pos = skip_samples;
+			skip_samples = 0;
+		}
+		if (trim_end) {
+			if (remaining_samples < pcm_end - pcm_pos)
+				pcm_end = pcm_pos + remaining_samples;
+			remaining_samples -= pcm_end - pcm_pos;
+			if (pcm_end == pcm_pos)
+				return (0);
+		}
+		return (1);
 	}
-	format.rate = header->samplerate;
-	format.byte_format = AO_FMT_NATIVE;
-	format.bits = 16;
-
-	return MAD_FLOW_STOP;
-}
-
-static inline signed int
-downsample(mad_fixed_t sample)
-{
-	return sample >> (MAD_F_FRACBITS + 1 - 16);
 }
 
-static enum mad_flow
-out_func(void *data, struct mad_header const *header, struct mad_pcm *pcm)
+static long
+mad_decode(void *buf, unsigned long frames)
 {
-	unsigned int i;
-	mad_fixed_t const *left, *right;
-	signed int sample;
-	char *ptr;
-	info_t command;
-	bool paused;
-
-	i = pcm->length;
-	left = pcm->samples[0];
-	right = pcm->samples[1];
-
-	ptr = buf;
-	while (i--) {
-		sample = downsample(*left++);
-		*ptr++ = sample & 0xff;
-		*ptr++ = (sample >> 8) & 0xff;
-
-		if (pcm->channels == 2) {
-			sample = downsample(*right++);
-			*ptr++ = sample & 0xff;
-			*ptr++ = (sample >> 8) & 0xff;
+	unsigned long done = 0;
+	unsigned int n;
+
+	while (done < frames) {
+		if (pcm_pos == pcm_end && next_pcm() == 0)
+			break;
+
+		n = pcm_end - pcm_pos;
+		if (n > frames - done)
+			n = frames - done;
+		if (mad_output_bits == 24) {
+			pcm_convert_s24(pcm, pcm_pos, n, mad_dither,
+				(int32_t *)buf + done * pcm->channels);
+		} else {
+			pcm_convert_s16(pcm, pcm_pos, n, mad_dither,
+				(int16_t *)buf + done * pcm->channels);
 		}
+		pcm_pos += n;
+		done += n;
 	}
-
-	// checking for new event
-	pthread_mutex_lock(&audio_cmd_mutex);
-	command = audio_cmd;
-	pthread_mutex_unlock(&audio_cmd_mutex);
-
-	switch (command) {
-	case CMD_PLAY:
-		logger("engine_ao - CMD_PLAY\n");
-		pthread_mutex_lock(&audio_cmd_mutex);
-		audio_cmd = STATUS_STOP;
-		pthread_mutex_unlock(&audio_cmd_mutex);
-		// TODO: use codec_status only
-		pthread_mutex_lock(&codec_status_mutex);
-		codec_status = CODEC_STATUS_EXIT_PLAY_OTHER;
-		pthread_mutex_unlock(&codec_status_mutex);
-		return (MAD_FLOW_STOP);
-		break;
-	case CMD_STOP:
-		logger("engine_ao - CMD_STOP\n");
-		pthread_mutex_lock(&audio_cmd_mutex);
-		audio_cmd = STATUS_STOP;
-		pthread_mutex_unlock(&audio_cmd_mutex);
-		return (MAD_FLOW_STOP);
-	case CMD_QUIT:
-		logger("engine_ao - CMD_QUIT\n");
-		pthread_mutex_lock(&audio_cmd_mutex);
-		audio_cmd = STATUS_EXIT;
-		pthread_mutex_unlock(&audio_cmd_mutex);
-		return (MAD_FLOW_STOP);
-	case CMD_PAUSE: // TODO
-		//paused = true;
-		break;
-	case CMD_FF: // TODO
-		break;
-	case CMD_REV: // TODO
-		break;
-	case STATUS_ACK:
-		break;
-	default:
-		logger("engine_ao - TODO: %d\n", command);
-		;;
-	}
-	ao_play(device, buf, pcm->length * pcm->channels * 2);
-
-	return (MAD_FLOW_CONTINUE);
+	return (done);
 }
 
-static enum mad_flow
-err_func(void *data, struct mad_stream *stream, struct mad_frame *frame)
-{
-	return MAD_FLOW_CONTINUE;
-}
+const struct codec mad_codec = {
+	"mad",
+	mad_libraries,
+	mad_extensions,
+	mp3_decoder_load,
+	NULL,		/* decodes every mp3 */
+	mad_open,
+	mad_decode,
+	mad_seek,
+	mad_close
+};
@@ -1,5 +1,7 @@
 #include "audio_shared.h"
+#include "codec.h"
 
-int prepare_mad_codec();
-int cleanup_mad_codec();
-exit_reason_t play_file_using_mad_codec();
+extern const struct codec mad_codec;
+
+extern int mad_output_bits;
+extern bool mad_dither;
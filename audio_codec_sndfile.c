@@ -0,0 +1,179 @@
+#include <dlfcn.h>
+#include <sndfile.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "audio_codec_sndfile.h"
+#include "logger.h"
+
+/*
+ * libsndfile API: http://www.mega-nerd.com/libsndfile/api.html
+ */
+
+static SNDFILE *sndfile;
+static SF_INFO sfinfo;
+
+// libsndfile functions, resolved by sndfile_load()
+static struct {
+	SNDFILE *(*open)(const char *, int, SF_INFO *);
+	int (*close)(SNDFILE *);
+	sf_count_t (*readf_int)(SNDFILE *, int *, sf_count_t);
+	sf_count_t (*seek)(SNDFILE *, sf_count_t, int);
+	int (*command)(SNDFILE *, int, void *, int);
+	const char *(*strerror)(SNDFILE *);
+	const char *(*get_string)(SNDFILE *, int);
+} sf;
+
+static const struct {
+	const char *name;
+	void *fp;
+} symbols[] = {
+	{ "sf_open", &sf.open },
+	{ "sf_close", &sf.close },
+	{ "sf_readf_int", &sf.readf_int },
+	{ "sf_seek", &sf.seek },
+	{ "sf_command", &sf.command },
+	{ "sf_strerror", &sf.strerror },
+	{ "sf_get_string", &sf.get_string },
+};
+
+static const char *const sndfile_libraries[] = {
+	"libsndfile.so.1",
+	"libsndfile.1.dylib",
+	"/opt/pkg/lib/libsndfile.1.dylib",
+	"/opt/local/lib/libsndfile.so.1",
+	"/usr/pkg/lib/libsndfile.so.1",
+	NULL
+};
+
+// formats of all libsndfile versions first, mp3 is probed
+static const char *const sndfile_extensions[] = {
+	"aiff",
+	"flac",
+	"wav",
+	"ogg",
+	"mp3",
+	NULL
+};
+
+static int
+sndfile_load(void *lib)
+{
+	unsigned int i;
+	void *sym;
+
+	for (i = 0; i < sizeof (symbols) / sizeof (symbols[0]); i++) {
+		sym = dlsym(lib, symbols[i].name);
+		if (sym == NULL)
+			return (-1);
+		// function pointer from void *
+		memcpy(symbols[i].fp, &sym, sizeof (sym));
+	}
+	return (0);
+}
+
+/*
+ * Returns true if the library reads files with the extension, MP3 is
+ * supported since libsndfile 1.1.
+ */
+static bool
+has_major_format(const char *ext)
+{
+	SF_FORMAT_INFO info;
+	int i, count;
+
+	if (sf.command(NULL, SFC_GET_FORMAT_MAJOR_COUNT, &count,
+			sizeof (count)) != 0)
+		return (false);
+	for (i = 0; i < count; i++) {
+		info.format = i;
+		if (sf.command(NULL, SFC_GET_FORMAT_MAJOR, &info,
+				sizeof (info)) != 0)
+			continue;
+		if (info.extension != NULL && strcmp(info.extension, ext) == 0)
+			return (true);
+	}
+	return (false);
+}
+
+static bool
+sndfile_probe(const char *path, const char *ext)
+{
+	static int mp3_support = -1;
+
+	if (strcmp(ext, "mp3") != 0)
+		return (true);
+	if (mp3_support == -1)
+		mp3_support = has_major_format(ext);
+	return (mp3_support);
+}
+
+static void
+get_tag(int type, char *buf, size_t size)
+{
+	const char *str;
+
+	str = sf.get_string(sndfile, type);
+	snprintf(buf, size, "%s", (str != NULL) ? str : "");
+}
+
+static int
+sndfile_open(const char *path, struct codec_info *info)
+{
+	struct stat st;
+
+	memset(&sfinfo, 0, sizeof (sfinfo));
+	sndfile = sf.open(path, SFM_READ, &sfinfo);
+	if (sndfile == NULL) {
+		logger("sf_open error: %s\n", sf.strerror(NULL));
+		return (-1);
+	}
+
+	memset(info, 0, sizeof (*info));
+	info->rate = sfinfo.samplerate;
+	info->channels = sfinfo.channels;
+	info->bits = 32;	// sf_readf_int()
+	info->frames = sfinfo.frames;
+	if (sfinfo.samplerate > 0)
+		info->duration_ms = sfinfo.frames * 1000 / sfinfo.samplerate;
+	if (info->duration_ms > 0 && stat(path, &st) == 0)
+		info->bitrate = (unsigned long long)st.st_size * 8 /
+			info->duration_ms;
+	get_tag(SF_STR_TITLE, info->title, sizeof (info->title));
+	get_tag(SF_STR_ARTIST, info->artist, sizeof (info->artist));
+	get_tag(SF_STR_ALBUM, info->album, sizeof (info->album));
+	return (0);
+}
+
+static long
+sndfile_decode(void *buf, unsigned long frames)
+{
+	return (sf.readf_int(sndfile, buf, frames));
+}
+
+static long long
+sndfile_seek(unsigned long long frame)
+{
+	return (sf.seek(sndfile, frame, SEEK_SET));
+}
+
+static void
+sndfile_close()
+{
+	logger("CLEANING UP: sf_close()\n");
+	sf.close(sndfile);
+	sndfile = NULL;
+}
+
+const struct codec sndfile_codec = {
+	"sndfile",
+	sndfile_libraries,
+	sndfile_extensions,
+	sndfile_load,
+	sndfile_probe,
+	sndfile_open,
+	sndfile_decode,
+	sndfile_seek,
+	sndfile_close
+};
@@ -0,0 +1,3 @@
+#include "codec.h"
+
+extern const struct codec sndfile_codec;
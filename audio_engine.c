@@ -1,23 +1,28 @@
 #include <math.h>
-#include <sndfile.h>
 
 #include "audio_shared.h"
 #include "audio_codec_mad.h"
+#include "audio_engine.h"
+#include "codec.h"
+#include "event_loop.h"
+#include "event_queue.h"
 #include "logger.h"
+#include "mailbox.h"
+#include "meta_cache.h"
+#include "pcm_ring.h"
 #include "protocol.h"
+#include "resample.h"
 #include "utils.h"
 
 /*
  * API:
- * http://www.mega-nerd.com/libsndfile/api.html
  * http://www.xiph.org/ao/doc/ao_sample_format.html
  * http://www.mega-nerd.com/SRC/api_full.html
  */
 
-// libsndfile handler
-SNDFILE *sndfile;
-SF_INFO sfinfo;
-int mode = SFM_READ;
+// codec of the current file
+static const struct codec *codec;
+static struct codec_info codec_info;
 
 // libao settings
 ao_device *device;
@@ -30,147 +35,195 @@ pthread_t ao_thread = NULL;
 pthread_attr_t *aot_attr = NULL;
 void *ao_arg = NULL;
 
-// socket sender thread
-pthread_t sender_thread = NULL;
-pthread_attr_t *sender_attr = NULL;
-void *sender_arg = NULL;
+// output thread - drains PCM ring into ao_play()
+pthread_t output_thread = NULL;
+pthread_attr_t *output_attr = NULL;
+void *output_arg = NULL;
+volatile bool output_running;
 
-// cached of current audio file name
-char *current_filename = NULL;
+// amount of decoded audio buffered ahead of ao_play()
+unsigned int pcm_buffer_ms = PCM_RING_DEFAULT_MS;
+
+// position updates for clients, duration is set by codecs
+unsigned int status_interval_ms = STATUS_INTERVAL_DEFAULT_MS;
+static unsigned int track_duration_ms;
 
+// used only by the output thread
+static unsigned int position_base_ms, position_duration_ms;
+static unsigned long long played_frames;
 
 /*
- *
+ * Optional sample rate converter, audio device runs at resample_rate.
+ * Codecs write to staging block which is converted into PCM ring.
  */
-pthread_mutex_t audio_cmd_mutex = PTHREAD_MUTEX_INITIALIZER;
-char *audio_cmd_str;
-info_t audio_cmd;
-
-// for event notifications (pause/unpause/play/exit..)
-pthread_mutex_t ao_event_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t ao_event = PTHREAD_COND_INITIALIZER;
+unsigned int resample_rate = 0;
+resample_quality_t resample_quality = RESAMPLE_SINC;
+static bool resampling = false;
+static struct pcm_block staging;
 
+// cached of current audio file name
+char *current_filename = NULL;
 
 /*
- * Used by engine_socket_sender to notify UI.
+ * Audio device is opened once and kept for the whole session,
+ * it is reopened only if the sample format changes.
  */
-pthread_mutex_t audio_status_for_ui_mutex = PTHREAD_MUTEX_INITIALIZER;
-volatile info_t audio_status_for_ui;
-
-pthread_mutex_t status_event_for_ui_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t status_event_for_ui = PTHREAD_COND_INITIALIZER;
+static ao_sample_format device_format;
+static unsigned int device_opens = 0;
 
+// time of the last CMD_PLAY, for time-to-first-sample measurement
+static unsigned long long play_request_us;
 
 /*
- * TODO
+ * Files played after the current one, without a gap if possible.  Ring
+ * of paths which doubles when full, a whole library fits in.
  */
-pthread_mutex_t codec_status_mutex = PTHREAD_MUTEX_INITIALIZER;
-codec_status_t codec_status;
+#define	PLAY_QUEUE_MIN 64
+static struct play_queue {
+	char **names;
+	unsigned int size;
+	unsigned int head;
+	unsigned int count;
+} play_queue;
+pthread_mutex_t play_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 
-// used by audio thread
-int *buffer;
+/*
+ * Commands for audio thread are queued in the mailbox (mailbox.c),
+ * ao_event wakes up audio thread when it is idle or paused.
+ */
+pthread_mutex_t ao_event_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ao_event = PTHREAD_COND_INITIALIZER;
 
-static int sock_fd, conn_fd;
+// last command returned by next_command(), CMD_PLAY carries a file name
+static struct engine_cmd last_cmd;
+static bool paused = false;
 
+// listening TCP socket, -1 when UI is connected through socketpair
+static int sock_fd = -1;
 
-bool use_codec;
 
-void stop_command();
-void quit_command();
+void push_command(info_t cmd, char *str);
 int engine_socket_receiver();
-int signal_cond_event();
-int get_connection_fd();
 int init_network();
 void notify_packet_sender(info_t status);
+void play_queue_free();
 
-void cleanup_native_codec();
 
-void *engine_socket_sender();
 void *engine_ao();
+void *engine_output();
 
 
 /*
- * Entry point of audio daemon.
+ * Everything commands depend on: mailbox, event queues, client sockets,
+ * audio output.  ui_fd is the engine end of a socketpair, or -1 to wait
+ * for the UI on TCP port.
  */
 int
-engine_daemon()
+engine_init(int ui_fd)
 {
 	int err;
 	pid_t ppid;
 
+	// messages are written by a thread of this process, not the UI
+	if (logger_init() == 0)
+		atexit(logger_stop);
+
 	logger("########################################\n");
 	logger("engine_daemon - START\n");
 
-	// buffer for audio filename string received from UI
-	audio_cmd_str = malloc(NAME_MAX + 1);
-	if (audio_cmd_str == NULL) {
-		logger("ERROR: can't alloc memory for audio_cmd_str\n");
-		return (-1);
-	}
+	mailbox_init();
+	event_queue_init();
+	codec_init();
+	meta_cache_open(NULL);
 
-	current_filename = malloc(NAME_MAX + 1);
+	current_filename = malloc(PKT_MAX_PAYLOAD);
 	if (!current_filename) {
 		logger("ERROR: Can't initialize current_filename.");
-		free(audio_cmd_str);
 		return (-1);
 	}
 
-	logger("starting network..\n");
-	sock_fd = init_network();
-	if (!sock_fd) {
-		logger("ERROR: init_network()\n");
-		free(audio_cmd_str);
+	// UI end of socketpair is already connected
+	if (ui_fd == -1) {
+		logger("starting network..\n");
+		sock_fd = init_network();
+		if (!sock_fd) {
+			logger("ERROR: init_network()\n");
+			free(current_filename);
+			return (-1);
+		}
+
+		// network is initialized, notify parent
+		ppid = getppid();
+		logger("ppid: %d\n", ppid);
+
+		err = kill(ppid, SIGUSR1);
+		if (err == -1) {
+			logger("ERROR: can't send SIGUSR1 to the parent\n");
+			free(current_filename);
+			ao_shutdown();
+			return (err);
+		}
+	}
+
+	if (event_loop_init(sock_fd, ui_fd) == -1) {
+		logger("ERROR: event_loop_init()\n");
 		free(current_filename);
 		return (-1);
 	}
 
-	// network is initialized, notify parent
-	ppid = getppid();
-	logger("ppid: %d\n", ppid);
+	logger("starting audio subsystem..\n");
+	ao_initialize();
+	default_driver = ao_default_driver_id();
 
-	err = kill(ppid, SIGUSR1);
-	if (err == -1) {
-		logger("ERROR: can't send SIGUSR1 to the parent\n");
-		free(audio_cmd_str);
+	if (pcm_ring_init(pcm_buffer_ms) == -1) {
+		logger("ERROR: can't alloc memory for PCM ring\n");
 		free(current_filename);
 		ao_shutdown();
-		return (err);
+		return (-1);
 	}
 
-	conn_fd = get_connection_fd();
-	if (conn_fd == -1) {
-		logger("ERROR: get_connection_fd()\n");
-		free(audio_cmd_str);
+	if (resample_rate > 0 &&
+			resample_init(resample_quality, resample_rate) == -1) {
+		logger("ERROR: can't initialize resampler\n");
 		free(current_filename);
+		pcm_ring_destroy();
+		ao_shutdown();
 		return (-1);
 	}
+	return (0);
+}
 
-	logger("starting audio subsystem..\n");
-	ao_initialize();
-	default_driver = ao_default_driver_id();
+/*
+ * Runs the engine until a quit command, after engine_init().
+ */
+int
+engine_run()
+{
+	int err;
 
-	logger("starting sender thread..\n");
-	err = pthread_create(&sender_thread, sender_attr,
-		engine_socket_sender, sender_arg);
+	logger("starting output thread..\n");
+	output_running = true;
+	err = pthread_create(&output_thread, output_attr,
+		engine_output, output_arg);
 	if (err != 0) {
-		logger("ERROR: sender thread\n");
-		free(audio_cmd_str);
+		logger("ERROR: output thread\n");
 		free(current_filename);
+		pcm_ring_destroy();
 		ao_shutdown();
+		return (-1);
 	}
 
 	logger("starting ao thread..\n");
 	err = pthread_create(&ao_thread, aot_attr, engine_ao, ao_arg);
 	if (err != 0) {
 		logger("ERROR: engine_ao failed\n");
-		free(audio_cmd_str);
 		free(current_filename);
 		ao_shutdown();
 	}
 
 	logger("waiting for commands..\n");
-	// main loop - receiving commands from UI
+	// main loop - commands from clients, status to subscribers
 	err = engine_socket_receiver();
 
 
@@ -180,16 +233,20 @@ engine_daemon()
 		pthread_join(ao_thread, NULL);
 	}
 
-	// finishing sender_thread
-	notify_packet_sender(CMD_QUIT);
-
-	if (pthread_kill(sender_thread, 0) == 0) {
-		logger("engine_daemon - waiting for sender_thread..\n");
-		pthread_join(sender_thread, NULL);
+	// finishing output_thread
+	output_running = false;
+	if (pthread_kill(output_thread, 0) == 0) {
+		logger("engine_daemon - waiting for output_thread..\n");
+		pthread_join(output_thread, NULL);
 	}
+	pcm_ring_destroy();
+	if (resample_rate > 0)
+		resample_destroy();
+	play_queue_free();
 
 	ao_shutdown();
-	free(audio_cmd_str);
+	codec_unload();
+	meta_cache_close();
 	free(current_filename);
 
 	logger("engine_daemon - STOP\n");
@@ -197,122 +254,273 @@ engine_daemon()
 }
 
 /*
- * Thread - sends audio status to UI.
+ * Entry point of audio daemon.
  */
-void *
-engine_socket_sender()
+int
+engine_daemon(int ui_fd)
 {
-	int err;
-	info_t status_copy;
+	if (engine_init(ui_fd) == -1)
+		return (-1);
+	return (engine_run());
+}
 
-	for (;;) {
-		pthread_mutex_lock(&status_event_for_ui_mutex);
-		// waiting for an event
-		if (pthread_cond_wait(&status_event_for_ui,
-				&status_event_for_ui_mutex) != 0) {
-			logger("ERROR: pthread_cond_wait in engine_socket_sender()\n");
-		}
-		pthread_mutex_unlock(&status_event_for_ui_mutex);
+static bool
+same_audio_format(ao_sample_format *a, ao_sample_format *b)
+{
+	return (a->bits == b->bits && a->rate == b->rate &&
+		a->channels == b->channels && a->byte_format == b->byte_format);
+}
 
-		// reading status variable
-		pthread_mutex_lock(&audio_status_for_ui_mutex);
-		status_copy = audio_status_for_ui;
-		pthread_mutex_unlock(&audio_status_for_ui_mutex);
+/*
+ * Opens audio device for current format.  Already opened device is kept
+ * if the format didn't change, so the next file is played without a gap.
+ */
+int
+open_audio_device()
+{
+	bool was_resampling = resampling;
+
+	// resampler converts file rate to the device rate
+	resampling = false;
+	if (resample_rate > 0 && format.rate != resample_rate) {
+		if (resample_set_format(format.rate, format.channels,
+				format.bits) == 0) {
+			format.rate = resample_rate;
+			resampling = true;
+			// history is kept only between consecutive files
+			if (!was_resampling)
+				resample_reset();
+		} else {
+			logger("resampler: unsupported format, rate %d\n",
+				format.rate);
+		}
+	}
 
-		if (status_copy == CMD_QUIT)
-			pthread_exit(NULL);
+	if (device != NULL) {
+		if (same_audio_format(&device_format, &format))
+			return (0);
+		// let the output thread finish previous file
+		logger("audio format changed, reopening device\n");
+		pcm_ring_drain();
+		ao_close(device);
+		device = NULL;
+	}
 
-		// send audio status to UI
-		err = send_packet(conn_fd, status_copy, NULL);
-		if (err == -1) {
-			logger("ERROR: send_packet failed\n");
-		}
+	// libao
+	device = ao_open_live(default_driver, &format, NULL);
+	if (device == NULL) {
+		logger("ao_open_live() error: %s\n", strerror(errno));
+		return (-1);
 	}
+	device_format = format;
+	device_opens++;
+	pcm_ring_set_rate(format.bits / 8 * format.channels * format.rate);
+	pcm_ring_reset_stats();
+	return (0);
 }
 
+/*
+ * Returns block for decoded PCM or NULL if PCM ring is full.
+ */
+struct pcm_block *
+get_pcm_block()
+{
+	struct pcm_block *blk;
+
+	blk = pcm_ring_write_block();
+	if (blk == NULL || !resampling)
+		return (blk);
+	return (&staging);
+}
+
+/*
+ * Publishes block returned by get_pcm_block().
+ */
 void
-show_sf_info(SF_INFO * sfinfo)
+commit_pcm_block()
 {
-	printf("FRAMES: %lld\n", (long long)sfinfo->frames);
-	printf("SAMPLE RATE: %d\n", sfinfo->samplerate);
-	printf("CHANNELS: %d\n", sfinfo->channels);
-	printf("FORMAT: %d\n", sfinfo->format);
-	printf("SECTIONS: %d\n", sfinfo->sections);
-	printf("SEEKABLE: %d\n", sfinfo->seekable);
+	struct pcm_block *blk;
+	unsigned int frame_size, frames;
+
+	if (!resampling) {
+		pcm_ring_commit();
+		return;
+	}
+
+	frame_size = format.bits / 8 * format.channels;
+	if (resample_push(staging.data, staging.len / frame_size) == -1)
+		logger("ERROR: resampler out of memory, block dropped\n");
+	for (;;) {
+		while ((blk = pcm_ring_write_block()) == NULL)
+			usleep(PCM_RING_POLL_US);
+		frames = resample_pull(blk->data, PCM_BLOCK_SIZE / frame_size);
+		if (frames == 0)
+			break;
+		blk->len = frames * frame_size;
+		pcm_ring_commit();
+	}
 }
 
+/*
+ * Called only when the engine is exiting.
+ */
 void
-cleanup_native_codec()
+close_audio_device()
 {
+	if (device == NULL)
+		return;
+
+	pcm_ring_flush();
 	logger("CLEANING UP: ao_close()\n");
 	ao_close(device);
+	device = NULL;
+}
 
-	logger("CLEANING UP: sf_close()\n");
-	sf_close(sndfile);
-
-	logger("CLEANING UP: free()\n");
-	free(buffer);
+/*
+ * Converts CMD_SEEK argument, decimal milliseconds, to sample frames.
+ */
+int
+seek_position(const char *str, unsigned int rate, unsigned long long *pos)
+{
+	unsigned long long ms;
+	char *end;
 
-	logger("CLEANING UP - DONE\n");
+	errno = 0;
+	ms = strtoull(str, &end, 10);
+	if (errno != 0 || end == str || *end != '\0') {
+		logger("invalid seek position '%s'\n", str);
+		return (-1);
+	}
+	*pos = ms * rate / 1000;
+	return (0);
 }
 
+/*
+ * Drops buffered audio after a seek, resampler history belongs to the
+ * old position too.
+ */
 void
-exit_sndfile()
+flush_pcm_output()
 {
-	logger("CLEANING UP: sf_close()\n");
-	sf_close(sndfile);
+	pcm_ring_flush();
+	if (resampling)
+		resample_reset();
 }
 
-static void
-set_audio_format()
+void
+log_pcm_ring_stats()
 {
-	memset(&format, 0, sizeof (format));
-	format.channels = sfinfo.channels;
-	format.rate = sfinfo.samplerate;
-	format.byte_format = AO_FMT_NATIVE;
-	format.bits = 32;	// 32 for sf_read_int(), 16 for sf_read_short()
+	struct pcm_ring_stats stats;
+
+	pcm_ring_get_stats(&stats);
+	logger("pcm_ring: blocks %d, fill %d/%d, min_fill %d, underruns %d\n",
+		stats.blocks, stats.fill, stats.limit, stats.min_fill,
+		stats.underruns);
 }
 
-int
-open_file_sf(char *str_buf)
+void
+log_resample_stats()
 {
-	sndfile = sf_open(str_buf, mode, &sfinfo);
-	if (sndfile == NULL) {
-		logger("sf_open error: %s\n", strerror(errno));
-		return (-1);
-	}
-	return (0);
+	struct resample_stats stats;
+
+	resample_get_stats(&stats);
+	logger("resampler: %s, %d frames in %d us, %d times faster "
+		"than realtime\n", resample_quality_name(resample_quality),
+		(int)stats.frames_out, (int)stats.cpu_us, stats.realtime_x);
 }
 
-int
-open_audio_device()
+/*
+ * Called by codecs before decoding a file.
+ */
+void
+set_track_duration(unsigned int duration_ms)
 {
-	// libao
-	device = ao_open_live(default_driver, &format, NULL);
-	if (device == NULL) {
-		logger("ao_open_live() error: %s\n", strerror(errno));
-		return (-1);
-	}
-	return (0);
+	track_duration_ms = duration_ms;
 }
 
+/*
+ * Marks position of the next decoded block, at track start or after
+ * a seek.
+ */
 void
-notify_packet_sender(info_t status)
+set_track_position(unsigned long long frame, unsigned int rate)
+{
+	pcm_ring_set_next_position(frame * 1000 / rate, track_duration_ms);
+}
+
+/*
+ * Sent at most every status_interval_ms and only when a client listens.
+ * ao_play() returns when the block is queued by the device, the last
+ * block is estimated to be not heard yet.
+ */
+static void
+publish_position(unsigned int last_frames)
 {
-	int ret;
+	static unsigned long long last_us;
+	struct pcm_ring_stats stats;
+	unsigned long long now, heard, position;
+
+	if (status_interval_ms == 0 || !event_loop_has_subscribers())
+		return;
+	now = get_time_us();
+	if (now - last_us < status_interval_ms * 1000ULL)
+		return;
+	last_us = now;
+
+	heard = (played_frames > last_frames) ? played_frames - last_frames : 0;
+	position = position_base_ms + heard * 1000 / device_format.rate;
+	pcm_ring_get_stats(&stats);
+
+	event_queue_post(STATUS_POSITION, position, true);
+	event_queue_post(STATUS_DURATION, position_duration_ms, true);
+	event_queue_post(STATUS_BUFFER,
+		stats.limit ? stats.fill * 100ULL / stats.limit : 0, true);
+	event_loop_wakeup();
+}
 
-	// set for packet sender
-	pthread_mutex_lock(&audio_status_for_ui_mutex);
-	audio_status_for_ui = status;
-	pthread_mutex_unlock(&audio_status_for_ui_mutex);
+/*
+ * Thread - plays PCM blocks decoded by engine_ao.
+ */
+void *
+engine_output()
+{
+	struct pcm_block *blk;
+	unsigned int frame_size, frames;
+
+	while (output_running) {
+		blk = pcm_ring_read_block();
+		if (blk == NULL) {
+			usleep(PCM_RING_POLL_US);
+			continue;
+		}
+		if (blk->flags & PCM_BLOCK_TRACK_START) {
+			logger("time to first sample: %d us, device opens: %d\n",
+				(int)(get_time_us() - play_request_us), device_opens);
+		}
+		if (blk->flags & PCM_BLOCK_POSITION) {
+			position_base_ms = blk->position_ms;
+			position_duration_ms = blk->duration_ms;
+			played_frames = 0;
+		}
+		frame_size = device_format.bits / 8 * device_format.channels;
+		frames = blk->len / frame_size;
 
-	// send event signal to packet sender
-	pthread_mutex_lock(&status_event_for_ui_mutex);
-	ret = pthread_cond_signal(&status_event_for_ui);
-	if (ret != 0) {
-		logger("ERROR: pthread_cond_signal: %d\n", ret);
+		ao_play(device, blk->data, blk->len);
+		pcm_ring_release();
+
+		played_frames += frames;
+		publish_position(frames);
 	}
-	pthread_mutex_unlock(&status_event_for_ui_mutex);
+	return (NULL);
+}
+
+void
+notify_packet_sender(info_t status)
+{
+	// sent to subscribers by the event loop thread
+	if (event_queue_post(status, 0, false) == -1)
+		logger("ERROR: status queue full, status %d dropped\n", status);
+	event_loop_wakeup();
 }
 
 void
@@ -321,207 +529,255 @@ notify_ui_eof()
 	notify_packet_sender(STATUS_STOP);
 }
 
+/*
+ * Remembers metadata of the opened file, the UI shows it without
+ * opening the file.
+ */
+static void
+update_meta_cache()
+{
+	struct meta m;
+	struct stat st;
+
+	if (stat(current_filename, &st) == -1 ||
+			meta_cache_lookup(&st, &m) == 0)
+		return;
+	meta_from_codec_info(&m, get_file_type(current_filename),
+		&codec_info);
+	if (meta_cache_store(&st, &m) == -1)
+		logger("meta cache: can't store %s\n", current_filename);
+}
+
+/*
+ * Opens current_filename with a codec for its format and the audio
+ * device for its sample format.
+ */
 int
-prepare_native_codec()
+prepare_audio_file_and_codec()
 {
-	int err;
-	err = open_file_sf(current_filename);
-	if (err == -1) {
-		logger("ERROR: can't open audio file\n");
+	codec = codec_find(current_filename);
+	if (codec == NULL) {
+		logger("ERROR: no codec for %s\n", current_filename);
+		return (-1);
+	}
+	if (codec->open(current_filename, &codec_info) == -1) {
+		logger("ERROR: %s can't open file\n", codec->name);
 		return (-1);
 	}
 
-	set_audio_format();
+	memset(&format, 0, sizeof (format));
+	format.channels = codec_info.channels;
+	format.rate = codec_info.rate;
+	format.byte_format = AO_FMT_NATIVE;
+	format.bits = codec_info.bits;
+	set_track_duration(codec_info.duration_ms);
+	update_meta_cache();
 
 	if (open_audio_device() == -1) {
 		logger("ERROR: can't open audio device\n");
-		sf_close(sndfile);
+		codec->close();
 		return (-1);
 	}
-
 	return (0);
 }
 
-int
-prepare_audio_file_and_codec()
+/*
+ * Handles commands for the codec, seeks move position.  Returns
+ * EXIT_REASON_UNKNOWN if decoding continues.
+ */
+static exit_reason_t
+handle_codec_commands(unsigned long long *position)
 {
-	int err, idx;
+	struct engine_cmd cmd;
+	unsigned long long target, step;
+	long long seek_ret;
 
-	pthread_mutex_lock(&audio_cmd_mutex);
-	strncpy(current_filename, audio_cmd_str, NAME_MAX);
-	pthread_mutex_unlock(&audio_cmd_mutex);
+	// codecs count frames at file rate, format.rate may be resampler rate
+	step = (unsigned long long)SEEK_STEP_SEC * codec_info.rate;
 
-	// getting index for file type from supported_files[]
-	idx = get_file_type(current_filename);
-	if (idx == -1) {
-		logger("ERROR: can't get file type\n");
-		return (-1);
+	while (next_command(&cmd)) {
+		switch (cmd.cmd) {
+		case CMD_PLAY:
+			return (EXIT_REASON_PLAY_OTHER);
+		case CMD_STOP:
+			return (EXIT_REASON_STOP);
+		case CMD_QUIT:
+			return (EXIT_REASON_QUIT);
+		case CMD_FF:
+			target = *position + step;
+			break;
+		case CMD_REV:
+			target = (*position > step) ? *position - step : 0;
+			break;
+		case CMD_SEEK:
+			if (seek_position(cmd.str, codec_info.rate,
+					&target) == -1)
+				continue;
+			break;
+		default:
+			continue;
+		}
+
+		if (codec_info.frames > 0 && target > codec_info.frames)
+			target = codec_info.frames;
+		seek_ret = codec->seek(target);
+		log_debug("seek_ret: %d\n", (int)seek_ret);
+		if (seek_ret == -1)
+			continue;
+		*position = seek_ret;
+		// drop audio decoded before the seek
+		flush_pcm_output();
+		set_track_position(*position, codec_info.rate);
 	}
+	return (EXIT_REASON_UNKNOWN);
+}
 
-	if (idx == 4) {
-		// use 'mad' codec for mp3
-		err = prepare_mad_codec();
-		if (err == -1) {
-			logger("ERROR: can't prepare mad codec\n");
-			return (-1);
+/*
+ * Decodes current file into PCM ring until the end of file or until
+ * a command stops it.
+ */
+exit_reason_t
+play_file_using_codec()
+{
+	struct pcm_block *blk;
+	unsigned long long position = 0, decoded = 0, cpu_us;
+	unsigned int frame_size;
+	long frames;
+	exit_reason_t ret;
+
+	frame_size = codec_info.bits / 8 * codec_info.channels;
+	cpu_us = get_thread_cpu_us();
+
+	while ((ret = handle_codec_commands(&position)) ==
+			EXIT_REASON_UNKNOWN) {
+		blk = get_pcm_block();
+		if (blk == NULL) {
+			// ring is full, output thread is behind us
+			usleep(PCM_RING_POLL_US);
+			continue;
 		}
-		use_codec = true;
-	} else {
-		err = prepare_native_codec();
-		use_codec = false;
+
+		frames = codec->decode(blk->data, PCM_BLOCK_SIZE / frame_size);
+		if (frames <= 0) {
+			// end of file, buffered audio is still playing
+			if (frames == -1)
+				logger("ERROR: %s decoding error\n", codec->name);
+			ret = EXIT_REASON_EOF;
+			break;
+		}
+		blk->len = frames * frame_size;
+		commit_pcm_block();
+		position += frames;
+		decoded += frames;
 	}
-	return (err);
+
+	cpu_us = get_thread_cpu_us() - cpu_us;
+	if (decoded > 0) {
+		logger("codec %s: %llu ms of audio, %llu us CPU per second\n",
+			codec->name, decoded * 1000 / codec_info.rate,
+			cpu_us * codec_info.rate / decoded);
+	}
+	return (ret);
+}
+
+/*
+ * Takes next file from the play queue, returns -1 if queue is empty.
+ */
+int
+play_queue_pop(char *filename)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&play_queue_mutex);
+	if (play_queue.count > 0) {
+		snprintf(filename, PKT_MAX_PAYLOAD, "%s",
+			play_queue.names[play_queue.head]);
+		free(play_queue.names[play_queue.head]);
+		play_queue.head = (play_queue.head + 1) % play_queue.size;
+		play_queue.count--;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&play_queue_mutex);
+	return (ret);
 }
 
+/*
+ * Plays current_filename.  Audio device is not closed here,
+ * caller decides if the next file can reuse it.
+ */
 exit_reason_t
-play_file_using_native_codec()
-{
-	int buf_len, buf_size;
-	static bool paused = false, shifted = false;
-	bool last_read = false;
-	sfinfo.format = 0;
-	int read_cnt = 0;
-	int i, play_chunk;
-	char *bufp = NULL;
-	sf_count_t count, seek_ret, seek_frames;
-	info_t command;
-
-	// buf_len = format.bits/8 * format.channels * format.rate / 4;
-	buf_len = format.bits/8 * format.channels * format.rate;
-	seek_frames = buf_len * 4;
-	buf_size = buf_len * sizeof (int);
-	play_chunk = buf_size / 16;
-	logger("play_chunk: %d\n", play_chunk);
-	buffer = malloc(buf_size);
-	if (buffer == NULL) {
-		logger("buffer error: %s\n", strerror(errno));
+play_current_file()
+{
+	exit_reason_t ret;
+
+	logger("playing: %s\n", current_filename);
+	if (prepare_audio_file_and_codec() == -1)
 		return (EXIT_REASON_ERROR);
-	}
+	set_track_position(0, 1);
+
+	ret = play_file_using_codec();
+	codec->close();
+	log_pcm_ring_stats();
+	if (resampling)
+		log_resample_stats();
+	return (ret);
+}
 
-	// reading a file
-	for (;;) {
-		count = sf_read_int(sndfile, buffer, buf_len);
-		logger("read from file: %d\n", (int)count);
-		logger("read_cnt: %d\n", read_cnt);
-		if ((int)count == 0) {
-			// end of file
-			notify_ui_eof();
-			pthread_mutex_lock(&audio_cmd_mutex);
-			audio_cmd = STATUS_STOP;
-			pthread_mutex_unlock(&audio_cmd_mutex);
-			return (EXIT_REASON_EOF);
+/*
+ * Sleeps until there is a command in the mailbox.
+ */
+static void
+wait_for_command()
+{
+	pthread_mutex_lock(&ao_event_mutex);
+	while (!mailbox_pending()) {
+		if (pthread_cond_wait(&ao_event, &ao_event_mutex) != 0) {
+			logger("ERROR: pthread_cond_wait failed\n");
 		}
-		if (count < buf_len) {
-			if (count <= play_chunk) {
-				// play the rest of the buffer
-				ao_play(device, (char *)buffer, count);
-				notify_ui_eof();
+	}
+	pthread_mutex_unlock(&ao_event_mutex);
+}
 
-				pthread_mutex_lock(&audio_cmd_mutex);
-				audio_cmd = STATUS_STOP;
-				pthread_mutex_unlock(&audio_cmd_mutex);
-				return (EXIT_REASON_EOF);
-			}
-			last_read = true;
+/*
+ * Called by codecs between blocks.  Returns next command for the codec
+ * or false if there is none.  Commands are returned in the order they
+ * were sent, CMD_PAUSE is handled here - while paused this function
+ * doesn't return until the codec has something to do.
+ */
+bool
+next_command(struct engine_cmd *cmd)
+{
+	for (;;) {
+		if (!mailbox_pending()) {
+			if (!paused)
+				return (false);
+			wait_for_command();
 		}
+		if (mailbox_pop(cmd) == -1)
+			continue;
 
-		// play in small chunks
-		bufp = (char *)buffer;
-		for (i = 0; i < 16; i++) {
-			// checking for the command
-			pthread_mutex_lock(&audio_cmd_mutex);
-			command = audio_cmd;
-			pthread_mutex_unlock(&audio_cmd_mutex);
-
-			switch (command) {
-			case CMD_PLAY:
-				logger("engine_ao - CMD_PLAY\n");
-				return (EXIT_REASON_PLAY_OTHER);
-				break;
-			case CMD_STOP:
-				logger("engine_ao - CMD_STOP\n");
-				return (EXIT_REASON_STOP);
-			case CMD_QUIT:
-				logger("engine_ao - CMD_QUIT\n");
-				return (EXIT_REASON_QUIT);
-			case CMD_PAUSE:
-				logger("engine_ao - CMD_PAUSE\n");
-				paused = true;
-				break;
-			case CMD_FF:
-				logger("engine_ao - CMD_FF\n");
-				seek_ret = sf_seek(sndfile, seek_frames, SEEK_CUR);
-				logger("seek_ret: %lld\n", seek_ret);
-				if (seek_ret == -1)
-					sf_seek(sndfile, 0, SEEK_END);
-				shifted = true;
-				audio_cmd = STATUS_ACK;
-				break;
-			case CMD_REV:
-				logger("engine_ao - CMD_REV\n");
-				seek_ret = sf_seek(sndfile, 0, SEEK_CUR);
-				if (seek_ret <= seek_frames)
-					seek_ret = sf_seek(sndfile, 0, SEEK_SET);
-				else
-					seek_ret = sf_seek(sndfile, -seek_frames, SEEK_CUR);
-				logger("seek_ret: %lld\n", seek_ret);
-				audio_cmd = STATUS_ACK;
-				shifted = true;
-				break;
-			case STATUS_ACK:
-				break;
-			default:
-				logger("engine_ao - TODO: %d\n", command);
-				;;
-			}
-
-			// CMD_FF, CMD_REV, CMD_PLAY (replay)
-			if (shifted) {
-				shifted = false;
-				break;
-			}
+		log_debug("engine_ao - command %d, latency %d us\n", cmd->cmd,
+			(int)(get_time_us() - cmd->time_us));
 
+		switch (cmd->cmd) {
+		case CMD_PAUSE:
+			paused = !paused;
+			pcm_ring_pause(paused);
+			continue;
+		case CMD_PLAY:
+		case CMD_STOP:
+		case CMD_QUIT:
 			if (paused) {
-				pthread_mutex_lock(&ao_event_mutex);
-				// waiting for an event
-				if (pthread_cond_wait(&ao_event, &ao_event_mutex) != 0) {
-					logger("ERROR: pthread_cond_wait failed\n");
-					// TODO ?
-				}
 				paused = false;
-				pthread_mutex_unlock(&ao_event_mutex);
-			}
-
-			// check for STOP or PLAY commands
-			pthread_mutex_lock(&audio_cmd_mutex);
-			command = audio_cmd;
-			pthread_mutex_unlock(&audio_cmd_mutex);
-
-			if (command == CMD_STOP) {
-				logger("engine_ao - CMD_STOP\n");
-				return (EXIT_REASON_STOP);
-			} else if (command == CMD_PLAY) {
-				logger("engine_ao - CMD_PLAY\n");
-				return (EXIT_REASON_PLAY_OTHER);
-			}
-
-			// play sound
-			ao_play(device, bufp, play_chunk);
-			bufp += play_chunk;
-			if (last_read) {
-				// TODO
-				logger("count: %d\n", count);
-				logger("play_chunk: %d\n", play_chunk);
-				logger("bufp - (char *)buffer: %d\n", bufp - (char *)buffer);
-				if (bufp - (char *)buffer >= count) {
-					notify_ui_eof();
-					break;
-				}
+				pcm_ring_pause(false);
 			}
+			break;
+		default:
+			;;
 		}
-		read_cnt++;
+		last_cmd = *cmd;
+		return (true);
 	}
-	return (EXIT_REASON_EOF);
 }
 
 /*
@@ -530,158 +786,142 @@ play_file_using_native_codec()
 void *
 engine_ao()
 {
-	unsigned int command;
-	exit_reason_t ret = EXIT_REASON_UNKNOWN;
+	struct engine_cmd cmd;
+	exit_reason_t ret;
 
 	for (;;) {
-		switch (ret) {
-		case (EXIT_REASON_UNKNOWN):
-		case (EXIT_REASON_ERROR):
-		case (EXIT_REASON_STOP):
-		case (EXIT_REASON_EOF):
-			// waiting for new event
-			pthread_mutex_lock(&ao_event_mutex);
-			if (pthread_cond_wait(&ao_event, &ao_event_mutex) != 0) {
-				logger("ERROR: pthread_cond_wait failed\n");
-				// TODO
-			}
-			pthread_mutex_unlock(&ao_event_mutex);
-			break;
-		default:
-			;;
-		}
+		wait_for_command();
+		if (mailbox_pop(&cmd) == -1)
+			continue;
 
-		pthread_mutex_lock(&audio_cmd_mutex);
-		command = audio_cmd;
-		if (command == CMD_PLAY)
-			audio_cmd = STATUS_ACK;
-		pthread_mutex_unlock(&audio_cmd_mutex);
+		log_debug("engine_ao - command %d, latency %d us\n", cmd.cmd,
+			(int)(get_time_us() - cmd.time_us));
 
-		switch (command) {
-		case CMD_PLAY:
+		// another CMD_PLAY may come while playing
+		while (cmd.cmd == CMD_PLAY) {
 			logger("engine_ao - CMD_PLAY\n");
-			if (prepare_audio_file_and_codec() == -1) {
-				ret = EXIT_REASON_ERROR;
-				break;
-			}
-			if (use_codec) {
-				ret = play_file_using_mad_codec();
-				cleanup_mad_codec();
+			snprintf(current_filename, PKT_MAX_PAYLOAD, "%s",
+				cmd.str);
+			play_request_us = cmd.time_us;
+
+			pcm_ring_set_next_flags(PCM_BLOCK_TRACK_START);
+			ret = play_current_file();
+
+			// gapless - next file is decoded while the ring drains
+			while (ret == EXIT_REASON_EOF &&
+					play_queue_pop(current_filename) == 0)
+				ret = play_current_file();
+
+			// audio device stays open for the next file
+			if (ret == EXIT_REASON_EOF) {
+				pcm_ring_drain();
+				notify_ui_eof();
 			} else {
-				ret = play_file_using_native_codec();
-				cleanup_native_codec();
+				flush_pcm_output();
 			}
-			break;
-		case CMD_QUIT:
+
+			// command which stopped the codec
+			if (ret == EXIT_REASON_PLAY_OTHER ||
+					ret == EXIT_REASON_QUIT)
+				cmd = last_cmd;
+			else
+				cmd.cmd = CMD_UNKNOWN;
+		}
+
+		if (cmd.cmd == CMD_QUIT) {
 			logger("engine_ao - CMD_QUIT\n");
+			close_audio_device();
 			pthread_exit(NULL);
-		default:
-			;;
 		}
 	}
 }
 
-void
-play_command(char *filename)
-{
-	pthread_mutex_lock(&audio_cmd_mutex);
-	audio_cmd = CMD_PLAY;
-	snprintf(audio_cmd_str, NAME_MAX, "%s", filename);
-	pthread_mutex_unlock(&audio_cmd_mutex);
-
-	if (signal_cond_event() != 0) {
-		logger("ERROR: PLAY COMMAND FAILED\n");
-	}
-}
-
-void
-stop_command()
+/*
+ * Doubles the play queue, entries keep their order from index 0.
+ * Called with play_queue_mutex held.
+ */
+static int
+play_queue_grow()
 {
-	pthread_mutex_lock(&audio_cmd_mutex);
-	audio_cmd = CMD_STOP;
-	pthread_mutex_unlock(&audio_cmd_mutex);
+	unsigned int size, i;
+	char **names;
 
-	if (signal_cond_event() != 0) {
-		logger("ERROR: STOP COMMAND FAILED\n");
-	}
+	size = play_queue.size ? 2 * play_queue.size : PLAY_QUEUE_MIN;
+	names = malloc(size * sizeof (names[0]));
+	if (names == NULL)
+		return (-1);
+	for (i = 0; i < play_queue.count; i++)
+		names[i] = play_queue.names[(play_queue.head + i) %
+			play_queue.size];
+	free(play_queue.names);
+	play_queue.names = names;
+	play_queue.size = size;
+	play_queue.head = 0;
+	return (0);
 }
 
 void
-quit_command()
+play_queue_free()
 {
-	pthread_mutex_lock(&audio_cmd_mutex);
-	audio_cmd = CMD_QUIT;
-	pthread_mutex_unlock(&audio_cmd_mutex);
+	char name[PKT_MAX_PAYLOAD];
 
-	if (signal_cond_event() != 0) {
-		logger("ERROR: QUIT COMMAND FAILED\n");
-	}
+	while (play_queue_pop(name) == 0)
+		;
+	free(play_queue.names);
+	play_queue.names = NULL;
+	play_queue.size = 0;
 }
 
+/*
+ * Adds file to the play queue.
+ */
 void
-ff_command()
+queue_command(char *filename)
 {
-	pthread_mutex_lock(&audio_cmd_mutex);
-	audio_cmd = CMD_FF;
-	pthread_mutex_unlock(&audio_cmd_mutex);
-
-	if (signal_cond_event() != 0) {
-		logger("ERROR: FF COMMAND FAILED\n");
+	unsigned int idx;
+	char *name;
+
+	name = strdup(filename);
+	pthread_mutex_lock(&play_queue_mutex);
+	if (name == NULL || (play_queue.count == play_queue.size &&
+			play_queue_grow() == -1)) {
+		pthread_mutex_unlock(&play_queue_mutex);
+		free(name);
+		logger("ERROR: can't alloc memory for the play queue\n");
+		return;
 	}
+	idx = (play_queue.head + play_queue.count) % play_queue.size;
+	play_queue.names[idx] = name;
+	play_queue.count++;
+	pthread_mutex_unlock(&play_queue_mutex);
 }
 
+/*
+ * Queues a command for the audio thread and wakes it up.
+ */
 void
-rev_command()
+push_command(info_t cmd, char *str)
 {
-	pthread_mutex_lock(&audio_cmd_mutex);
-	audio_cmd = CMD_REV;
-	pthread_mutex_unlock(&audio_cmd_mutex);
-
-	if (signal_cond_event() != 0) {
-		logger("ERROR: REV COMMAND FAILED\n");
+	if (mailbox_push(cmd, str) == -1) {
+		logger("ERROR: mailbox full, command %d dropped\n", cmd);
+		return;
 	}
-}
 
-int
-signal_cond_event()
-{
-	/*
-	 *
-	 */
 	pthread_mutex_lock(&ao_event_mutex);
 	int ret = pthread_cond_signal(&ao_event);
 	if (ret != 0) {
 		logger("ERROR: pthread_cond_signal: %d\n", ret);
 	}
 	pthread_mutex_unlock(&ao_event_mutex);
-	return (0);
-}
-
-
-void
-pause_command()
-{
-	pthread_mutex_lock(&audio_cmd_mutex);
-	if (audio_cmd == CMD_PLAY || audio_cmd == STATUS_ACK) {
-		audio_cmd = CMD_PAUSE;
-	} else if (audio_cmd == CMD_PAUSE) {
-		audio_cmd = STATUS_ACK;
-		pthread_mutex_lock(&ao_event_mutex);
-		int ret = pthread_cond_signal(&ao_event);
-		if (ret != 0) {
-			logger("ERROR: pthread_cond_signal: %d\n", ret);
-		}
-		pthread_mutex_unlock(&ao_event_mutex);
-	}
-	pthread_mutex_unlock(&audio_cmd_mutex);
 }
 
 int
 init_network()
 {
-	int i, err, sock_fd;
+	int err, sock_fd;
 	struct sockaddr_in addr;
 	int in_queue = 5;
+	int on = 1;
 
 	memset(&addr, 0, sizeof (addr));
 	addr.sin_family = AF_INET;
@@ -694,19 +934,16 @@ init_network()
 		return (0);
 	}
 
-	// use loop to avoid 'Address already in use' bind error
-	for (i = 0;; i++) {
-		err = bind(sock_fd, (struct sockaddr *)&addr, sizeof (addr));
-		if (err == 0)
-			break;
-
-		if (i == 15) {
-			close(sock_fd);
-			return (0);
-		}
-
+	/*
+	 * Connections of a previous instance in TIME_WAIT don't block
+	 * bind, it fails only if another engine is listening.
+	 */
+	setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+	err = bind(sock_fd, (struct sockaddr *)&addr, sizeof (addr));
+	if (err) {
 		logger("ERROR: bind error: %s\n", strerror(errno));
-		sleep(3);
+		close(sock_fd);
+		return (0);
 	}
 
 	err = listen(sock_fd, in_queue);
@@ -719,128 +956,133 @@ init_network()
 	return (sock_fd);
 }
 
-int
-get_connection_fd()
+/*
+ * Handles a packet from UI, returns true on CMD_QUIT.
+ */
+static bool
+handle_packet(struct pkt *pkt)
 {
-	int conn_fd;
-	logger("socket_daemon - waiting for new connection..\n");
-	conn_fd = accept(sock_fd, NULL, NULL);
-	if (conn_fd == -1) {
-		logger("ERROR: accept error: %s\n", strerror(errno));
-		close(sock_fd);
-		return (-1);
+	char *str = pkt->data;
+
+	log_debug("received command: %d, seq %u\n", pkt->info, pkt->seq);
+	if (str)
+		log_debug("received string: %s\n", str);
+
+	switch (pkt->info) {
+	case CMD_PLAY:
+		logger("socket_daemon received CMD_PLAY\n");
+		if (str)
+			push_command(CMD_PLAY, str);
+		break;
+	case CMD_PAUSE:
+		logger("socket_daemon received CMD_PAUSE\n");
+		push_command(CMD_PAUSE, NULL);
+		break;
+	case CMD_STOP:
+		logger("socket_daemon received CMD_STOP\n");
+		push_command(CMD_STOP, NULL);
+		break;
+	case CMD_QUIT:
+		logger("socket_daemon received CMD_QUIT\n");
+		push_command(CMD_QUIT, NULL);
+		return (true);
+	case CMD_FF:
+		logger("socket_daemon received CMD_FF\n");
+		push_command(CMD_FF, NULL);
+		break;
+	case CMD_REV:
+		logger("socket_daemon received CMD_REV\n");
+		push_command(CMD_REV, NULL);
+		break;
+	case CMD_SEEK:
+		logger("socket_daemon received CMD_SEEK\n");
+		if (str)
+			push_command(CMD_SEEK, str);
+		break;
+	case CMD_QUEUE:
+		logger("socket_daemon received CMD_QUEUE\n");
+		if (str)
+			queue_command(str);
+		break;
+	default:
+		;;
 	}
-	logger("new connection, conn_fd: %d\n", conn_fd);
-	return (conn_fd);
+	return (false);
 }
 
 /*
- * Receives commands from ui using socket connection.
+ * Command from the UI running in the engine process (single-process
+ * mode).  Goes to the same handler as packets from clients, without
+ * the socket round trip.  Safe to call from any thread.
  */
 int
-engine_socket_receiver()
+engine_command(info_t cmd, const char *str)
 {
-	int len;
-	char *str_buf;
-	bool has_content = false;
-
-	struct pkt_header pkt_hdr, host_pkt_hdr;
-	host_pkt_hdr.info = CMD_UNKNOWN;
+	struct pkt pkt;
+
+	pkt.info = cmd;
+	pkt.seq = 0;
+	pkt.data = (char *)str;
+	if (str == NULL) {
+		pkt.type = PAYLOAD_NONE;
+		pkt.size = 0;
+	} else {
+		pkt.type = PAYLOAD_STRING;
+		pkt.size = strlen(str) + 1;
+		if (pkt.size > PKT_MAX_PAYLOAD) {
+			errno = EMSGSIZE;
+			return (-1);
+		}
+	}
 
-	for (;;) {
-		logger("reading from socket..\n");
-		len = read(conn_fd, &pkt_hdr, sizeof (pkt_hdr));
+	if (handle_packet(&pkt))
+		event_loop_stop();
+	return (0);
+}
 
-		logger("read %d bytes from socket\n", len);
-		if (len == 0) {
-			logger("ERROR: - connection closed (initial read)\n");
-			break;
-		}
-		if (len < sizeof (pkt_hdr)) {
-			logger("ERROR: - received less bytes from socket\n");
+/*
+ * Event loop wakeup - queued status events go to subscribed clients.
+ */
+static void
+send_status()
+{
+	struct status_event ev;
+	char value[8];
+
+	while (event_queue_pop(&ev) == 0) {
+		switch (ev.status) {
+		case STATUS_POSITION:
+		case STATUS_DURATION:
+		case STATUS_BUFFER:
+			pkt_put_uint64(value, ev.value);
+			broadcast_packet(ev.status, PAYLOAD_UINT64, value,
+				sizeof (value), ev.seq);
 			break;
+		default:
+			broadcast_packet(ev.status, PAYLOAD_NONE, NULL, 0,
+				ev.seq);
 		}
+	}
+}
 
-		host_pkt_hdr.info = ntohl(pkt_hdr.info);
-		host_pkt_hdr.size = ntohl(pkt_hdr.size);
-		logger("receiver host_pkg_hdr.info: %d\n", (unsigned int)host_pkt_hdr.info);
-		logger("receiver host_pkg_hdr.size: %d\n", (unsigned int)host_pkt_hdr.size);
+int
+engine_socket_receiver()
+{
+	struct event_handlers handlers = { handle_packet, send_status };
+	int err;
 
-		if (host_pkt_hdr.size > 0) {
-			str_buf = malloc(host_pkt_hdr.size);
-			if (!str_buf) {
-				logger("ERROR: malloc error: %s\n", strerror(errno));
-				break;
-			}
-			has_content = true;
-
-			len = read(conn_fd, str_buf, host_pkt_hdr.size);
-			if (len == 0) {
-				logger("ERROR: socket_daemon() - connection closed\n");
-				break;
-			} else if (len < sizeof (str_buf)) {
-				logger("ERROR: read less then buffer\n");
-				break;
-			}
-		} else {
-			has_content = false;
-		}
+	err = event_loop_run(&handlers);
+	if (event_queue_dropped() > 0)
+		logger("status events dropped: %u\n", event_queue_dropped());
 
-		logger("received command: %d\n", host_pkt_hdr.info);
-		if (has_content) {
-			logger("received string: %s\n", str_buf);
-		}
+	// UI is gone
+	if (err == -1)
+		push_command(CMD_QUIT, NULL);
 
-		switch (host_pkt_hdr.info) {
-		case CMD_PLAY:
-			logger("socket_daemon received CMD_PLAY\n");
-			play_command(str_buf);
-			break;
-		case CMD_PAUSE:
-			logger("socket_daemon received CMD_PAUSE\n");
-			pause_command();
-			break;
-		case CMD_STOP:
-			logger("socket_daemon received CMD_STOP\n");
-			stop_command();
-			break;
-		case CMD_QUIT:
-			logger("socket_daemon received CMD_QUIT\n");
-			quit_command();
-			close(conn_fd);
-			close(sock_fd);
-			if (pthread_kill(ao_thread, 0) == 0) {
-				logger("waiting for audio thread..\n");
-				pthread_join(ao_thread, NULL);
-			}
-			return (0);
-		case CMD_FF:
-			logger("socket_daemon received CMD_FF\n");
-			ff_command();
-			break;
-		case CMD_REV:
-			logger("socket_daemon received CMD_REV\n");
-			rev_command();
-			break;
-		default:
-			;;
-		}
-		if (has_content) {
-			free(str_buf);
-			has_content = false;
-		}
-	}
-	// we are here if error occurred
-	stop_command();
-	if (has_content) {
-		free(str_buf);
-		has_content = false;
-	}
-	close(conn_fd);
-	close(sock_fd);
+	event_loop_close();
 	if (pthread_kill(ao_thread, 0) == 0) {
 		logger("waiting for audio thread..\n");
 		pthread_join(ao_thread, NULL);
 	}
-	return (-1);
+	return (err);
 }
@@ -1 +1,18 @@
-int engine_daemon();
+#include "protocol.h"
+#include "resample.h"
+
+int engine_init(int ui_fd);
+int engine_run();
+int engine_daemon(int ui_fd);
+int engine_command(info_t cmd, const char *str);
+
+// amount of decoded audio (in ms) buffered ahead of the audio device
+extern unsigned int pcm_buffer_ms;
+
+// how often clients get position updates (in ms), 0 - never
+#define	STATUS_INTERVAL_DEFAULT_MS 250
+extern unsigned int status_interval_ms;
+
+// audio device rate when resampling is enabled, 0 - disabled
+extern unsigned int resample_rate;
+extern resample_quality_t resample_quality;
@@ -11,6 +11,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "mailbox.h"
 #include "protocol.h"
 
 typedef enum {
@@ -22,27 +23,24 @@ typedef enum {
 	EXIT_REASON_EOF
 } exit_reason_t;
 
-typedef enum {
-	CODEC_STATUS_UNKNOWN,
-	CODEC_STATUS_ERROR,
-	CODEC_STATUS_PLAY,
-	CODEC_STATUS_EXIT_PLAY_OTHER,
-	CODEC_STATUS_STOP,
-	CODEC_STATUS_PAUSE,
-	CODEC_STATUS_QUIT,
-	CODEC_STATUS_EOF
-} codec_status_t;
-
+// CMD_FF and CMD_REV
+#define	SEEK_STEP_SEC 10
 
 extern char *current_filename;
 extern ao_sample_format format;
 extern ao_device *device;
 
-extern int open_audio_device();
-extern pthread_mutex_t audio_cmd_mutex;
-extern info_t audio_cmd;
+struct pcm_block;
 
-extern pthread_mutex_t codec_status_mutex;
-extern codec_status_t codec_status;
+extern int open_audio_device();
+extern void log_pcm_ring_stats();
+extern struct pcm_block *get_pcm_block();
+extern void commit_pcm_block();
+extern void flush_pcm_output();
+extern void set_track_duration(unsigned int duration_ms);
+extern void set_track_position(unsigned long long frame, unsigned int rate);
+extern int seek_position(const char *str, unsigned int rate,
+	unsigned long long *pos);
+extern bool next_command(struct engine_cmd *cmd);
 
 #endif
@@ -0,0 +1,222 @@
+#include <ctype.h>
+#include <dlfcn.h>
+#include <string.h>
+
+#include "audio_codec_mad.h"
+#include "audio_codec_sndfile.h"
+#include "codec.h"
+#include "logger.h"
+#include "utils.h"
+
+static const struct codec *codecs[CODEC_MAX];
+static unsigned int codecs_num;
+
+// library handle of each codec, loaded on first use
+static void *libs[CODEC_MAX];
+static bool load_failed[CODEC_MAX];
+
+/*
+ * Codec chosen by benchmark for an extension which more codecs can
+ * decode, measured once per engine run.
+ */
+static struct codec_choice {
+	char ext[CODEC_EXT_MAX];
+	unsigned int codec;
+} choices[CODEC_MAX];
+static unsigned int choices_num;
+
+// decoded audio of benchmarks is thrown away here
+static char bench_buf[16384];
+
+int
+codec_register(const struct codec *c)
+{
+	if (codecs_num == CODEC_MAX)
+		return (-1);
+	codecs[codecs_num++] = c;
+	return (0);
+}
+
+/*
+ * Registers built-in codecs, earlier ones are preferred if benchmark
+ * can't tell them apart.
+ */
+void
+codec_init()
+{
+	codec_register(&mad_codec);
+	codec_register(&sndfile_codec);
+}
+
+static int
+load_codec(unsigned int i)
+{
+	const char *const *name;
+	void *lib = NULL;
+
+	if (libs[i] != NULL)
+		return (0);
+	if (load_failed[i])
+		return (-1);
+
+	for (name = codecs[i]->libraries; *name != NULL; name++) {
+		lib = dlopen(*name, RTLD_NOW | RTLD_LOCAL);
+		if (lib != NULL)
+			break;
+	}
+	if (lib == NULL) {
+		logger("codec %s: can't load library: %s\n", codecs[i]->name,
+			dlerror());
+		load_failed[i] = true;
+		return (-1);
+	}
+	if (codecs[i]->load(lib) == -1) {
+		logger("codec %s: missing symbols in %s\n", codecs[i]->name,
+			*name);
+		dlclose(lib);
+		load_failed[i] = true;
+		return (-1);
+	}
+	logger("codec %s: loaded %s\n", codecs[i]->name, *name);
+	libs[i] = lib;
+	return (0);
+}
+
+/*
+ * Lowercase extension of path, empty if there is none or it is too long.
+ */
+static void
+get_extension(const char *path, char *ext)
+{
+	const char *dot;
+	int i;
+
+	ext[0] = '\0';
+	dot = strrchr(path, '.');
+	if (dot == NULL || strchr(dot, '/') != NULL ||
+			strlen(dot + 1) >= CODEC_EXT_MAX)
+		return;
+	for (i = 0; dot[i + 1] != '\0'; i++)
+		ext[i] = tolower((unsigned char)dot[i + 1]);
+	ext[i] = '\0';
+}
+
+static bool
+has_extension(const struct codec *c, const char *ext)
+{
+	const char *const *e;
+
+	for (e = c->extensions; *e != NULL; e++) {
+		if (strcmp(*e, ext) == 0)
+			return (true);
+	}
+	return (false);
+}
+
+/*
+ * Decodes CODEC_BENCH_SEC of the file, returns frames per second of CPU
+ * time or 0 if the codec can't decode it.
+ */
+static unsigned long long
+bench_codec(const struct codec *c, const char *path)
+{
+	struct codec_info info;
+	unsigned long long frames = 0, limit, cpu_us;
+	unsigned long chunk;
+	long n;
+
+	if (c->open(path, &info) == -1)
+		return (0);
+
+	chunk = sizeof (bench_buf) / (info.bits / 8 * info.channels);
+	limit = (unsigned long long)CODEC_BENCH_SEC * info.rate;
+	cpu_us = get_thread_cpu_us();
+	while (frames < limit && (n = c->decode(bench_buf, chunk)) > 0)
+		frames += n;
+	cpu_us = get_thread_cpu_us() - cpu_us;
+	c->close();
+
+	if (cpu_us == 0)
+		cpu_us = 1;
+	logger("codec %s: %llu frames in %llu us CPU\n", c->name, frames,
+		cpu_us);
+	return (frames * 1000000 / cpu_us);
+}
+
+static const struct codec *
+choose_codec(const char *ext, const char *path, unsigned int *cand,
+	unsigned int n)
+{
+	unsigned long long fps, best_fps = 0;
+	unsigned int i, best = cand[0];
+
+	for (i = 0; i < choices_num; i++) {
+		if (strcmp(choices[i].ext, ext) == 0)
+			return (codecs[choices[i].codec]);
+	}
+
+	for (i = 0; i < n; i++) {
+		fps = bench_codec(codecs[cand[i]], path);
+		if (fps > best_fps) {
+			best_fps = fps;
+			best = cand[i];
+		}
+	}
+	// not remembered when the file itself is bad
+	if (best_fps > 0 && choices_num < CODEC_MAX) {
+		snprintf(choices[choices_num].ext, CODEC_EXT_MAX, "%s", ext);
+		choices[choices_num].codec = best;
+		choices_num++;
+	}
+	logger("codec %s chosen for .%s files\n", codecs[best]->name, ext);
+	return (codecs[best]);
+}
+
+/*
+ * Returns codec for the file, loading its library if needed.
+ */
+const struct codec *
+codec_find(const char *path)
+{
+	char ext[CODEC_EXT_MAX];
+	unsigned int cand[CODEC_MAX];
+	unsigned int i, n = 0;
+	int type;
+
+	// mislabelled files get the codec of their real format
+	if (sniff_file_types) {
+		type = get_file_type((char *)path);
+		if (type == -1)
+			return (NULL);
+		snprintf(ext, sizeof (ext), "%s", supported_files[type]);
+	} else {
+		get_extension(path, ext);
+	}
+	if (ext[0] == '\0')
+		return (NULL);
+
+	for (i = 0; i < codecs_num; i++) {
+		if (!has_extension(codecs[i], ext) || load_codec(i) == -1)
+			continue;
+		if (codecs[i]->probe == NULL || codecs[i]->probe(path, ext))
+			cand[n++] = i;
+	}
+
+	if (n == 0)
+		return (NULL);
+	if (n == 1)
+		return (codecs[cand[0]]);
+	return (choose_codec(ext, path, cand, n));
+}
+
+void
+codec_unload()
+{
+	unsigned int i;
+
+	for (i = 0; i < codecs_num; i++) {
+		if (libs[i] != NULL)
+			dlclose(libs[i]);
+		libs[i] = NULL;
+	}
+}
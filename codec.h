@@ -0,0 +1,54 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdbool.h>
+
+/*
+ * Audio decoders.  Each codec is a table of functions registered with
+ * codec_register().  Its library is loaded with dlopen() when a file
+ * first needs the codec, so libraries of unused formats are never
+ * mapped.  A codec decodes one file at a time.
+ */
+
+#define	CODEC_MAX 8
+#define	CODEC_EXT_MAX 8		/* longest extension, with '\0' */
+#define	CODEC_TAG_MAX 64	/* UTF-8 tag field, with '\0' */
+
+// audio decoded by each codec when more of them can play a format
+#define	CODEC_BENCH_SEC 5
+
+struct codec_info {
+	unsigned int rate;
+	unsigned int channels;
+	unsigned int bits;		/* 16 or 32, native endian */
+	unsigned long long frames;	/* exact length, 0 if unknown */
+	unsigned int duration_ms;	/* may be estimated */
+	unsigned int bitrate;		/* kbps, average, 0 if unknown */
+	char title[CODEC_TAG_MAX];	/* tags, empty if missing */
+	char artist[CODEC_TAG_MAX];
+	char album[CODEC_TAG_MAX];
+};
+
+struct codec {
+	const char *name;
+	const char *const *libraries;	/* dlopen() tries them in order */
+	const char *const *extensions;	/* lowercase, NULL terminated */
+
+	// resolves library symbols, returns -1 if some is missing
+	int (*load)(void *lib);
+	// checks file with extension ext can be decoded, NULL if all can
+	bool (*probe)(const char *path, const char *ext);
+	int (*open)(const char *path, struct codec_info *info);
+	// returns number of frames, 0 at the end of file, -1 on error
+	long (*decode)(void *buf, unsigned long frames);
+	// returns new position in frames or -1
+	long long (*seek)(unsigned long long frame);
+	void (*close)();
+};
+
+int codec_register(const struct codec *c);
+void codec_init();
+const struct codec *codec_find(const char *path);
+void codec_unload();
+
+#endif
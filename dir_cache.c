@@ -0,0 +1,145 @@
+#include <sys/param.h>
+
+#include "dir_cache.h"
+
+static struct dir_cache_slot {
+	char path[MAXPATHLEN];
+	struct dir_listing listing;
+	size_t bytes;
+	unsigned long long used;	/* 0 - empty slot */
+} cache[DIR_CACHE_SLOTS];
+static unsigned long long cache_tick;
+static size_t cache_bytes;
+
+static size_t
+listing_bytes(const struct dir_contents *contents)
+{
+	return (sizeof (*contents) + contents->size *
+		sizeof (*contents->list) + contents->names_size);
+}
+
+static void
+free_slot(struct dir_cache_slot *s)
+{
+	cache_bytes -= s->bytes;
+	free_dir_contents(s->listing.contents);
+	free(s->listing.contents);
+	memset(s, 0, sizeof (*s));
+}
+
+static struct dir_cache_slot *
+oldest_slot()
+{
+	struct dir_cache_slot *oldest = NULL;
+	unsigned int i;
+
+	for (i = 0; i < DIR_CACHE_SLOTS; i++) {
+		if (cache[i].used == 0)
+			continue;
+		if (oldest == NULL || cache[i].used < oldest->used)
+			oldest = &cache[i];
+	}
+	return (oldest);
+}
+
+static struct dir_cache_slot *
+find_slot(const char *path)
+{
+	unsigned int i;
+
+	for (i = 0; i < DIR_CACHE_SLOTS; i++) {
+		if (cache[i].used != 0 && strcmp(cache[i].path, path) == 0)
+			return (&cache[i]);
+	}
+	return (NULL);
+}
+
+static bool
+listing_valid(const struct dir_listing *l, const struct stat *st)
+{
+	return (l->st.st_dev == st->st_dev && l->st.st_ino == st->st_ino &&
+		l->st.st_mtime == st->st_mtime &&
+		l->st.st_nlink == st->st_nlink);
+}
+
+/*
+ * Takes the listing of a directory being left, l->contents is owned by
+ * the cache after the call.  mtime has one second resolution, listings
+ * read in the second of the last change are not kept.
+ */
+void
+dir_cache_put(const char *path, struct dir_listing *l)
+{
+	struct dir_cache_slot *s;
+	size_t bytes;
+	unsigned int i;
+
+	s = find_slot(path);
+	if (s != NULL)
+		free_slot(s);
+	if (l->contents == NULL)
+		return;
+
+	bytes = listing_bytes(l->contents);
+	if (bytes > DIR_CACHE_BYTES || strlen(path) >= MAXPATHLEN ||
+			l->st.st_mtime >= l->scanned) {
+		free_dir_contents(l->contents);
+		free(l->contents);
+		l->contents = NULL;
+		return;
+	}
+
+	while (cache_bytes + bytes > DIR_CACHE_BYTES)
+		free_slot(oldest_slot());
+	for (i = 0, s = NULL; i < DIR_CACHE_SLOTS && s == NULL; i++) {
+		if (cache[i].used == 0)
+			s = &cache[i];
+	}
+	if (s == NULL) {
+		s = oldest_slot();
+		free_slot(s);
+	}
+
+	snprintf(s->path, sizeof (s->path), "%s", path);
+	s->listing = *l;
+	s->bytes = bytes;
+	s->used = ++cache_tick;
+	cache_bytes += bytes;
+	l->contents = NULL;
+}
+
+/*
+ * Moves a valid listing of path to l and returns 0, the caller owns
+ * l->contents.  Returns -1 if the directory has to be read.
+ */
+int
+dir_cache_get(const char *path, struct dir_listing *l)
+{
+	struct dir_cache_slot *s;
+	struct stat st;
+
+	s = find_slot(path);
+	if (s == NULL)
+		return (-1);
+	if (stat(path, &st) == -1 || !listing_valid(&s->listing, &st)) {
+		free_slot(s);
+		return (-1);
+	}
+
+	*l = s->listing;
+	s->listing.contents = NULL;
+	cache_bytes -= s->bytes;
+	memset(s, 0, sizeof (*s));
+	return (0);
+}
+
+void
+dir_cache_clear()
+{
+	unsigned int i;
+
+	for (i = 0; i < DIR_CACHE_SLOTS; i++) {
+		if (cache[i].used != 0)
+			free_slot(&cache[i]);
+	}
+}
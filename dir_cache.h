@@ -0,0 +1,31 @@
+#ifndef DIR_CACHE_H
+#define DIR_CACHE_H
+
+#include <sys/stat.h>
+#include <time.h>
+
+#include "utils.h"
+
+/*
+ * Listings of recently left directories with their scroll position.  A
+ * listing is used again while the directory has the same mtime, the
+ * least recently left ones are freed when the cache is over its memory
+ * limit.
+ */
+
+#define	DIR_CACHE_SLOTS 32
+#define	DIR_CACHE_BYTES (16 * 1024 * 1024)
+
+struct dir_listing {
+	struct dir_contents *contents;
+	struct stat st;		/* of the directory before it was read */
+	time_t scanned;
+	unsigned int head_idx;
+	unsigned int cur_idx;
+};
+
+void dir_cache_put(const char *path, struct dir_listing *l);
+int dir_cache_get(const char *path, struct dir_listing *l);
+void dir_cache_clear();
+
+#endif
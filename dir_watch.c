@@ -0,0 +1,123 @@
+#include <sys/param.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "dir_watch.h"
+#include "utils.h"
+
+static char watch_path[MAXPATHLEN];
+static int watch_fd = -1;
+
+// polling fallback, directory stat of the last check
+static struct stat watch_st;
+static bool watch_recent;
+
+int
+dir_watch_start(const char *path)
+{
+	dir_watch_stop();
+	snprintf(watch_path, sizeof (watch_path), "%s", path);
+
+#ifdef __linux__
+	watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch_fd != -1 && inotify_add_watch(watch_fd, path,
+			IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM |
+			IN_MOVED_TO | IN_ONLYDIR) != -1)
+		return (0);
+	if (watch_fd != -1)
+		close(watch_fd);
+	watch_fd = -1;
+#endif
+	if (stat(path, &watch_st) == -1)
+		return (-1);
+	watch_recent = (watch_st.st_mtime >= time(NULL) - 1);
+	return (0);
+}
+
+void
+dir_watch_stop()
+{
+	if (watch_fd != -1)
+		close(watch_fd);
+	watch_fd = -1;
+	watch_path[0] = '\0';
+}
+
+#ifdef __linux__
+/*
+ * A file is usually created empty and written later, so names closed
+ * after writing are reported as changed.  Events of a long burst are
+ * read but not passed to fn.
+ */
+static int
+read_inotify(dir_event_fn fn, void *arg)
+{
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	const struct inotify_event *ev;
+	ssize_t len, pos;
+	int n = 0;
+	bool rescan = false;
+
+	while ((len = read(watch_fd, u.buf, sizeof (u.buf))) > 0) {
+		for (pos = 0; pos < len; pos += sizeof (*ev) + ev->len) {
+			ev = (const struct inotify_event *)(u.buf + pos);
+			if (ev->mask & IN_Q_OVERFLOW) {
+				rescan = true;
+				continue;
+			}
+			if (ev->len == 0)
+				continue;
+			if (++n > DIR_WATCH_BATCH_MAX)
+				rescan = true;
+			if (rescan)
+				continue;
+			if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+				fn(DIR_WATCH_REMOVE, ev->name, arg);
+			else if (ev->mask & IN_CLOSE_WRITE)
+				fn(DIR_WATCH_CHANGE, ev->name, arg);
+			else
+				fn(DIR_WATCH_ADD, ev->name, arg);
+		}
+	}
+	return (rescan ? DIR_WATCH_RESCAN : n);
+}
+#endif
+
+/*
+ * mtime has one second resolution, changes in the second of the last
+ * check are caught by one more rescan.
+ */
+static int
+poll_stat()
+{
+	struct stat st;
+	bool changed;
+
+	if (watch_path[0] == '\0' || stat(watch_path, &st) == -1)
+		return (0);
+	changed = watch_recent || st.st_mtime != watch_st.st_mtime ||
+		st.st_size != watch_st.st_size ||
+		st.st_nlink != watch_st.st_nlink;
+	watch_recent = (st.st_mtime >= time(NULL) - 1);
+	watch_st = st;
+	return (changed ? DIR_WATCH_RESCAN : 0);
+}
+
+/*
+ * Calls fn for every change since the last call.  Returns number of
+ * changes or DIR_WATCH_RESCAN if they are not known.
+ */
+int
+dir_watch_read(dir_event_fn fn, void *arg)
+{
+#ifdef __linux__
+	if (watch_fd != -1)
+		return (read_inotify(fn, arg));
+#endif
+	return (poll_stat());
+}
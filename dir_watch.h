@@ -0,0 +1,32 @@
+#ifndef DIR_WATCH_H
+#define DIR_WATCH_H
+
+/*
+ * Changes of one directory.  inotify reports every added, removed and
+ * written name on Linux, other systems (and Linux out of watches) compare
+ * directory stat between polls and ask for a rescan.
+ */
+
+// how often the UI checks for changes while waiting for a key
+#define	DIR_WATCH_POLL_MS 250
+
+// dir_watch_read() result when the listing has to be read again
+#define	DIR_WATCH_RESCAN -1
+
+// more changes at once are cheaper to apply by a rescan
+#define	DIR_WATCH_BATCH_MAX 64
+
+typedef enum {
+	DIR_WATCH_ADD,
+	DIR_WATCH_REMOVE,
+	DIR_WATCH_CHANGE	/* closed after writing, may be new too */
+} dir_event_t;
+
+typedef void (*dir_event_fn)(dir_event_t event, const char *name,
+	void *arg);
+
+int dir_watch_start(const char *path);
+void dir_watch_stop();
+int dir_watch_read(dir_event_fn fn, void *arg);
+
+#endif
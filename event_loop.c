@@ -0,0 +1,350 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+
+#include "event_loop.h"
+#include "logger.h"
+
+struct client {
+	int fd;
+	bool owner;		/* engine quits when it disconnects */
+	bool subscribed;
+	struct pkt_reader reader;
+	char out[CLIENT_OUT_SIZE];
+	size_t out_start;
+	size_t out_len;
+	unsigned long dropped;
+};
+
+static struct client clients[MAX_CLIENTS];
+static int listen_fd = -1;
+static bool owner_seen;
+
+// read by the output thread to skip position updates
+static atomic_int subscribers;
+
+// written by other threads to wake up poll()
+static int wakeup_pipe[2] = { -1, -1 };
+static atomic_bool stop_requested;
+
+static int
+set_nonblocking(int fd)
+{
+	int flags;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1)
+		return (-1);
+	return (fcntl(fd, F_SETFL, flags | O_NONBLOCK));
+}
+
+static struct client *
+add_client(int fd, bool owner)
+{
+	struct client *c;
+	int i;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].fd == -1)
+			break;
+	}
+	if (i == MAX_CLIENTS || set_nonblocking(fd) == -1)
+		return (NULL);
+
+	c = &clients[i];
+	c->fd = fd;
+	c->owner = owner;
+	c->subscribed = false;
+	c->out_start = 0;
+	c->out_len = 0;
+	c->dropped = 0;
+	pkt_reader_init(&c->reader);
+	logger("client %d connected, fd %d\n", i, fd);
+	return (c);
+}
+
+static void
+remove_client(struct client *c)
+{
+	logger("client fd %d disconnected, %lu packets, %lu dropped\n",
+		c->fd, c->reader.packets, c->dropped);
+	if (c->subscribed)
+		atomic_fetch_sub(&subscribers, 1);
+	close(c->fd);
+	c->fd = -1;
+}
+
+/*
+ * Uses listening socket for TCP clients and/or owner_fd, the UI end of
+ * socketpair.  Without owner_fd the first TCP client is the owner.
+ */
+int
+event_loop_init(int lfd, int owner_fd)
+{
+	int i;
+
+	for (i = 0; i < MAX_CLIENTS; i++)
+		clients[i].fd = -1;
+
+	if (pipe(wakeup_pipe) == -1)
+		return (-1);
+	set_nonblocking(wakeup_pipe[0]);
+	set_nonblocking(wakeup_pipe[1]);
+
+	listen_fd = lfd;
+	owner_seen = false;
+	atomic_store(&stop_requested, false);
+	if (owner_fd != -1) {
+		if (add_client(owner_fd, true) == NULL)
+			return (-1);
+		owner_seen = true;
+	}
+	return (0);
+}
+
+/*
+ * Safe to call from any thread, never blocks.
+ */
+void
+event_loop_wakeup()
+{
+	char c = 0;
+
+	// pipe already non-empty if the write fails
+	(void) write(wakeup_pipe[1], &c, 1);
+}
+
+/*
+ * Makes event_loop_run() return 0 as on a quit command, for commands
+ * which don't come from a client.
+ */
+void
+event_loop_stop()
+{
+	atomic_store(&stop_requested, true);
+	event_loop_wakeup();
+}
+
+bool
+event_loop_has_subscribers()
+{
+	return (atomic_load_explicit(&subscribers, memory_order_relaxed) > 0);
+}
+
+/*
+ * Writes as much of the output queue as the socket takes.
+ */
+static int
+flush_client(struct client *c)
+{
+	ssize_t len;
+
+	while (c->out_len > 0) {
+		len = write(c->fd, c->out + c->out_start, c->out_len);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return (0);
+			return (-1);
+		}
+		c->out_start += len;
+		c->out_len -= len;
+	}
+	c->out_start = 0;
+	return (0);
+}
+
+static void
+queue_packet(struct client *c, const char *pkt, size_t len)
+{
+	if (c->out_start + c->out_len + len > CLIENT_OUT_SIZE) {
+		memmove(c->out, c->out + c->out_start, c->out_len);
+		c->out_start = 0;
+	}
+	// slow client, drop the packet rather than wait
+	if (c->out_len + len > CLIENT_OUT_SIZE) {
+		c->dropped++;
+		return;
+	}
+	memcpy(c->out + c->out_start + c->out_len, pkt, len);
+	c->out_len += len;
+
+	// on error poll() reports the client as gone
+	(void) flush_client(c);
+}
+
+/*
+ * Sends packet to all subscribed clients, called only by the loop
+ * thread.
+ */
+void
+broadcast_packet(info_t info, payload_t type, const void *data, size_t size,
+	uint32_t seq)
+{
+	char pkt[sizeof (struct pkt_header) + PKT_MAX_PAYLOAD];
+	size_t len;
+	int i;
+
+	if (size > PKT_MAX_PAYLOAD)
+		return;
+
+	len = pkt_encode(pkt, info, type, data, size, seq);
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].fd != -1 && clients[i].subscribed)
+			queue_packet(&clients[i], pkt, len);
+	}
+}
+
+static void
+accept_client()
+{
+	struct client *c;
+	int fd;
+
+	fd = accept(listen_fd, NULL, NULL);
+	if (fd == -1) {
+		logger("ERROR: accept error: %s\n", strerror(errno));
+		return;
+	}
+
+	c = add_client(fd, !owner_seen);
+	if (c == NULL) {
+		logger("ERROR: too many clients\n");
+		close(fd);
+		return;
+	}
+	owner_seen = true;
+}
+
+/*
+ * Returns -1 if the client is gone, 1 on quit command.
+ */
+static int
+read_client(struct client *c, const struct event_handlers *handlers)
+{
+	struct pkt pkt;
+	ssize_t len;
+	int ret;
+
+	len = pkt_reader_fill(&c->reader, c->fd);
+	if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return (0);
+	if (len <= 0)
+		return (-1);
+
+	// one read may carry several packets
+	while ((ret = pkt_reader_next(&c->reader, &pkt)) == 1) {
+		if (pkt.info == CMD_SUBSCRIBE) {
+			if (!c->subscribed)
+				atomic_fetch_add(&subscribers, 1);
+			c->subscribed = true;
+			continue;
+		}
+		if (handlers->packet(&pkt))
+			return (1);
+	}
+	if (ret == -1) {
+		logger("ERROR: invalid packet from fd %d\n", c->fd);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Serves clients until a quit command (returns 0) or until the owner
+ * disconnects (returns -1).
+ */
+int
+event_loop_run(const struct event_handlers *handlers)
+{
+	struct pollfd fds[MAX_CLIENTS + 2];
+	int map[MAX_CLIENTS + 2];
+	struct client *c;
+	char buf[64];
+	int i, n, ret;
+
+	for (;;) {
+		n = 0;
+		fds[n].fd = wakeup_pipe[0];
+		fds[n].events = POLLIN;
+		map[n++] = -1;
+		if (listen_fd != -1) {
+			fds[n].fd = listen_fd;
+			fds[n].events = POLLIN;
+			map[n++] = -1;
+		}
+		for (i = 0; i < MAX_CLIENTS; i++) {
+			c = &clients[i];
+			if (c->fd == -1)
+				continue;
+			fds[n].fd = c->fd;
+			fds[n].events = POLLIN;
+			if (c->out_len > 0)
+				fds[n].events |= POLLOUT;
+			map[n++] = i;
+		}
+
+		if (poll(fds, n, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			logger("ERROR: poll error: %s\n", strerror(errno));
+			return (-1);
+		}
+
+		if (fds[0].revents & POLLIN) {
+			while (read(wakeup_pipe[0], buf, sizeof (buf)) > 0)
+				;
+			handlers->wakeup();
+			if (atomic_load(&stop_requested))
+				return (0);
+		}
+		if (listen_fd != -1 && (fds[1].revents & POLLIN))
+			accept_client();
+
+		for (i = 0; i < n; i++) {
+			if (map[i] == -1 || fds[i].revents == 0)
+				continue;
+			c = &clients[map[i]];
+			// removed while handling a previous event
+			if (c->fd != fds[i].fd)
+				continue;
+
+			ret = 0;
+			if (fds[i].revents & POLLOUT)
+				ret = flush_client(c);
+			if (ret == 0 &&
+					(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				ret = read_client(c, handlers);
+			if (ret == 1)
+				return (0);
+			if (ret == -1) {
+				remove_client(c);
+				if (c->owner)
+					return (-1);
+			}
+		}
+	}
+}
+
+/*
+ * Sends queued packets which fit into socket buffers and closes all
+ * clients.
+ */
+void
+event_loop_close()
+{
+	int i;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].fd == -1)
+			continue;
+		flush_client(&clients[i]);
+		remove_client(&clients[i]);
+	}
+	if (listen_fd != -1)
+		close(listen_fd);
+	listen_fd = -1;
+	close(wakeup_pipe[0]);
+	close(wakeup_pipe[1]);
+}
@@ -0,0 +1,34 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdbool.h>
+
+#include "protocol.h"
+
+/*
+ * Engine side of the protocol: a single thread serves all clients with
+ * poll(), the UI and other controllers.  Each client has a bounded
+ * output queue flushed with non-blocking writes.  When the queue of a
+ * client which doesn't read is full, its packets are dropped, so it
+ * never blocks the loop, other clients or the audio threads.  Commands
+ * are still read from such client.
+ */
+
+#define	MAX_CLIENTS 16
+#define	CLIENT_OUT_SIZE 16384
+
+struct event_handlers {
+	bool (*packet)(struct pkt *pkt);	/* returns true to quit */
+	void (*wakeup)();
+};
+
+int event_loop_init(int listen_fd, int owner_fd);
+int event_loop_run(const struct event_handlers *handlers);
+void event_loop_close();
+void event_loop_wakeup();
+void event_loop_stop();
+bool event_loop_has_subscribers();
+void broadcast_packet(info_t info, payload_t type, const void *data,
+	size_t size, uint32_t seq);
+
+#endif
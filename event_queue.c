@@ -0,0 +1,91 @@
+#include "event_queue.h"
+#include "mpsc_ring.h"
+
+static atomic_uint seq[EVENT_QUEUE_SIZE];
+static struct status_event events[EVENT_QUEUE_SIZE];
+static struct mpsc_ring ring;
+
+// latest value of coalesced events, bit per status in pending
+static atomic_ullong latest[EVENT_COALESCE_MAX];
+static atomic_uint pending;
+
+void
+event_queue_init()
+{
+	mpsc_ring_init(&ring, seq, events, sizeof (events[0]),
+		EVENT_QUEUE_SIZE);
+	atomic_init(&pending, 0);
+}
+
+static int
+post_coalesced(info_t status, unsigned long long value)
+{
+	if (status >= EVENT_COALESCE_MAX)
+		return (-1);
+	atomic_store_explicit(&latest[status], value, memory_order_relaxed);
+	atomic_fetch_or_explicit(&pending, 1U << status, memory_order_release);
+	return (0);
+}
+
+/*
+ * Returns -1 if the queue is full, the event is counted as dropped.
+ */
+int
+event_queue_post(info_t status, unsigned long long value, bool coalesce)
+{
+	struct status_event *ev;
+	unsigned int pos, ticket;
+
+	if (coalesce)
+		return (post_coalesced(status, value));
+
+	ev = mpsc_ring_reserve(&ring, &pos, &ticket);
+	if (ev == NULL)
+		return (-1);
+
+	ev->status = status;
+	ev->seq = ticket + 1;
+	ev->value = value;
+	mpsc_ring_publish(&ring, pos);
+	return (0);
+}
+
+/*
+ * Queued events first, in order, then the latest coalesced events.
+ * Returns -1 if there is no event.
+ */
+int
+event_queue_pop(struct status_event *ev)
+{
+	struct status_event *queued;
+	unsigned int bits;
+	info_t status;
+
+	queued = mpsc_ring_peek(&ring);
+	if (queued != NULL) {
+		*ev = *queued;
+		mpsc_ring_release(&ring);
+		return (0);
+	}
+
+	bits = atomic_load_explicit(&pending, memory_order_acquire);
+	if (bits == 0)
+		return (-1);
+
+	// lowest pending status
+	for (status = 0; !(bits & (1U << status)); status++)
+		;
+	atomic_fetch_and_explicit(&pending, ~(1U << status),
+		memory_order_acquire);
+	ev->status = status;
+	ev->seq = 0;
+	ev->value = atomic_load_explicit(&latest[status],
+		memory_order_relaxed);
+	return (0);
+}
+
+unsigned int
+event_queue_dropped()
+{
+	return (mpsc_ring_failed(&ring));
+}
@@ -0,0 +1,31 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <stdbool.h>
+
+#include "protocol.h"
+
+/*
+ * Status events for clients.  Any thread posts, the event loop thread
+ * consumes.  State transitions go through a bounded lock-free queue and
+ * keep their order.  Coalesced events (e.g. position updates) keep only
+ * the latest value per status and never fill the queue.  Queued events
+ * are numbered when posted and a dropped event uses up its number, so
+ * a gap is where events were lost.
+ */
+
+#define	EVENT_QUEUE_SIZE 256	/* must be a power of 2 */
+#define	EVENT_COALESCE_MAX 32	/* coalesced status must be below this */
+
+struct status_event {
+	info_t status;
+	unsigned int seq;	/* a gap means dropped events, 0 if coalesced */
+	unsigned long long value;
+};
+
+void event_queue_init();
+int event_queue_post(info_t status, unsigned long long value, bool coalesce);
+int event_queue_pop(struct status_event *ev);
+unsigned int event_queue_dropped();
+
+#endif
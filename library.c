@@ -0,0 +1,484 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/param.h>
+
+#include "library.h"
+#include "utils.h"
+
+/*
+ * Open directory, every child task holds a reference until it opens the
+ * child relative to it.
+ */
+struct lib_dir {
+	DIR *dirp;
+	atomic_uint refs;
+	char *path;
+};
+
+struct lib_task {
+	struct lib_dir *parent;		/* NULL for the root */
+	char *path;
+	const char *name;		/* last component of path */
+};
+
+struct lib_found {
+	size_t path_off;
+	int type;
+};
+
+struct lib_scan;
+
+/*
+ * Worker thread with its own tasks, the owner takes the newest task,
+ * thieves take the oldest one.
+ */
+struct lib_worker {
+	pthread_t tid;
+	unsigned int idx;
+	struct lib_scan *scan;
+
+	pthread_mutex_t mutex;
+	struct lib_task *tasks;
+	unsigned int head, tail, size;
+
+	// tracks found by this worker, paths one after another
+	struct lib_found *found;
+	unsigned int found_num, found_size;
+	char *paths;
+	size_t paths_len, paths_size;
+
+	unsigned long long entries;
+	bool failed;
+};
+
+struct lib_scan {
+	struct lib_worker *workers;
+	unsigned int threads;
+	atomic_uint pending;	/* tasks not finished yet */
+	atomic_uint queued;	/* tasks nobody took yet */
+	pthread_mutex_t idle_mutex;
+	pthread_cond_t idle_cond;
+};
+
+static void
+dir_release(struct lib_dir *d)
+{
+	if (atomic_fetch_sub(&d->refs, 1) != 1)
+		return;
+	(void) closedir(d->dirp);
+	free(d->path);
+	free(d);
+}
+
+static void
+wake_idle(struct lib_scan *s)
+{
+	pthread_mutex_lock(&s->idle_mutex);
+	pthread_cond_broadcast(&s->idle_cond);
+	pthread_mutex_unlock(&s->idle_mutex);
+}
+
+static int
+push_task(struct lib_worker *w, struct lib_dir *parent, char *path,
+	const char *name)
+{
+	struct lib_task *tasks;
+
+	pthread_mutex_lock(&w->mutex);
+	if (w->tail == w->size && w->head > 0) {
+		memmove(w->tasks, w->tasks + w->head,
+			sizeof (*tasks) * (w->tail - w->head));
+		w->tail -= w->head;
+		w->head = 0;
+	}
+	if (w->tail == w->size) {
+		tasks = realloc(w->tasks, sizeof (*tasks) * w->size * 2);
+		if (tasks == NULL) {
+			pthread_mutex_unlock(&w->mutex);
+			return (-1);
+		}
+		w->tasks = tasks;
+		w->size *= 2;
+	}
+	w->tasks[w->tail].parent = parent;
+	w->tasks[w->tail].path = path;
+	w->tasks[w->tail].name = name;
+	w->tail++;
+	atomic_fetch_add(&w->scan->pending, 1);
+	atomic_fetch_add(&w->scan->queued, 1);
+	pthread_mutex_unlock(&w->mutex);
+
+	wake_idle(w->scan);
+	return (0);
+}
+
+static int
+take_task(struct lib_worker *w, struct lib_task *t)
+{
+	pthread_mutex_lock(&w->mutex);
+	if (w->head == w->tail) {
+		pthread_mutex_unlock(&w->mutex);
+		return (-1);
+	}
+	*t = w->tasks[--w->tail];
+	if (w->head == w->tail)
+		w->head = w->tail = 0;
+	pthread_mutex_unlock(&w->mutex);
+	atomic_fetch_sub(&w->scan->queued, 1);
+	return (0);
+}
+
+static int
+steal_task(struct lib_worker *w, struct lib_task *t)
+{
+	struct lib_scan *s = w->scan;
+	struct lib_worker *v;
+	unsigned int i;
+
+	for (i = 1; i < s->threads; i++) {
+		v = &s->workers[(w->idx + i) % s->threads];
+		pthread_mutex_lock(&v->mutex);
+		if (v->head == v->tail) {
+			pthread_mutex_unlock(&v->mutex);
+			continue;
+		}
+		*t = v->tasks[v->head++];
+		if (v->head == v->tail)
+			v->head = v->tail = 0;
+		pthread_mutex_unlock(&v->mutex);
+		atomic_fetch_sub(&s->queued, 1);
+		return (0);
+	}
+	return (-1);
+}
+
+static int
+add_found(struct lib_worker *w, const char *path, int type)
+{
+	struct lib_found *found;
+	size_t len, size;
+	char *paths;
+
+	if (w->found_num == w->found_size) {
+		found = realloc(w->found, sizeof (*found) * w->found_size * 2);
+		if (found == NULL)
+			return (-1);
+		w->found = found;
+		w->found_size *= 2;
+	}
+
+	len = strlen(path) + 1;
+	size = w->paths_size;
+	while (w->paths_len + len > size)
+		size *= 2;
+	if (size != w->paths_size) {
+		paths = realloc(w->paths, size);
+		if (paths == NULL)
+			return (-1);
+		w->paths = paths;
+		w->paths_size = size;
+	}
+
+	memcpy(w->paths + w->paths_len, path, len);
+	w->found[w->found_num].path_off = w->paths_len;
+	w->found[w->found_num].type = type;
+	w->found_num++;
+	w->paths_len += len;
+	return (0);
+}
+
+/*
+ * Like entry_type() of scan_dir(), but only real directories are
+ * F_DIR, symlinks to directories could make loops.
+ */
+static int
+lib_entry_type(int dfd, struct dirent *ent)
+{
+	struct stat st;
+
+#ifdef DT_UNKNOWN
+	switch (ent->d_type) {
+	case DT_DIR:
+		return (F_DIR);
+	case DT_REG:
+		return (F_NORMAL);
+	case DT_UNKNOWN:
+	case DT_LNK:
+		break;
+	default:
+		return (F_UNDEFINED);
+	}
+#endif
+	if (fstatat(dfd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+		return (F_UNDEFINED);
+	if (S_ISDIR(st.st_mode))
+		return (F_DIR);
+	if (S_ISLNK(st.st_mode) && fstatat(dfd, ent->d_name, &st, 0) == -1)
+		return (F_UNDEFINED);
+	return (S_ISREG(st.st_mode) ? F_NORMAL : F_UNDEFINED);
+}
+
+/*
+ * Reads one directory, subdirectories become tasks of this worker.
+ */
+static void
+scan_task(struct lib_worker *w, struct lib_task *t)
+{
+	struct lib_dir *d;
+	struct dirent *ent;
+	char buf[MAXPATHLEN], *path;
+	const char *sep;
+	size_t len;
+	int fd, type;
+
+	if (t->parent != NULL) {
+		fd = openat(dirfd(t->parent->dirp), t->name,
+			O_RDONLY | O_DIRECTORY);
+		dir_release(t->parent);
+	} else {
+		fd = open(t->path, O_RDONLY | O_DIRECTORY);
+	}
+	if (fd == -1) {
+		// unreadable or removed meanwhile, other errors lose a subtree
+		if (errno != EACCES && errno != ENOENT)
+			w->failed = true;
+		free(t->path);
+		return;
+	}
+
+	d = malloc(sizeof (*d));
+	if (d == NULL || (d->dirp = fdopendir(fd)) == NULL) {
+		close(fd);
+		free(d);
+		free(t->path);
+		w->failed = true;
+		return;
+	}
+	d->path = t->path;
+	atomic_init(&d->refs, 1);
+
+	len = strlen(d->path);
+	sep = (len > 0 && d->path[len - 1] == '/') ? "" : "/";
+
+	while ((ent = readdir(d->dirp)) != NULL) {
+		// ".", ".." and hidden files
+		if (ent->d_name[0] == '.')
+			continue;
+		w->entries++;
+
+		type = lib_entry_type(dirfd(d->dirp), ent);
+		if (type == F_DIR) {
+			path = malloc(len + strlen(ent->d_name) + 2);
+			if (path == NULL) {
+				w->failed = true;
+				continue;
+			}
+			sprintf(path, "%s%s%s", d->path, sep, ent->d_name);
+			atomic_fetch_add(&d->refs, 1);
+			if (push_task(w, d, path, path + len + strlen(sep))
+					== -1) {
+				atomic_fetch_sub(&d->refs, 1);
+				free(path);
+				w->failed = true;
+			}
+		} else if (type == F_NORMAL) {
+			if (snprintf(buf, sizeof (buf), "%s%s%s", d->path, sep,
+					ent->d_name) >= sizeof (buf))
+				continue;
+			type = get_file_type(buf);
+			if (type != -1 && add_found(w, buf, type) == -1)
+				w->failed = true;
+		}
+	}
+	dir_release(d);
+}
+
+static void *
+lib_worker(void *arg)
+{
+	struct lib_worker *w = arg;
+	struct lib_scan *s = w->scan;
+	struct lib_task t;
+	bool done;
+
+	for (;;) {
+		if (take_task(w, &t) == 0 || steal_task(w, &t) == 0) {
+			scan_task(w, &t);
+			if (atomic_fetch_sub(&s->pending, 1) == 1)
+				wake_idle(s);
+			continue;
+		}
+
+		pthread_mutex_lock(&s->idle_mutex);
+		while (atomic_load(&s->pending) > 0 &&
+				atomic_load(&s->queued) == 0)
+			pthread_cond_wait(&s->idle_cond, &s->idle_mutex);
+		done = (atomic_load(&s->pending) == 0);
+		pthread_mutex_unlock(&s->idle_mutex);
+		if (done)
+			return (NULL);
+	}
+}
+
+static int
+track_cmp(const void *a, const void *b)
+{
+	return (strcmp(((const struct library_track *)a)->path,
+		((const struct library_track *)b)->path));
+}
+
+/*
+ * Moves tracks of all workers to one table sorted by path.
+ */
+static int
+merge_tracks(struct lib_scan *s, struct library *lib)
+{
+	struct lib_worker *w;
+	size_t paths_len = 0, base = 0;
+	unsigned int i, j, n = 0;
+
+	for (i = 0; i < s->threads; i++) {
+		n += s->workers[i].found_num;
+		paths_len += s->workers[i].paths_len;
+		lib->entries += s->workers[i].entries;
+	}
+
+	lib->tracks = malloc(sizeof (*lib->tracks) * (n + 1));
+	lib->paths = malloc(paths_len + 1);
+	if (lib->tracks == NULL || lib->paths == NULL)
+		return (-1);
+
+	for (i = 0; i < s->threads; i++) {
+		w = &s->workers[i];
+		memcpy(lib->paths + base, w->paths, w->paths_len);
+		for (j = 0; j < w->found_num; j++) {
+			lib->tracks[lib->amount].path = lib->paths + base +
+				w->found[j].path_off;
+			lib->tracks[lib->amount].type = w->found[j].type;
+			lib->amount++;
+		}
+		base += w->paths_len;
+	}
+	qsort(lib->tracks, lib->amount, sizeof (*lib->tracks), track_cmp);
+	return (0);
+}
+
+static int
+init_worker(struct lib_scan *s, unsigned int idx)
+{
+	struct lib_worker *w = &s->workers[idx];
+
+	w->idx = idx;
+	w->scan = s;
+	pthread_mutex_init(&w->mutex, NULL);
+	w->size = SCAN_DIR_SIZE;
+	w->tasks = malloc(sizeof (*w->tasks) * w->size);
+	w->found_size = SCAN_DIR_SIZE;
+	w->found = malloc(sizeof (*w->found) * w->found_size);
+	w->paths_size = SCAN_DIR_NAMES;
+	w->paths = malloc(w->paths_size);
+	if (w->tasks == NULL || w->found == NULL || w->paths == NULL)
+		return (-1);
+	return (0);
+}
+
+static void
+free_worker(struct lib_worker *w)
+{
+	pthread_mutex_destroy(&w->mutex);
+	free(w->tasks);
+	free(w->found);
+	free(w->paths);
+}
+
+/*
+ * Runs the workers from the root task to the last directory, the
+ * calling thread is worker 0.
+ */
+static int
+run_workers(struct lib_scan *s, const char *root)
+{
+	unsigned int i, started;
+	char *path;
+
+	path = strdup(root);
+	if (path == NULL || push_task(&s->workers[0], NULL, path, path) == -1) {
+		free(path);
+		return (-1);
+	}
+
+	for (started = 1; started < s->threads; started++) {
+		if (pthread_create(&s->workers[started].tid, NULL, lib_worker,
+				&s->workers[started]) != 0)
+			break;
+	}
+	lib_worker(&s->workers[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(s->workers[i].tid, NULL);
+
+	for (i = 0; i < s->threads; i++) {
+		if (s->workers[i].failed)
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Scans the tree under root with threads workers, 0 means one per CPU.
+ * Returns 0, or -1 if memory or file descriptors ran out and some
+ * tracks may be missing.
+ */
+int
+library_scan(const char *root, unsigned int threads, struct library *lib)
+{
+	struct lib_scan s;
+	unsigned int i;
+	long cpus;
+	int ret = 0;
+
+	memset(lib, 0, sizeof (*lib));
+	lib->time_us = get_time_us();
+
+	if (threads == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cpus > 0) ? cpus : 1;
+	}
+	if (threads > LIBRARY_THREADS_MAX)
+		threads = LIBRARY_THREADS_MAX;
+
+	memset(&s, 0, sizeof (s));
+	s.threads = threads;
+	atomic_init(&s.pending, 0);
+	atomic_init(&s.queued, 0);
+	s.workers = calloc(threads, sizeof (*s.workers));
+	if (s.workers == NULL)
+		return (-1);
+	pthread_mutex_init(&s.idle_mutex, NULL);
+	pthread_cond_init(&s.idle_cond, NULL);
+
+	for (i = 0; i < threads; i++) {
+		if (init_worker(&s, i) == -1)
+			ret = -1;
+	}
+	if (ret == 0)
+		ret = run_workers(&s, root);
+	if (merge_tracks(&s, lib) == -1)
+		ret = -1;
+
+	for (i = 0; i < threads; i++)
+		free_worker(&s.workers[i]);
+	free(s.workers);
+	pthread_mutex_destroy(&s.idle_mutex);
+	pthread_cond_destroy(&s.idle_cond);
+	lib->time_us = get_time_us() - lib->time_us;
+	return (ret);
+}
+
+void
+library_free(struct library *lib)
+{
+	free(lib->tracks);
+	free(lib->paths);
+	memset(lib, 0, sizeof (*lib));
+}
@@ -0,0 +1,33 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+/*
+ * Recursive scan of a directory tree for supported audio files.  Every
+ * directory is one task of a pool of threads, idle threads steal tasks
+ * of busy ones.  Hidden files and directories are skipped, symlinks to
+ * directories are not followed.
+ */
+
+#define	LIBRARY_THREADS_MAX 64
+
+struct library_track {
+	const char *path;
+	int type;		/* index to supported_files[] */
+};
+
+/*
+ * Tracks sorted by path, paths are stored in one block.
+ */
+struct library {
+	unsigned int amount;
+	struct library_track *tracks;
+	char *paths;
+	unsigned long long entries;	/* directory entries seen */
+	unsigned long long time_us;
+};
+
+int library_scan(const char *root, unsigned int threads,
+	struct library *lib);
+void library_free(struct library *lib);
+
+#endif
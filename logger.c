@@ -1,62 +1,281 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
-#include <stdarg.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-// TODO: queue/socket based logger (async)
+#include "logger.h"
+#include "utils.h"
 
-pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
-FILE *file;
+/*
+ * Every thread formats its messages into its own ring, the writer
+ * thread drains all rings into the log file.  Callers never block or
+ * do I/O, a message is dropped if the ring is full.  A ring is freed
+ * when its thread exits and taken by the next thread that logs.
+ * Messages of threads beyond LOG_THREADS living ones are counted as
+ * lost and the count is written to the log.
+ */
 
 #define	log_filename "./engine.log"
 
-void
-logger(char *fmt, ...)
+#define	LOG_THREADS 16
+#define	LOG_RING_SIZE 256	/* must be a power of 2 */
+#define	LOG_RING_MASK (LOG_RING_SIZE - 1)
+#define	LOG_MSG_SIZE 256
+#define	LOG_POLL_US 10000
+
+// every LOG_SAMPLE-th call is timed
+#define	LOG_SAMPLE 64
+
+struct log_ring {
+	atomic_bool owned;
+	atomic_uint head;	/* written by the owner thread */
+	atomic_uint tail;	/* written by the writer thread */
+	atomic_uint dropped;
+	unsigned int calls;
+	unsigned int samples;
+	unsigned long long sampled_ns;
+	char msg[LOG_RING_SIZE][LOG_MSG_SIZE];
+};
+
+int log_level = LOG_INFO;
+
+static struct log_ring rings[LOG_THREADS];
+static atomic_uint rings_lost;	/* messages of threads without a ring */
+static __thread struct log_ring *thread_ring;
+
+// destructor frees the ring of an exiting thread
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static int log_fd = -1;
+static pthread_t writer_thread;
+static atomic_bool writer_stop;
+static bool writer_running;
+
+/*
+ * Messages still in the ring are written by the writer thread, the next
+ * owner appends after them.
+ */
+static void
+release_ring(void *ring)
+{
+	atomic_store_explicit(&((struct log_ring *)ring)->owned, false,
+		memory_order_release);
+}
+
+static void
+create_ring_key()
 {
-	int i;
-	char *p, *sp;
+	pthread_key_create(&ring_key, release_ring);
+}
+
+static struct log_ring *
+get_ring()
+{
+	unsigned int i;
+	bool unowned;
+
+	if (thread_ring != NULL)
+		return (thread_ring);
 
+	pthread_once(&ring_key_once, create_ring_key);
+	for (i = 0; i < LOG_THREADS; i++) {
+		unowned = false;
+		if (atomic_compare_exchange_strong_explicit(&rings[i].owned,
+				&unowned, true, memory_order_acquire,
+				memory_order_relaxed))
+			break;
+	}
+	if (i == LOG_THREADS)
+		return (NULL);
+	thread_ring = &rings[i];
+	pthread_setspecific(ring_key, thread_ring);
+	return (thread_ring);
+}
+
+void
+log_write(const char *fmt, ...)
+{
+	struct log_ring *ring;
+	unsigned int head, tail;
+	unsigned long long start_ns = 0;
+	bool sample;
 	va_list list;
 
-	pthread_mutex_lock(&log_mutex);
-	file = fopen(log_filename, "a+");
-	if (!file) {
-		printf("LOG OPEN ERROR\n");
-		printf("%s\n", strerror(errno));
-		pthread_mutex_unlock(&log_mutex);
+	ring = get_ring();
+	if (ring == NULL) {
+		atomic_fetch_add_explicit(&rings_lost, 1, memory_order_relaxed);
+		return;
+	}
+
+	sample = (ring->calls++ % LOG_SAMPLE == 0);
+	if (sample)
+		start_ns = get_time_ns();
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (head - tail == LOG_RING_SIZE) {
+		atomic_fetch_add_explicit(&ring->dropped, 1,
+			memory_order_relaxed);
 		return;
 	}
 
 	va_start(list, fmt);
-	for (p = fmt; *p; p++) {
-		if (*p != '%') {
-			fputc(*p, file);
-		} else {
-			switch (*++p) {
-			case 's':
-				sp = va_arg(list, char *);
-				fprintf(file, "%s", sp);
-				continue;
-			case 'd':
-				i = va_arg(list, int);
-				fprintf(file, "%d", i);
+	vsnprintf(ring->msg[head & LOG_RING_MASK], LOG_MSG_SIZE, fmt, list);
+	va_end(list);
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+	if (sample) {
+		ring->sampled_ns += get_time_ns() - start_ns;
+		ring->samples++;
+	}
+}
+
+static void
+write_all(const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(log_fd, buf, len);
+		if (ret == -1) {
+			if (errno == EINTR)
 				continue;
+			return;
+		}
+		buf += ret;
+		len -= ret;
+	}
+}
+
+/*
+ * Writes pending messages of all rings, returns number of messages.
+ */
+static unsigned int
+drain_rings()
+{
+	static unsigned int reported[LOG_THREADS], reported_lost;
+	char buf[8192];
+	size_t len = 0, msg_len;
+	struct log_ring *ring;
+	unsigned int i, head, tail, dropped, lost, count = 0;
+
+	for (i = 0; i < LOG_THREADS; i++) {
+		ring = &rings[i];
+		tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		for (; tail != head; tail++) {
+			msg_len = strlen(ring->msg[tail & LOG_RING_MASK]);
+			if (len + msg_len > sizeof (buf)) {
+				write_all(buf, len);
+				len = 0;
 			}
+			memcpy(buf + len, ring->msg[tail & LOG_RING_MASK],
+				msg_len);
+			len += msg_len;
+			count++;
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+		dropped = atomic_load_explicit(&ring->dropped,
+			memory_order_relaxed);
+		if (dropped != reported[i] && len + 64 <= sizeof (buf)) {
+			len += snprintf(buf + len, 64,
+				"logger: %u messages dropped\n",
+				dropped - reported[i]);
+			reported[i] = dropped;
 		}
 	}
-	va_end(list);
+	lost = atomic_load_explicit(&rings_lost, memory_order_relaxed);
+	if (lost != reported_lost && len + 64 <= sizeof (buf)) {
+		len += snprintf(buf + len, 64, "logger: %u messages lost, "
+			"more than %d threads\n", lost - reported_lost,
+			LOG_THREADS);
+		reported_lost = lost;
+	}
+	write_all(buf, len);
+	return (count);
+}
+
+static void *
+log_writer(void *arg)
+{
+	bool stop;
 
-	if (fclose(file) != 0) {
-		printf("LOG CLOSE ERROR\n");
+	for (;;) {
+		stop = atomic_load(&writer_stop);
+		if (drain_rings() > 0)
+			continue;
+		if (stop)
+			break;
+		usleep(LOG_POLL_US);
+	}
+	return (NULL);
+}
+
+/*
+ * Opens the log file and starts the writer thread.
+ */
+int
+logger_init()
+{
+	int err;
+
+	log_fd = open(log_filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (log_fd == -1) {
+		printf("LOG OPEN ERROR\n");
 		printf("%s\n", strerror(errno));
-		pthread_mutex_unlock(&log_mutex);
+		return (-1);
+	}
+
+	atomic_store(&writer_stop, false);
+	err = pthread_create(&writer_thread, NULL, log_writer, NULL);
+	if (err != 0) {
+		printf("LOG THREAD ERROR\n");
+		close(log_fd);
+		log_fd = -1;
+		return (-1);
+	}
+	writer_running = true;
+	return (0);
+}
+
+/*
+ * Writes pending messages and overhead of log_write() calls.
+ */
+void
+logger_stop()
+{
+	unsigned long long ns = 0;
+	unsigned int i, calls = 0, samples = 0;
+	char buf[128];
+	int len;
+
+	if (!writer_running)
 		return;
+
+	atomic_store(&writer_stop, true);
+	pthread_join(writer_thread, NULL);
+	writer_running = false;
+
+	for (i = 0; i < LOG_THREADS; i++) {
+		calls += rings[i].calls;
+		samples += rings[i].samples;
+		ns += rings[i].sampled_ns;
 	}
-	pthread_mutex_unlock(&log_mutex);
+	len = snprintf(buf, sizeof (buf),
+		"logger: %u calls, %llu ns per call, %u lost\n", calls,
+		samples ? ns / samples : 0, atomic_load(&rings_lost));
+	write_all(buf, len);
+
+	close(log_fd);
+	log_fd = -1;
 }
@@ -1,2 +1,32 @@
+#ifndef LOGGER_H
+#define LOGGER_H
 
-void logger(char *fmt, ...);
+/*
+ * Messages above LOG_LEVEL are compiled out, e.g. -DLOG_LEVEL=LOG_INFO
+ * removes debug messages.  Messages above log_level are skipped at
+ * runtime with a single compare.
+ */
+#define	LOG_ERROR 0
+#define	LOG_INFO 1
+#define	LOG_DEBUG 2
+
+#ifndef LOG_LEVEL
+#define	LOG_LEVEL LOG_DEBUG
+#endif
+
+extern int log_level;
+
+#define	log_at(level, ...) do { \
+	if ((level) <= LOG_LEVEL && (level) <= log_level) \
+		log_write(__VA_ARGS__); \
+} while (0)
+
+#define	logger(...) log_at(LOG_INFO, __VA_ARGS__)
+#define	log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+
+int logger_init();
+void logger_stop();
+void log_write(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+#endif
@@ -0,0 +1,58 @@
+#include "mailbox.h"
+#include "mpsc_ring.h"
+
+static atomic_uint seq[MAILBOX_SIZE];
+static struct engine_cmd cmds[MAILBOX_SIZE];
+static struct mpsc_ring ring;
+
+void
+mailbox_init()
+{
+	mpsc_ring_init(&ring, seq, cmds, sizeof (cmds[0]), MAILBOX_SIZE);
+}
+
+/*
+ * Returns -1 if the mailbox is full.
+ */
+int
+mailbox_push(info_t cmd, const char *str)
+{
+	struct engine_cmd *c;
+	unsigned int pos;
+
+	c = mpsc_ring_reserve(&ring, &pos, NULL);
+	if (c == NULL)
+		return (-1);
+
+	c->cmd = cmd;
+	if (str)
+		snprintf(c->str, sizeof (c->str), "%s", str);
+	else
+		c->str[0] = '\0';
+	c->time_us = get_time_us();
+
+	mpsc_ring_publish(&ring, pos);
+	return (0);
+}
+
+bool
+mailbox_pending()
+{
+	return (mpsc_ring_pending(&ring));
+}
+
+/*
+ * Returns -1 if the mailbox is empty.
+ */
+int
+mailbox_pop(struct engine_cmd *cmd)
+{
+	struct engine_cmd *c;
+
+	c = mpsc_ring_peek(&ring);
+	if (c == NULL)
+		return (-1);
+	*cmd = *c;
+	mpsc_ring_release(&ring);
+	return (0);
+}
@@ -0,0 +1,27 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdbool.h>
+
+#include "protocol.h"
+#include "utils.h"
+
+/*
+ * Commands for the audio thread in a lock-free MPSC ring, any thread
+ * pushes, the audio thread is the only consumer.
+ */
+
+#define	MAILBOX_SIZE 64		/* must be a power of 2 */
+
+struct engine_cmd {
+	info_t cmd;
+	char str[PKT_MAX_PAYLOAD];	/* file path of CMD_PLAY */
+	unsigned long long time_us;	/* when the command was queued */
+};
+
+void mailbox_init();
+int mailbox_push(info_t cmd, const char *str);
+bool mailbox_pending();
+int mailbox_pop(struct engine_cmd *cmd);
+
+#endif
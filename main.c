@@ -1,18 +1,35 @@
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "audio_codec_mad.h"
 #include "audio_engine.h"
+#include "logger.h"
+#include "pcm_ring.h"
+#include "protocol.h"
 #include "ui.h"
+#include "utils.h"
 
+// UI connects to the engine over TCP instead of socketpair
+static bool use_tcp = false;
 
+// engine runs as a thread instead of a forked process
+static bool single_process = false;
+
+
+/*
+ * fds[0] is the UI end and fds[1] the engine end of a socketpair,
+ * both -1 when TCP is used.
+ */
 int
-init_audio_engine()
+init_audio_engine(int fds[2])
 {
 	int pid, err;
 	pid = fork();
@@ -23,11 +40,15 @@ init_audio_engine()
 	if (pid > 0) {
 		// parent process
 		printf("audio engine pid: %d\n", pid);
+		if (fds[1] != -1)
+			close(fds[1]);
 		return (pid);
 	}
 
 	// we are a child process
-	err = engine_daemon();
+	if (fds[0] != -1)
+		close(fds[0]);
+	err = engine_daemon(fds[1]);
 	if (!err) {
 		exit(0);
 	}
@@ -35,6 +56,37 @@ init_audio_engine()
 	exit(1);
 }
 
+/*
+ * Thread - engine in single-process mode, initialized by main() before
+ * the UI can send commands.
+ */
+void *
+engine_thread(void *arg)
+{
+	if (engine_run() != 0)
+		printf("audio engine exited with error\n");
+	return (NULL);
+}
+
+void
+usage(char *name)
+{
+	printf("usage: %s [-dmstv] [-b buffer_ms] [-i interval_ms] [-r rate]"
+		" [-q quality] [-w bits]\n", name);
+	printf("  -b  amount of decoded audio buffered ahead of the device"
+		" (default: %d ms)\n", PCM_RING_DEFAULT_MS);
+	printf("  -i  position update interval, 0 disables"
+		" (default: %d ms)\n", STATUS_INTERVAL_DEFAULT_MS);
+	printf("  -r  resample all files to this rate\n");
+	printf("  -q  resampler quality: linear, cubic, sinc (default)\n");
+	printf("  -w  MP3 output precision: 16 (default) or 24 bits\n");
+	printf("  -d  TPDF dither for MP3 output\n");
+	printf("  -m  detect file types by content, not extension\n");
+	printf("  -s  run engine as a thread of the UI process\n");
+	printf("  -t  control engine over TCP port %d\n", DAEMON_PORT);
+	printf("  -v  log debug messages to engine.log\n");
+}
+
 void
 handler(int signal)
 {
@@ -50,8 +102,73 @@ handler(int signal)
 int
 main(int argc, char *argv[])
 {
-	int daemon_pid, status, err;
+	int daemon_pid, status, err, opt, quality;
+	int fds[2] = { -1, -1 };
 	struct sigaction sa;
+	pthread_t engine_tid;
+
+	ui_start_us = get_time_us();
+
+	while ((opt = getopt(argc, argv, "b:i:r:q:w:dmstvh")) != -1) {
+		switch (opt) {
+		case 'b':
+			pcm_buffer_ms = atoi(optarg);
+			if (pcm_buffer_ms == 0) {
+				usage(argv[0]);
+				return (-1);
+			}
+			break;
+		case 'i':
+			status_interval_ms = atoi(optarg);
+			break;
+		case 'r':
+			resample_rate = atoi(optarg);
+			if (resample_rate == 0) {
+				usage(argv[0]);
+				return (-1);
+			}
+			break;
+		case 'q':
+			quality = resample_quality_from_name(optarg);
+			if (quality == -1) {
+				usage(argv[0]);
+				return (-1);
+			}
+			resample_quality = quality;
+			break;
+		case 'w':
+			mad_output_bits = atoi(optarg);
+			if (mad_output_bits != 16 && mad_output_bits != 24) {
+				usage(argv[0]);
+				return (-1);
+			}
+			break;
+		case 'd':
+			mad_dither = true;
+			break;
+		case 'm':
+			sniff_file_types = true;
+			break;
+		case 's':
+			single_process = true;
+			break;
+		case 't':
+			use_tcp = true;
+			break;
+		case 'v':
+			log_level = LOG_DEBUG;
+			break;
+		default:
+			usage(argv[0]);
+			return (-1);
+		}
+	}
+
+	// TCP mode needs the engine process to signal readiness
+	if (single_process && use_tcp) {
+		usage(argv[0]);
+		return (-1);
+	}
 
 	sa.sa_handler = &handler;
 	sa.sa_flags = SA_RESTART;
@@ -62,14 +179,44 @@ main(int argc, char *argv[])
 		return (-1);
 	}
 
-	daemon_pid = init_audio_engine();
+	// connected before fork, no need to wait for the engine
+	if (!use_tcp && socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+		printf("socketpair error:\n");
+		printf("%s\n", strerror(errno));
+		return (-1);
+	}
+
+	if (single_process) {
+		// a closed socket must not kill both UI and engine
+		signal(SIGPIPE, SIG_IGN);
+		ui_engine_local = true;
+		if (engine_init(fds[1]) == -1) {
+			printf("can't initialize audio engine\n");
+			return (-1);
+		}
+		if (pthread_create(&engine_tid, NULL, engine_thread,
+				NULL) != 0) {
+			printf("can't start audio engine thread\n");
+			return (-1);
+		}
+		printf("starting curses..\n");
+		err = curses_ui(fds[0]);
+		if (err == -1)
+			engine_command(CMD_QUIT, NULL);
+		pthread_join(engine_tid, NULL);
+		return (0);
+	}
 
-	printf("waiting for audio engine..\n");
-	// TODO: handle child exit
-	pause();
+	daemon_pid = init_audio_engine(fds);
+
+	if (use_tcp) {
+		printf("waiting for audio engine..\n");
+		// TODO: handle child exit
+		pause();
+	}
 
 	printf("starting curses..\n");
-	err = curses_ui();
+	err = curses_ui(fds[0]);
 
 	// wait for audio engine
 	err = wait(&status);
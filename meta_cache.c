@@ -0,0 +1,470 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#include "logger.h"
+#include "meta_cache.h"
+#include "utils.h"
+
+#define	META_MAGIC "APMETA\0\0"
+#define	META_HASH_MUL 0x9e3779b97f4a7c15ULL
+
+struct meta_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+};
+
+/*
+ * Record in native byte order, check covers all fields before it.  It
+ * is verified when the record is used, so a torn append is never used
+ * and opening the file doesn't read whole records.
+ */
+struct meta_record {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime;
+	uint32_t rate;
+	uint32_t channels;
+	uint32_t duration_ms;
+	uint32_t bitrate;
+	int32_t type;
+	char title[CODEC_TAG_MAX];
+	char artist[CODEC_TAG_MAX];
+	char album[CODEC_TAG_MAX];
+	uint32_t check;
+};
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int cache_users;
+static char cache_path[MAXPATHLEN];
+static int cache_fd = -1;		/* appends */
+
+// records of the cache file
+static void *map;
+static size_t map_len;
+static const struct meta_record *mapped;
+static unsigned int mapped_num;
+
+// records stored since the file was mapped
+static struct meta_record *added;
+static unsigned int added_num, added_size;
+
+/*
+ * Open addressing table of record numbers + 1, 0 is an empty slot.  One
+ * slot per (dev, inode).
+ */
+static unsigned int *slots;
+static unsigned int index_size;		/* power of 2 */
+static unsigned int live;
+
+static uint32_t
+record_check(const struct meta_record *r)
+{
+	const unsigned char *p = (const unsigned char *)r;
+	uint32_t h = 0x811c9dc5;
+	size_t i;
+
+	// FNV-1a
+	for (i = 0; i < offsetof(struct meta_record, check); i++)
+		h = (h ^ p[i]) * 0x01000193;
+	return (h);
+}
+
+static const struct meta_record *
+record_at(unsigned int n)
+{
+	if (n < mapped_num)
+		return (&mapped[n]);
+	return (&added[n - mapped_num]);
+}
+
+static unsigned int
+slot_of(uint64_t dev, uint64_t ino)
+{
+	return (((ino ^ dev << 48) * META_HASH_MUL >> 32) & (index_size - 1));
+}
+
+static int
+index_grow(unsigned int records)
+{
+	unsigned int *old = slots, old_size = index_size, i, j;
+	const struct meta_record *r;
+
+	index_size = (old_size == 0) ? 1024 : old_size * 2;
+	while (index_size < records * 2)
+		index_size *= 2;
+	slots = calloc(index_size, sizeof (*slots));
+	if (slots == NULL) {
+		slots = old;
+		index_size = old_size;
+		return (-1);
+	}
+	for (i = 0; i < old_size; i++) {
+		if (old[i] == 0)
+			continue;
+		r = record_at(old[i] - 1);
+		j = slot_of(r->dev, r->ino);
+		while (slots[j] != 0)
+			j = (j + 1) & (index_size - 1);
+		slots[j] = old[i];
+	}
+	free(old);
+	return (0);
+}
+
+/*
+ * Adds record n, it replaces an older record of the same file.
+ */
+static int
+index_insert(unsigned int n)
+{
+	const struct meta_record *r, *o;
+	unsigned int i;
+
+	if ((live + 1) * 2 > index_size && index_grow(live + 1) == -1)
+		return (-1);
+
+	r = record_at(n);
+	for (i = slot_of(r->dev, r->ino); ; i = (i + 1) & (index_size - 1)) {
+		if (slots[i] == 0) {
+			slots[i] = n + 1;
+			live++;
+			return (0);
+		}
+		o = record_at(slots[i] - 1);
+		if (o->dev == r->dev && o->ino == r->ino) {
+			slots[i] = n + 1;
+			return (0);
+		}
+	}
+}
+
+static const struct meta_record *
+index_find(const struct stat *st)
+{
+	const struct meta_record *r;
+	unsigned int i;
+
+	if (index_size == 0)
+		return (NULL);
+	for (i = slot_of(st->st_dev, st->st_ino); slots[i] != 0;
+			i = (i + 1) & (index_size - 1)) {
+		r = record_at(slots[i] - 1);
+		if (r->dev == (uint64_t)st->st_dev &&
+				r->ino == (uint64_t)st->st_ino)
+			return (r);
+	}
+	return (NULL);
+}
+
+static void
+unload_file()
+{
+	if (map != NULL)
+		munmap(map, map_len);
+	map = NULL;
+	map_len = 0;
+	mapped = NULL;
+	mapped_num = 0;
+	free(added);
+	added = NULL;
+	added_num = added_size = 0;
+	free(slots);
+	slots = NULL;
+	index_size = 0;
+	live = 0;
+}
+
+/*
+ * Maps the cache file and indexes its records, no audio file is
+ * touched.  Sets compact if the file has more stale records than live
+ * ones, a torn record or a bad header.
+ */
+static int
+load_file(bool *compact)
+{
+	const struct meta_header *hdr;
+	struct stat st;
+	size_t data_len;
+	unsigned int i;
+	int fd;
+
+	*compact = false;
+	fd = open(cache_path, O_RDONLY);
+	if (fd == -1)
+		return ((errno == ENOENT) ? 0 : -1);
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return (-1);
+	}
+	if (st.st_size < (off_t)sizeof (*hdr)) {
+		*compact = (st.st_size > 0);
+		close(fd);
+		return (0);
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		return (-1);
+	}
+	map_len = st.st_size;
+
+	hdr = map;
+	if (memcmp(hdr->magic, META_MAGIC, sizeof (hdr->magic)) != 0 ||
+			hdr->version != META_CACHE_VERSION ||
+			hdr->record_size != sizeof (struct meta_record)) {
+		unload_file();
+		*compact = true;
+		return (0);
+	}
+
+	data_len = map_len - sizeof (*hdr);
+	mapped = (const struct meta_record *)((const char *)map +
+		sizeof (*hdr));
+	mapped_num = data_len / sizeof (struct meta_record);
+	// torn append
+	if (data_len % sizeof (struct meta_record) != 0)
+		*compact = true;
+
+	if (mapped_num > 0 && index_grow(mapped_num) == -1)
+		return (-1);
+	for (i = 0; i < mapped_num; i++) {
+		if (index_insert(i) == -1)
+			return (-1);
+	}
+	if (mapped_num >= META_CACHE_COMPACT_MIN && mapped_num - live > live)
+		*compact = true;
+	return (0);
+}
+
+static void
+init_header(struct meta_header *hdr)
+{
+	memset(hdr, 0, sizeof (*hdr));
+	memcpy(hdr->magic, META_MAGIC, sizeof (hdr->magic));
+	hdr->version = META_CACHE_VERSION;
+	hdr->record_size = sizeof (struct meta_record);
+}
+
+/*
+ * Writes live records to a new file which replaces the cache file, the
+ * file of other processes stays valid until they reopen it.  Broken
+ * records are dropped.
+ */
+static int
+compact_file()
+{
+	struct meta_header hdr;
+	char tmp[MAXPATHLEN + 16];
+	unsigned int i, records = 0;
+	FILE *f;
+	int err = 0;
+
+	snprintf(tmp, sizeof (tmp), "%s.%d", cache_path, (int)getpid());
+	f = fopen(tmp, "w");
+	if (f == NULL)
+		return (-1);
+
+	init_header(&hdr);
+	if (fwrite(&hdr, sizeof (hdr), 1, f) != 1)
+		err = -1;
+	for (i = 0; i < index_size && err == 0; i++) {
+		if (slots[i] == 0 || record_at(slots[i] - 1)->check !=
+				record_check(record_at(slots[i] - 1)))
+			continue;
+		if (fwrite(record_at(slots[i] - 1),
+				sizeof (struct meta_record), 1, f) != 1)
+			err = -1;
+		records++;
+	}
+	if (fclose(f) != 0)
+		err = -1;
+	if (err == 0 && rename(tmp, cache_path) == -1)
+		err = -1;
+	if (err == -1) {
+		unlink(tmp);
+		return (-1);
+	}
+	logger("meta cache: compacted %u records to %u\n",
+		mapped_num, records);
+	return (0);
+}
+
+static int
+open_for_append()
+{
+	struct meta_header hdr;
+
+	cache_fd = open(cache_path, O_WRONLY | O_APPEND | O_CREAT | O_EXCL,
+		0644);
+	if (cache_fd == -1 && errno == EEXIST) {
+		cache_fd = open(cache_path, O_WRONLY | O_APPEND);
+		return ((cache_fd == -1) ? -1 : 0);
+	}
+	if (cache_fd == -1)
+		return (-1);
+
+	init_header(&hdr);
+	if (write(cache_fd, &hdr, sizeof (hdr)) != sizeof (hdr)) {
+		close(cache_fd);
+		cache_fd = -1;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Opens the cache file, NULL is $HOME/META_CACHE_FILE.  Every call needs
+ * meta_cache_close(), later calls share the first one's cache.  Returns
+ * -1 if the file can't be used, records are then kept in memory only.
+ */
+int
+meta_cache_open(const char *path)
+{
+	unsigned long long start_us;
+	const char *home;
+	bool compact;
+	int ret = 0;
+
+	pthread_mutex_lock(&cache_mutex);
+	if (cache_users++ > 0) {
+		pthread_mutex_unlock(&cache_mutex);
+		return (0);
+	}
+
+	start_us = get_time_us();
+	home = getenv("HOME");
+	if (path != NULL)
+		snprintf(cache_path, sizeof (cache_path), "%s", path);
+	else
+		snprintf(cache_path, sizeof (cache_path), "%s/%s",
+			(home != NULL) ? home : ".", META_CACHE_FILE);
+
+	if (load_file(&compact) == -1) {
+		logger("meta cache: can't load %s: %s\n", cache_path,
+			strerror(errno));
+		unload_file();
+	} else if (compact && compact_file() == 0) {
+		unload_file();
+		if (load_file(&compact) == -1)
+			unload_file();
+	}
+	if (open_for_append() == -1) {
+		logger("meta cache: can't write %s: %s\n", cache_path,
+			strerror(errno));
+		ret = -1;
+	}
+	logger("meta cache: %u of %u records live, loaded in %llu us\n",
+		live, mapped_num, get_time_us() - start_us);
+	pthread_mutex_unlock(&cache_mutex);
+	return (ret);
+}
+
+void
+meta_cache_close()
+{
+	pthread_mutex_lock(&cache_mutex);
+	if (cache_users == 0 || --cache_users > 0) {
+		pthread_mutex_unlock(&cache_mutex);
+		return;
+	}
+	unload_file();
+	if (cache_fd != -1)
+		close(cache_fd);
+	cache_fd = -1;
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+/*
+ * Returns 0 and fills m if the file described by st is cached.
+ */
+int
+meta_cache_lookup(const struct stat *st, struct meta *m)
+{
+	const struct meta_record *r;
+	int ret = -1;
+
+	pthread_mutex_lock(&cache_mutex);
+	r = index_find(st);
+	if (r != NULL && r->size == (uint64_t)st->st_size &&
+			r->mtime == st->st_mtime && r->check == record_check(r)) {
+		m->type = r->type;
+		m->rate = r->rate;
+		m->channels = r->channels;
+		m->duration_ms = r->duration_ms;
+		m->bitrate = r->bitrate;
+		memcpy(m->title, r->title, sizeof (m->title));
+		memcpy(m->artist, r->artist, sizeof (m->artist));
+		memcpy(m->album, r->album, sizeof (m->album));
+		ret = 0;
+	}
+	pthread_mutex_unlock(&cache_mutex);
+	return (ret);
+}
+
+int
+meta_cache_store(const struct stat *st, const struct meta *m)
+{
+	struct meta_record r, *p;
+	unsigned int size;
+	int ret = 0;
+
+	memset(&r, 0, sizeof (r));
+	r.dev = st->st_dev;
+	r.ino = st->st_ino;
+	r.size = st->st_size;
+	r.mtime = st->st_mtime;
+	r.rate = m->rate;
+	r.channels = m->channels;
+	r.duration_ms = m->duration_ms;
+	r.bitrate = m->bitrate;
+	r.type = m->type;
+	snprintf(r.title, sizeof (r.title), "%s", m->title);
+	snprintf(r.artist, sizeof (r.artist), "%s", m->artist);
+	snprintf(r.album, sizeof (r.album), "%s", m->album);
+	r.check = record_check(&r);
+
+	pthread_mutex_lock(&cache_mutex);
+	if (cache_users == 0) {
+		pthread_mutex_unlock(&cache_mutex);
+		return (-1);
+	}
+	if (added_num == added_size) {
+		size = (added_size == 0) ? SCAN_DIR_SIZE : added_size * 2;
+		p = realloc(added, sizeof (*p) * size);
+		if (p == NULL) {
+			pthread_mutex_unlock(&cache_mutex);
+			return (-1);
+		}
+		added = p;
+		added_size = size;
+	}
+	added[added_num++] = r;
+	if (index_insert(mapped_num + added_num - 1) == -1)
+		ret = -1;
+	// one write, O_APPEND keeps records of other processes whole
+	if (cache_fd != -1 && write(cache_fd, &r, sizeof (r)) != sizeof (r))
+		ret = -1;
+	pthread_mutex_unlock(&cache_mutex);
+	return (ret);
+}
+
+void
+meta_from_codec_info(struct meta *m, int type, const struct codec_info *info)
+{
+	memset(m, 0, sizeof (*m));
+	m->type = type;
+	m->rate = info->rate;
+	m->channels = info->channels;
+	m->duration_ms = info->duration_ms;
+	m->bitrate = info->bitrate;
+	snprintf(m->title, sizeof (m->title), "%s", info->title);
+	snprintf(m->artist, sizeof (m->artist), "%s", info->artist);
+	snprintf(m->album, sizeof (m->album), "%s", info->album);
+}
@@ -0,0 +1,41 @@
+#ifndef META_CACHE_H
+#define META_CACHE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "codec.h"
+
+/*
+ * Metadata of audio files kept between sessions.  The cache file is
+ * mmapped read-only and indexed by (dev, inode) when opened, a record is
+ * valid while size and mtime of the file match.  New records are
+ * appended with one write(), later records replace earlier ones.  Files
+ * with more stale than live records are compacted when opened.
+ */
+
+#define	META_CACHE_FILE ".audioplayer.meta"	/* in $HOME */
+#define	META_CACHE_VERSION 1
+
+// files with fewer records are not compacted
+#define	META_CACHE_COMPACT_MIN 256
+
+struct meta {
+	int type;			/* index to supported_files[] */
+	unsigned int rate;
+	unsigned int channels;
+	unsigned int duration_ms;
+	unsigned int bitrate;		/* kbps */
+	char title[CODEC_TAG_MAX];
+	char artist[CODEC_TAG_MAX];
+	char album[CODEC_TAG_MAX];
+};
+
+int meta_cache_open(const char *path);
+void meta_cache_close();
+int meta_cache_lookup(const struct stat *st, struct meta *m);
+int meta_cache_store(const struct stat *st, const struct meta *m);
+void meta_from_codec_info(struct meta *m, int type,
+	const struct codec_info *info);
+
+#endif
@@ -0,0 +1,753 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/param.h>
+
+#include "meta_cache.h"
+#include "meta_probe.h"
+#include "mp3_header.h"
+
+typedef enum {
+	PROBE_QUEUED,
+	PROBE_RUNNING,
+	PROBE_DONE,
+	PROBE_FAILED
+} probe_state_t;
+
+/*
+ * File of the directory, the name is stored in names.
+ */
+struct probe_entry {
+	uint32_t name_off;
+	uint32_t hash;
+	uint8_t state;		/* probe_state_t */
+	uint8_t change;		/* bumped when the file is written again */
+	bool urgent;		/* pushed to urgent once */
+	bool shown;		/* asked for by meta_probe_show() */
+	struct meta_col col;
+};
+
+/*
+ * Everything below is protected by probe_mutex, no file is read while it
+ * is held.  Entries are replaced when the UI enters a directory, gen
+ * tells workers their running probe belongs to an old directory.
+ */
+static pthread_mutex_t probe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t probe_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t threads[META_PROBE_THREADS];
+static unsigned int threads_num;
+static bool stopping;
+
+static char dir_path[MAXPATHLEN];
+static unsigned int gen;
+
+static struct probe_entry *entries;
+static unsigned int entries_num, entries_size;
+static char *names;
+static size_t names_len, names_size;
+
+// open addressing, entry index + 1, 0 is empty
+static unsigned int *slots;
+static unsigned int slots_size;		/* power of 2 */
+
+// every queued entry is in queue, urgent ones are probed first
+static unsigned int *queue;
+static unsigned int queue_head, queue_len, queue_size;
+static unsigned int urgent[META_PROBE_URGENT];
+static unsigned int urgent_top, urgent_num;
+static unsigned int running;
+
+// set by workers, cleared by the UI when it redraws
+static atomic_bool changed;
+
+static uint32_t
+name_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name != '\0')
+		h = (h ^ (unsigned char)*name++) * 16777619U;
+	return (h);
+}
+
+static int
+slots_grow()
+{
+	unsigned int *s, size, i, pos;
+
+	size = (slots_size == 0) ? 64 : slots_size * 2;
+	s = calloc(size, sizeof (*s));
+	if (s == NULL)
+		return (-1);
+	for (i = 0; i < entries_num; i++) {
+		pos = entries[i].hash & (size - 1);
+		while (s[pos] != 0)
+			pos = (pos + 1) & (size - 1);
+		s[pos] = i + 1;
+	}
+	free(slots);
+	slots = s;
+	slots_size = size;
+	return (0);
+}
+
+static int
+find_entry(const char *name, uint32_t hash)
+{
+	unsigned int pos, e;
+
+	if (slots_size == 0)
+		return (-1);
+	pos = hash & (slots_size - 1);
+	while ((e = slots[pos]) != 0) {
+		if (entries[e - 1].hash == hash &&
+				strcmp(names + entries[e - 1].name_off, name) == 0)
+			return (e - 1);
+		pos = (pos + 1) & (slots_size - 1);
+	}
+	return (-1);
+}
+
+static void *
+grow_array(void *p, unsigned int *size, size_t elem, unsigned int need)
+{
+	unsigned int n = (*size == 0) ? SCAN_DIR_SIZE : *size;
+
+	while (n < need)
+		n *= 2;
+	if (n == *size)
+		return (p);
+	p = realloc(p, n * elem);
+	if (p != NULL)
+		*size = n;
+	return (p);
+}
+
+static int
+push_queue(unsigned int idx)
+{
+	void *p;
+
+	if (queue_head + queue_len == queue_size) {
+		p = grow_array(queue, &queue_size, sizeof (*queue),
+			queue_len + 1);
+		if (p == NULL)
+			return (-1);
+		queue = p;
+		memmove(queue, queue + queue_head, queue_len * sizeof (*queue));
+		queue_head = 0;
+	}
+	queue[queue_head + queue_len++] = idx;
+	return (0);
+}
+
+/*
+ * Adds a queued entry, returns its index or -1.
+ */
+static int
+add_entry(const char *name, uint32_t hash)
+{
+	struct probe_entry *e;
+	size_t len = strlen(name) + 1, size;
+	unsigned int pos;
+	void *p;
+
+	if ((entries_num + 1) * 2 > slots_size && slots_grow() == -1)
+		return (-1);
+	if (entries_num == entries_size) {
+		p = grow_array(entries, &entries_size, sizeof (*entries),
+			entries_num + 1);
+		if (p == NULL)
+			return (-1);
+		entries = p;
+	}
+	if (push_queue(entries_num) == -1)
+		return (-1);
+	if (names_len + len > names_size) {
+		size = MAX(names_size * 2, names_len + len + SCAN_DIR_NAMES);
+		p = realloc(names, size);
+		if (p == NULL)
+			return (-1);
+		names = p;
+		names_size = size;
+	}
+
+	e = &entries[entries_num];
+	memset(e, 0, sizeof (*e));
+	e->name_off = names_len;
+	e->hash = hash;
+	e->state = PROBE_QUEUED;
+	memcpy(names + names_len, name, len);
+	names_len += len;
+
+	pos = hash & (slots_size - 1);
+	while (slots[pos] != 0)
+		pos = (pos + 1) & (slots_size - 1);
+	slots[pos] = entries_num + 1;
+	return (entries_num++);
+}
+
+static void
+push_urgent(unsigned int idx)
+{
+	entries[idx].urgent = true;
+	urgent[urgent_top++ & (META_PROBE_URGENT - 1)] = idx;
+	// the oldest is overwritten, it is still in queue
+	if (urgent_num < META_PROBE_URGENT)
+		urgent_num++;
+}
+
+/*
+ * Takes the next queued entry, urgent ones first.  Returns -1 if there
+ * is none.
+ */
+static int
+take_entry()
+{
+	unsigned int idx;
+
+	while (urgent_num > 0) {
+		urgent_num--;
+		idx = urgent[--urgent_top & (META_PROBE_URGENT - 1)];
+		if (entries[idx].state == PROBE_QUEUED)
+			return (idx);
+	}
+	while (queue_len > 0) {
+		queue_len--;
+		idx = queue[queue_head++];
+		if (entries[idx].state == PROBE_QUEUED)
+			return (idx);
+	}
+	return (-1);
+}
+
+static inline uint32_t
+le16(const unsigned char *p)
+{
+	return (p[0] | p[1] << 8);
+}
+
+static inline uint32_t
+le32(const unsigned char *p)
+{
+	return (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+static inline uint32_t
+be16(const unsigned char *p)
+{
+	return (p[0] << 8 | p[1]);
+}
+
+static inline uint32_t
+be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+}
+
+static int
+probe_mp3(const struct probe_buf *b, struct meta_col *col)
+{
+	struct mp3_header hdr;
+	struct mp3_xing xing;
+	unsigned long long samples;
+	long offset;
+
+	offset = mp3_find_frame(b->head, b->head_len, 0, &hdr);
+	if (offset == -1)
+		return (-1);
+	col->rate = hdr.samplerate;
+	if (hdr.bitrate > 0)
+		col->duration_ms = (b->size - offset) * 8 / hdr.bitrate;
+	if (mp3_parse_xing(b->head + offset, b->head_len - offset, &hdr,
+			&xing) == 0 || mp3_parse_vbri(b->head + offset,
+			b->head_len - offset, &hdr, &xing) == 0) {
+		samples = (unsigned long long)xing.frames * hdr.samples;
+		if (xing.has_lame &&
+				samples > xing.enc_delay + xing.enc_padding)
+			samples -= xing.enc_delay + xing.enc_padding;
+		col->duration_ms = samples * 1000 / hdr.samplerate;
+		offset += hdr.frame_len;
+	}
+	if (col->duration_ms > 0 && b->size > (unsigned long long)offset)
+		col->bitrate = (b->size - offset) * 8 / col->duration_ms;
+	return (0);
+}
+
+/*
+ * RIFF WAVE, chunk sizes are little endian and padded to even size.
+ * Chunks are looked for in the head only.
+ */
+static int
+probe_wav(const struct probe_buf *b, struct meta_col *col)
+{
+	const unsigned char *p = b->head;
+	unsigned long long data = 0, byterate = 0;
+	size_t len = b->head_len, pos = 12, size;
+
+	if (len < 12 || memcmp(p, "RIFF", 4) != 0 ||
+			memcmp(p + 8, "WAVE", 4) != 0)
+		return (-1);
+	while (pos + 8 <= len && (byterate == 0 || data == 0)) {
+		size = le32(p + pos + 4);
+		if (memcmp(p + pos, "fmt ", 4) == 0 && size >= 16 &&
+				pos + 8 + 16 <= len) {
+			col->rate = le32(p + pos + 12);
+			byterate = le32(p + pos + 16);
+		} else if (memcmp(p + pos, "data", 4) == 0) {
+			// streamed files have no size, data goes to the end
+			data = b->size - pos - 8;
+			if (size > 0 && size < data)
+				data = size;
+			else
+				break;
+		}
+		// the next chunk would start past the head, size may be huge
+		if (size >= len - pos - 8)
+			break;
+		pos += 8 + size + (size & 1);
+	}
+	if (byterate == 0)
+		return (-1);
+	col->duration_ms = data * 1000 / byterate;
+	col->bitrate = byterate * 8 / 1000;
+	return (0);
+}
+
+/*
+ * AIFF and AIFF-C, sample rate is an 80 bit IEEE extended float.
+ */
+static int
+probe_aiff(const struct probe_buf *b, struct meta_col *col)
+{
+	const unsigned char *p = b->head;
+	unsigned long long mant;
+	size_t len = b->head_len, pos = 12, size;
+	int exp, i;
+
+	if (len < 12 || memcmp(p, "FORM", 4) != 0 ||
+			(memcmp(p + 8, "AIFF", 4) != 0 &&
+			memcmp(p + 8, "AIFC", 4) != 0))
+		return (-1);
+	for (;;) {
+		if (pos + 8 > len)
+			return (-1);
+		size = be32(p + pos + 4);
+		if (memcmp(p + pos, "COMM", 4) == 0 && size >= 18 &&
+				pos + 8 + 18 <= len)
+			break;
+		if (size >= len - pos - 8)
+			return (-1);
+		pos += 8 + size + (size & 1);
+	}
+	p += pos + 8;
+
+	exp = (be16(p + 8) & 0x7fff) - 16383 - 63;
+	for (mant = 0, i = 0; i < 8; i++)
+		mant = mant << 8 | p[10 + i];
+	if (exp > 0 || exp < -63)
+		return (-1);
+	col->rate = mant >> -exp;
+	if (col->rate == 0)
+		return (-1);
+	col->duration_ms = (unsigned long long)be32(p + 2) * 1000 / col->rate;
+	col->bitrate = (unsigned long long)col->rate * be16(p) *
+		be16(p + 6) / 1000;
+	return (0);
+}
+
+static int
+probe_flac(const struct probe_buf *b, struct meta_col *col)
+{
+	const unsigned char *p = b->head;
+	unsigned long long samples;
+
+	// STREAMINFO is always the first block
+	if (8 + 18 > b->head_len || memcmp(p, "fLaC", 4) != 0 ||
+			(p[4] & 0x7f) != 0)
+		return (-1);
+	p += 8;
+
+	col->rate = p[10] << 12 | p[11] << 4 | p[12] >> 4;
+	samples = (unsigned long long)(p[13] & 0x0f) << 32 | be32(p + 14);
+	if (col->rate == 0)
+		return (-1);
+	col->duration_ms = samples * 1000 / col->rate;
+	if (col->duration_ms > 0)
+		col->bitrate = b->size * 8 / col->duration_ms;
+	return (0);
+}
+
+/*
+ * Ogg Vorbis or Opus, length is the granule position of the last page
+ * found in the tail.
+ */
+static int
+probe_ogg(const struct probe_buf *b, struct meta_col *col)
+{
+	const unsigned char *p = b->head, *t = b->tail;
+	unsigned long long granule = 0, preskip = 0, rate;
+	const unsigned char *pkt;
+	size_t pos;
+
+	if (b->head_len < 28 || memcmp(p, "OggS", 4) != 0 ||
+			27 + p[26] + 19 > b->head_len)
+		return (-1);
+	pkt = p + 27 + p[26];
+	if (memcmp(pkt, "\001vorbis", 7) == 0) {
+		rate = le32(pkt + 12);
+		col->rate = rate;
+	} else if (memcmp(pkt, "OpusHead", 8) == 0) {
+		// Opus always decodes at 48 kHz
+		rate = 48000;
+		preskip = le16(pkt + 10);
+		col->rate = le32(pkt + 12) != 0 ? le32(pkt + 12) : rate;
+	} else {
+		return (-1);
+	}
+	if (rate == 0)
+		return (-1);
+
+	for (pos = b->tail_len >= 27 ? b->tail_len - 27 : 0; pos > 0; pos--) {
+		if (t[pos] != 'O' || memcmp(t + pos, "OggS", 4) != 0 ||
+				t[pos + 4] != 0)
+			continue;
+		granule = (unsigned long long)le32(t + pos + 10) << 32 |
+			le32(t + pos + 6);
+		if (granule != ~0ULL)
+			break;
+	}
+	if (granule == ~0ULL || granule <= preskip)
+		return (0);
+	col->duration_ms = (granule - preskip) * 1000 / rate;
+	if (col->duration_ms > 0)
+		col->bitrate = b->size * 8 / col->duration_ms;
+	return (0);
+}
+
+static const struct {
+	const char *ext;
+	int (*parse)(const struct probe_buf *, struct meta_col *);
+	bool tail;		/* needs the end of the file */
+} parsers[] = {
+	{ "aiff", probe_aiff, false },
+	{ "flac", probe_flac, false },
+	{ "wav", probe_wav, false },
+	{ "ogg", probe_ogg, true },
+	{ "mp3", probe_mp3, false }
+};
+
+/*
+ * Returns index to parsers[] for extension ext, or -1.
+ */
+static int
+find_parser(const char *ext)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof (parsers) / sizeof (parsers[0]); i++) {
+		if (strcmp(parsers[i].ext, ext) == 0)
+			return (i);
+	}
+	return (-1);
+}
+
+/*
+ * Columns of a file of type ext from its head and tail, returns -1 if
+ * they can't be read.
+ */
+int
+meta_probe_parse(const char *ext, const struct probe_buf *b,
+	struct meta_col *col)
+{
+	int parser;
+
+	memset(col, 0, sizeof (*col));
+	parser = find_parser(ext);
+	if (parser == -1)
+		return (-1);
+	return (parsers[parser].parse(b, col));
+}
+
+/*
+ * Reads the columns of one file, the metadata cache of played files is
+ * tried first.  Only the head (after an ID3v2 tag) and, for Ogg, the
+ * tail are read into buf of PROBE_HEAD_SIZE + PROBE_TAIL_SIZE bytes.
+ * The file may be rewritten meanwhile, so it is never mapped: a
+ * truncated mapping would kill the process with SIGBUS.
+ */
+static int
+probe_file(const char *path, unsigned char *buf, struct meta_col *col)
+{
+	struct probe_buf b;
+	struct meta m;
+	struct stat st;
+	ssize_t len, tail;
+	size_t skip;
+	int fd, type, parser;
+
+	memset(col, 0, sizeof (*col));
+	type = get_file_type((char *)path);
+	if (type < 0 || type >= supported_files_num)
+		return (-1);
+	parser = find_parser(supported_files[type]);
+	if (parser == -1)
+		return (-1);
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return (-1);
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		close(fd);
+		return (-1);
+	}
+	if (meta_cache_lookup(&st, &m) == 0) {
+		close(fd);
+		col->duration_ms = m.duration_ms;
+		col->bitrate = m.bitrate;
+		col->rate = m.rate;
+		return (0);
+	}
+
+	b.head = buf;
+	b.tail = buf + PROBE_HEAD_SIZE;
+	b.tail_len = 0;
+	len = pread(fd, buf, PROBE_HEAD_SIZE, 0);
+	skip = (len >= 10) ? mp3_skip_id3v2(buf, st.st_size) : 0;
+	if (skip > 0)
+		len = pread(fd, buf, PROBE_HEAD_SIZE, skip);
+	if (len > 0 && parsers[parser].tail) {
+		tail = MIN(st.st_size, PROBE_TAIL_SIZE);
+		tail = pread(fd, buf + PROBE_HEAD_SIZE, tail,
+			st.st_size - tail);
+		b.tail_len = MAX(tail, 0);
+	}
+	close(fd);
+	if (len <= 0)
+		return (-1);
+	b.head_len = len;
+	// a file growing meanwhile is longer than st_size
+	b.size = MAX((unsigned long long)st.st_size - skip, b.head_len);
+	return (parsers[parser].parse(&b, col));
+}
+
+static void *
+probe_worker(void *arg)
+{
+	char path[MAXPATHLEN + NAME_MAX + 1];
+	struct meta_col col;
+	unsigned char *buf;
+	unsigned int my_gen;
+	uint8_t my_change;
+	int idx, ret;
+
+	buf = malloc(PROBE_HEAD_SIZE + PROBE_TAIL_SIZE);
+	if (buf == NULL)
+		return (NULL);
+
+	pthread_mutex_lock(&probe_mutex);
+	for (;;) {
+		while (!stopping && (idx = take_entry()) == -1)
+			pthread_cond_wait(&probe_cond, &probe_mutex);
+		if (stopping)
+			break;
+		entries[idx].state = PROBE_RUNNING;
+		snprintf(path, sizeof (path), "%s/%s", dir_path,
+			names + entries[idx].name_off);
+		my_gen = gen;
+		my_change = entries[idx].change;
+		running++;
+		pthread_mutex_unlock(&probe_mutex);
+
+		ret = probe_file(path, buf, &col);
+
+		pthread_mutex_lock(&probe_mutex);
+		running--;
+		if (my_gen != gen || entries[idx].change != my_change)
+			continue;
+		entries[idx].state = (ret == 0) ? PROBE_DONE : PROBE_FAILED;
+		entries[idx].col = col;
+		// files off screen need no redraw
+		if (entries[idx].shown)
+			atomic_store(&changed, true);
+	}
+	pthread_mutex_unlock(&probe_mutex);
+	free(buf);
+	return (NULL);
+}
+
+/*
+ * Starts the pool, columns stay empty if no thread can be started.
+ */
+int
+meta_probe_start()
+{
+	unsigned int i;
+
+	stopping = false;
+	meta_cache_open(NULL);
+	for (i = 0; i < META_PROBE_THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, probe_worker, NULL) != 0)
+			break;
+	}
+	threads_num = i;
+	return (threads_num > 0 ? 0 : -1);
+}
+
+void
+meta_probe_stop()
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&probe_mutex);
+	stopping = true;
+	pthread_cond_broadcast(&probe_cond);
+	pthread_mutex_unlock(&probe_mutex);
+	for (i = 0; i < threads_num; i++)
+		pthread_join(threads[i], NULL);
+	threads_num = 0;
+	meta_cache_close();
+
+	free(entries);
+	free(names);
+	free(slots);
+	free(queue);
+	entries = NULL;
+	names = NULL;
+	slots = NULL;
+	queue = NULL;
+	entries_num = entries_size = slots_size = queue_size = 0;
+	names_len = names_size = 0;
+	queue_head = queue_len = urgent_num = 0;
+}
+
+static bool
+probed_entry(const struct dir_contents *contents, unsigned int idx)
+{
+	return (contents->list[idx].type == F_NORMAL &&
+		(contents->list[idx].flags & DE_SUPPORTED));
+}
+
+/*
+ * Queues supported files of a new directory, entries first to last (the
+ * visible window) go first.  Results of the previous directory are
+ * dropped, probes still running for it are ignored.
+ */
+void
+meta_probe_dir(const char *path, const struct dir_contents *contents,
+	unsigned int first, unsigned int last)
+{
+	unsigned int i;
+	const char *name;
+
+	if (threads_num == 0)
+		return;
+
+	pthread_mutex_lock(&probe_mutex);
+	gen++;
+	snprintf(dir_path, sizeof (dir_path), "%s", path);
+	entries_num = 0;
+	names_len = 0;
+	queue_head = queue_len = 0;
+	urgent_num = 0;
+	if (slots_size > 0)
+		memset(slots, 0, slots_size * sizeof (*slots));
+
+	for (i = first; i <= last && i < contents->amount; i++) {
+		name = dir_entry_name(contents, i);
+		if (probed_entry(contents, i))
+			add_entry(name, name_hash(name));
+	}
+	for (i = 0; i < contents->amount; i++) {
+		name = dir_entry_name(contents, i);
+		if ((i < first || i > last) && probed_entry(contents, i))
+			add_entry(name, name_hash(name));
+	}
+	pthread_cond_broadcast(&probe_cond);
+	pthread_mutex_unlock(&probe_mutex);
+}
+
+/*
+ * Called for supported files shown on screen.  Returns 0 with columns
+ * of a probed file, otherwise the file is probed before files not shown
+ * and -1 is returned.
+ */
+int
+meta_probe_show(const char *name, struct meta_col *col)
+{
+	uint32_t hash = name_hash(name);
+	int idx, ret = -1;
+
+	if (threads_num == 0)
+		return (-1);
+
+	pthread_mutex_lock(&probe_mutex);
+	idx = find_entry(name, hash);
+	// added to the directory since it was entered
+	if (idx == -1)
+		idx = add_entry(name, hash);
+	if (idx != -1) {
+		entries[idx].shown = true;
+		if (entries[idx].state == PROBE_DONE) {
+			*col = entries[idx].col;
+			ret = 0;
+		} else if (entries[idx].state == PROBE_QUEUED &&
+				!entries[idx].urgent) {
+			push_urgent(idx);
+			pthread_cond_signal(&probe_cond);
+		}
+	}
+	pthread_mutex_unlock(&probe_mutex);
+	return (ret);
+}
+
+/*
+ * File of the directory was written, it is probed again.  Files not
+ * probed yet are left for meta_probe_show().
+ */
+void
+meta_probe_changed(const char *name)
+{
+	int idx;
+
+	if (threads_num == 0)
+		return;
+
+	pthread_mutex_lock(&probe_mutex);
+	idx = find_entry(name, name_hash(name));
+	if (idx != -1 && entries[idx].state != PROBE_QUEUED &&
+			push_queue(idx) == 0) {
+		// a running probe may have read the old contents
+		entries[idx].change++;
+		entries[idx].state = PROBE_QUEUED;
+		entries[idx].urgent = false;
+		if (entries[idx].shown)
+			atomic_store(&changed, true);
+		pthread_cond_signal(&probe_cond);
+	}
+	pthread_mutex_unlock(&probe_mutex);
+}
+
+/*
+ * Returns true once for any number of probes of shown files finished
+ * since the last call, the UI redraws then.
+ */
+bool
+meta_probe_update()
+{
+	return (atomic_exchange(&changed, false));
+}
+
+/*
+ * Probes are queued or running, the UI polls for results more often.
+ */
+bool
+meta_probe_busy()
+{
+	bool busy;
+
+	pthread_mutex_lock(&probe_mutex);
+	busy = threads_num > 0 && (queue_len > 0 || running > 0);
+	pthread_mutex_unlock(&probe_mutex);
+	return (busy || atomic_load(&changed));
+}
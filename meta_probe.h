@@ -0,0 +1,52 @@
+#ifndef META_PROBE_H
+#define META_PROBE_H
+
+#include <stdbool.h>
+
+#include "utils.h"
+
+/*
+ * Duration, bitrate and sample rate of files in the browsed directory.
+ * A pool of threads reads them from the metadata cache or from file
+ * headers, files shown on screen are probed first.  Results are read by
+ * the UI thread, which never waits for a probe.
+ */
+
+#define	META_PROBE_THREADS 4
+
+// how often the UI looks for results while probes run
+#define	META_PROBE_POLL_MS 40
+
+// names shown on screen probed before the rest, must be a power of 2
+#define	META_PROBE_URGENT 256
+
+struct meta_col {
+	unsigned int duration_ms;
+	unsigned int bitrate;		/* kbps */
+	unsigned int rate;
+};
+
+// bytes read from the start and, for Ogg, the end of a file
+#define	PROBE_HEAD_SIZE 65536
+#define	PROBE_TAIL_SIZE 65536
+
+struct probe_buf {
+	const unsigned char *head;	/* after ID3v2 tag */
+	size_t head_len;
+	const unsigned char *tail;	/* last bytes of the file */
+	size_t tail_len;
+	unsigned long long size;	/* from head to the end of the file */
+};
+
+int meta_probe_start();
+void meta_probe_stop();
+void meta_probe_dir(const char *path, const struct dir_contents *contents,
+	unsigned int first, unsigned int last);
+int meta_probe_show(const char *name, struct meta_col *col);
+void meta_probe_changed(const char *name);
+int meta_probe_parse(const char *ext, const struct probe_buf *b,
+	struct meta_col *col);
+bool meta_probe_update();
+bool meta_probe_busy();
+
+#endif
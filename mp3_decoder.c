@@ -0,0 +1,161 @@
+#include <dlfcn.h>
+#include <string.h>
+
+#include "mp3_decoder.h"
+
+// libmad functions, resolved by mp3_decoder_load()
+static struct {
+	void (*stream_init)(struct mad_stream *);
+	void (*stream_finish)(struct mad_stream *);
+	void (*stream_buffer)(struct mad_stream *, unsigned char const *,
+		unsigned long);
+	char const *(*stream_errorstr)(struct mad_stream const *);
+	int (*header_decode)(struct mad_header *, struct mad_stream *);
+	void (*frame_init)(struct mad_frame *);
+	void (*frame_finish)(struct mad_frame *);
+	void (*frame_mute)(struct mad_frame *);
+	int (*frame_decode)(struct mad_frame *, struct mad_stream *);
+	void (*synth_init)(struct mad_synth *);
+	void (*synth_mute)(struct mad_synth *);
+	void (*synth_frame)(struct mad_synth *, struct mad_frame const *);
+} mad;
+
+static const struct {
+	const char *name;
+	void *fp;
+} symbols[] = {
+	{ "mad_stream_init", &mad.stream_init },
+	{ "mad_stream_finish", &mad.stream_finish },
+	{ "mad_stream_buffer", &mad.stream_buffer },
+	{ "mad_stream_errorstr", &mad.stream_errorstr },
+	{ "mad_header_decode", &mad.header_decode },
+	{ "mad_frame_init", &mad.frame_init },
+	{ "mad_frame_finish", &mad.frame_finish },
+	{ "mad_frame_mute", &mad.frame_mute },
+	{ "mad_frame_decode", &mad.frame_decode },
+	{ "mad_synth_init", &mad.synth_init },
+	{ "mad_synth_mute", &mad.synth_mute },
+	{ "mad_synth_frame", &mad.synth_frame },
+};
+
+/*
+ * Returns -1 if some function is missing in lib.
+ */
+int
+mp3_decoder_load(void *lib)
+{
+	unsigned int i;
+	void *sym;
+
+	for (i = 0; i < sizeof (symbols) / sizeof (symbols[0]); i++) {
+		sym = dlsym(lib, symbols[i].name);
+		if (sym == NULL)
+			return (-1);
+		// function pointer from void *
+		memcpy(symbols[i].fp, &sym, sizeof (sym));
+	}
+	return (0);
+}
+
+void
+mp3_decoder_init(struct mp3_decoder *d, const unsigned char *data,
+	size_t size, size_t offset)
+{
+	mad.stream_init(&d->stream);
+	mad.frame_init(&d->frame);
+	mad.synth_init(&d->synth);
+	d->data = data;
+	d->size = size;
+	d->errors = 0;
+	mp3_decoder_restart(d, offset, 0);
+}
+
+void
+mp3_decoder_finish(struct mp3_decoder *d)
+{
+	mad.frame_finish(&d->frame);
+	mad.stream_finish(&d->stream);
+}
+
+/*
+ * Continues decoding at offset, frame_no is the number of the frame
+ * there.  Bit reservoir and overlap of the previous position are
+ * dropped, so the first frames decode with errors or silence.
+ */
+void
+mp3_decoder_restart(struct mp3_decoder *d, size_t offset, long frame_no)
+{
+	mad.stream_finish(&d->stream);
+	mad.stream_init(&d->stream);
+	mad.stream_buffer(&d->stream, d->data + offset, d->size - offset);
+	mad.frame_mute(&d->frame);
+	mad.synth_mute(&d->synth);
+	d->frame.header.flags = 0;
+	d->frame_no = frame_no - 1;
+}
+
+/*
+ * Decodes only the header of the next frame and skips its audio data.
+ * Returns 1, 0 at the end of the stream, -1 on unrecoverable error.
+ */
+int
+mp3_decoder_header(struct mp3_decoder *d, struct mad_header *header)
+{
+	for (;;) {
+		if (mad.header_decode(header, &d->stream) == 0) {
+			d->frame_no++;
+			return (1);
+		}
+		if (d->stream.error == MAD_ERROR_BUFLEN)
+			return (0);
+		if (!MAD_RECOVERABLE(d->stream.error))
+			return (-1);
+		d->errors++;
+	}
+}
+
+/*
+ * Decodes the next frame without synthesis.  Frames which fail to decode
+ * are skipped but counted, like in mad_decoder_run().
+ * Returns 1, 0 at the end of the stream, -1 on unrecoverable error.
+ */
+int
+mp3_decoder_frame(struct mp3_decoder *d)
+{
+	for (;;) {
+		if (mad.header_decode(&d->frame.header, &d->stream) == -1) {
+			if (d->stream.error == MAD_ERROR_BUFLEN)
+				return (0);
+			if (!MAD_RECOVERABLE(d->stream.error))
+				return (-1);
+			d->errors++;
+			continue;
+		}
+		d->frame_no++;
+
+		// header is already decoded (MAD_FLAG_INCOMPLETE)
+		if (mad.frame_decode(&d->frame, &d->stream) == 0)
+			return (1);
+		if (d->stream.error == MAD_ERROR_BUFLEN)
+			return (0);
+		if (!MAD_RECOVERABLE(d->stream.error))
+			return (-1);
+		d->errors++;
+	}
+}
+
+/*
+ * PCM of the last decoded frame, valid until the next call.
+ */
+struct mad_pcm *
+mp3_decoder_synth(struct mp3_decoder *d)
+{
+	mad.synth_frame(&d->synth, &d->frame);
+	return (&d->synth.pcm);
+}
+
+const char *
+mp3_decoder_error(const struct mp3_decoder *d)
+{
+	return (mad.stream_errorstr(&d->stream));
+}
@@ -0,0 +1,36 @@
+#ifndef MP3_DECODER_H
+#define MP3_DECODER_H
+
+#include <mad.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Pull-style decoder on libmad low-level API.  The caller decides when to
+ * decode the next frame, whether to synthesize it and where to restart,
+ * nothing runs behind its back.  The whole file is in memory (mmap).
+ * libmad is called through pointers set by mp3_decoder_load().
+ */
+
+struct mp3_decoder {
+	struct mad_stream stream;
+	struct mad_frame frame;
+	struct mad_synth synth;
+	const unsigned char *data;
+	size_t size;
+	long frame_no;		/* of the last frame, counts dropped frames */
+	unsigned long errors;	/* recoverable errors */
+};
+
+int mp3_decoder_load(void *lib);
+void mp3_decoder_init(struct mp3_decoder *d, const unsigned char *data,
+	size_t size, size_t offset);
+void mp3_decoder_finish(struct mp3_decoder *d);
+void mp3_decoder_restart(struct mp3_decoder *d, size_t offset,
+	long frame_no);
+int mp3_decoder_header(struct mp3_decoder *d, struct mad_header *header);
+int mp3_decoder_frame(struct mp3_decoder *d);
+struct mad_pcm *mp3_decoder_synth(struct mp3_decoder *d);
+const char *mp3_decoder_error(const struct mp3_decoder *d);
+
+#endif
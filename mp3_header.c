@@ -0,0 +1,389 @@
+#include <string.h>
+
+#include "mp3_header.h"
+
+/*
+ * http://www.mp3-tech.org/programmer/frame_header.html
+ * http://gabriel.mp3-tech.org/mp3infotag.html
+ * http://www.codeproject.com/Articles/8295/MPEG-Audio-Frame-Header (VBRI)
+ */
+
+// kbps, [MPEG1/MPEG2][layer - 1][index]
+static const int bitrates[2][3][16] = {
+	{
+		{0, 32, 64, 96, 128, 160, 192, 224,
+			256, 288, 320, 352, 384, 416, 448, 0},
+		{0, 32, 48, 56, 64, 80, 96, 112,
+			128, 160, 192, 224, 256, 320, 384, 0},
+		{0, 32, 40, 48, 56, 64, 80, 96,
+			112, 128, 160, 192, 224, 256, 320, 0}
+	},
+	{
+		{0, 32, 48, 56, 64, 80, 96, 112,
+			128, 144, 160, 176, 192, 224, 256, 0},
+		{0, 8, 16, 24, 32, 40, 48, 56,
+			64, 80, 96, 112, 128, 144, 160, 0},
+		{0, 8, 16, 24, 32, 40, 48, 56,
+			64, 80, 96, 112, 128, 144, 160, 0}
+	}
+};
+
+static const int samplerates[3] = { 44100, 48000, 32000 };
+
+static inline unsigned int
+be32(const unsigned char *p)
+{
+	return ((unsigned int)p[0] << 24 | (unsigned int)p[1] << 16 |
+		(unsigned int)p[2] << 8 | (unsigned int)p[3]);
+}
+
+/*
+ * Returns size of ID3v2 tag at the beginning of a file, 0 if not present.
+ */
+size_t
+mp3_skip_id3v2(const unsigned char *p, size_t len)
+{
+	size_t size;
+
+	if (len < 10 || p[0] != 'I' || p[1] != 'D' || p[2] != '3')
+		return (0);
+
+	// syncsafe integer
+	size = (p[6] & 0x7f) << 21 | (p[7] & 0x7f) << 14 |
+		(p[8] & 0x7f) << 7 | (p[9] & 0x7f);
+	size += 10;
+	if (p[5] & 0x10)	// footer present
+		size += 10;
+	if (size > len)
+		return (len);
+	return (size);
+}
+
+/*
+ * Parses 4 byte frame header, returns -1 if it is not a valid header.
+ */
+int
+mp3_parse_header(const unsigned char *p, struct mp3_header *hdr)
+{
+	int version_bits, layer_bits, br_idx, sr_idx, padding, lsf;
+
+	if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0)
+		return (-1);
+
+	version_bits = (p[1] >> 3) & 3;
+	layer_bits = (p[1] >> 1) & 3;
+	br_idx = p[2] >> 4;
+	sr_idx = (p[2] >> 2) & 3;
+	padding = (p[2] >> 1) & 1;
+
+	// reserved values and free format
+	if (version_bits == 1 || layer_bits == 0 || br_idx == 0 ||
+			br_idx == 15 || sr_idx == 3)
+		return (-1);
+
+	switch (version_bits) {
+	case 3:
+		hdr->version = 10;
+		break;
+	case 2:
+		hdr->version = 20;
+		break;
+	default:
+		hdr->version = 25;
+	}
+	lsf = (hdr->version != 10);
+
+	hdr->layer = 4 - layer_bits;
+	hdr->bitrate = bitrates[lsf][hdr->layer - 1][br_idx];
+	hdr->samplerate = samplerates[sr_idx];
+	if (hdr->version == 20)
+		hdr->samplerate /= 2;
+	else if (hdr->version == 25)
+		hdr->samplerate /= 4;
+	hdr->channels = ((p[3] >> 6) == 3) ? 1 : 2;
+
+	switch (hdr->layer) {
+	case 1:
+		hdr->samples = 384;
+		hdr->frame_len = (12 * hdr->bitrate * 1000 / hdr->samplerate +
+			padding) * 4;
+		break;
+	case 2:
+		hdr->samples = 1152;
+		hdr->frame_len = 144 * hdr->bitrate * 1000 / hdr->samplerate +
+			padding;
+		break;
+	default:
+		hdr->samples = lsf ? 576 : 1152;
+		hdr->frame_len = (lsf ? 72 : 144) * hdr->bitrate * 1000 /
+			hdr->samplerate + padding;
+	}
+	return (0);
+}
+
+/*
+ * Finds first frame starting from offset.  Frame is accepted only if
+ * the next frame header is valid too, returns frame offset or -1.
+ */
+long
+mp3_find_frame(const unsigned char *p, size_t len, size_t offset,
+	struct mp3_header *hdr)
+{
+	struct mp3_header next;
+	size_t i;
+
+	for (i = offset; i + 4 <= len; i++) {
+		if (p[i] != 0xff)
+			continue;
+		if (mp3_parse_header(&p[i], hdr) == -1)
+			continue;
+		// last frame in the file
+		if (i + hdr->frame_len + 4 > len)
+			return (i);
+		if (mp3_parse_header(&p[i + hdr->frame_len], &next) == 0 &&
+				next.samplerate == hdr->samplerate &&
+				next.layer == hdr->layer)
+			return (i);
+	}
+	return (-1);
+}
+
+/*
+ * Parses Xing/Info tag of the first frame, returns -1 if not present.
+ */
+int
+mp3_parse_xing(const unsigned char *frame, size_t len,
+	const struct mp3_header *hdr, struct mp3_xing *xing)
+{
+	const unsigned char *p, *end;
+	unsigned int flags;
+
+	memset(xing, 0, sizeof (*xing));
+
+	if (hdr->layer != 3)
+		return (-1);
+
+	// side information size
+	if (hdr->version == 10)
+		p = frame + 4 + (hdr->channels == 1 ? 17 : 32);
+	else
+		p = frame + 4 + (hdr->channels == 1 ? 9 : 17);
+
+	end = frame + (hdr->frame_len < len ? hdr->frame_len : len);
+	if (p + 8 > end)
+		return (-1);
+	if (memcmp(p, "Xing", 4) != 0 && memcmp(p, "Info", 4) != 0)
+		return (-1);
+
+	flags = be32(p + 4);
+	p += 8;
+
+	if (flags & 0x1) {
+		if (p + 4 > end)
+			return (-1);
+		xing->frames = be32(p);
+		p += 4;
+	}
+	// stream size, seek table and quality indicator are not used
+	if (flags & 0x2)
+		p += 4;
+	if (flags & 0x4)
+		p += 100;
+	if (flags & 0x8)
+		p += 4;
+
+	/*
+	 * LAME tag: 9 bytes encoder version, 12 bytes of other info,
+	 * then 12 bits of encoder delay and 12 bits of padding.
+	 */
+	if (p + 24 <= end && (memcmp(p, "LAME", 4) == 0 ||
+			memcmp(p, "Lavc", 4) == 0 || memcmp(p, "Lavf", 4) == 0)) {
+		p += 21;
+		xing->enc_delay = (p[0] << 4) | (p[1] >> 4);
+		xing->enc_padding = ((p[1] & 0x0f) << 8) | p[2];
+		xing->has_lame = true;
+	}
+	return (0);
+}
+
+/*
+ * Parses Fraunhofer VBRI tag, it is always 32 bytes after the header.
+ * Returns -1 if not present.
+ */
+int
+mp3_parse_vbri(const unsigned char *frame, size_t len,
+	const struct mp3_header *hdr, struct mp3_xing *xing)
+{
+	const unsigned char *p = frame + 4 + 32;
+
+	memset(xing, 0, sizeof (*xing));
+
+	if (hdr->frame_len < len)
+		len = hdr->frame_len;
+	if (hdr->layer != 3 || 4 + 32 + 18 > len)
+		return (-1);
+	if (memcmp(p, "VBRI", 4) != 0)
+		return (-1);
+
+	// version, delay, quality and stream size precede the frame count
+	xing->frames = be32(p + 14);
+	return (0);
+}
+
+/*
+ * Appends code point c as UTF-8 if it fits with the terminating '\0'.
+ */
+static size_t
+put_utf8(char *dst, size_t pos, size_t size, unsigned int c)
+{
+	unsigned char *d = (unsigned char *)dst + pos;
+
+	if (c < 0x80 && pos + 2 <= size) {
+		d[0] = c;
+		return (pos + 1);
+	}
+	if (c >= 0x80 && c < 0x800 && pos + 3 <= size) {
+		d[0] = 0xc0 | c >> 6;
+		d[1] = 0x80 | (c & 0x3f);
+		return (pos + 2);
+	}
+	if (c >= 0x800 && pos + 4 <= size) {
+		d[0] = 0xe0 | c >> 12;
+		d[1] = 0x80 | ((c >> 6) & 0x3f);
+		d[2] = 0x80 | (c & 0x3f);
+		return (pos + 3);
+	}
+	return (size);
+}
+
+/*
+ * Copies ID3 text to UTF-8.  Encodings: 0 - ISO-8859-1, 1 - UTF-16 with
+ * BOM, 2 - UTF-16BE, 3 - UTF-8.  Characters outside of BMP become '?'.
+ */
+static void
+copy_text(char *dst, size_t size, int enc, const unsigned char *p,
+	size_t len)
+{
+	size_t i = 0, pos = 0;
+	unsigned int c;
+	bool le = false;
+
+	if ((enc == 1 || enc == 2) && len >= 2 && (p[0] == 0xff ||
+			p[0] == 0xfe) && (p[0] ^ p[1]) == 0x01) {
+		le = (p[0] == 0xff);
+		i = 2;
+	}
+	while (i < len && pos < size) {
+		if (enc == 1 || enc == 2) {
+			if (i + 1 >= len)
+				break;
+			c = le ? (p[i] | p[i + 1] << 8) :
+				(p[i] << 8 | p[i + 1]);
+			i += 2;
+			if (c >= 0xd800 && c < 0xe000)
+				c = '?';
+		} else {
+			c = p[i++];
+			// UTF-8 is copied byte by byte
+			if (enc == 3 && c >= 0x80) {
+				if (pos + 2 > size)
+					break;
+				dst[pos++] = c;
+				continue;
+			}
+		}
+		if (c == 0)
+			break;
+		pos = put_utf8(dst, pos, size, c);
+	}
+	if (pos >= size)
+		pos = size - 1;
+	dst[pos] = '\0';
+}
+
+static void
+parse_id3v2(const unsigned char *p, size_t len, struct mp3_tags *tags)
+{
+	size_t pos = 10, end, id_len, hdr_len, frame_len;
+	int ver = p[3];
+	char *dst;
+
+	end = mp3_skip_id3v2(p, len);
+	if (p[5] & 0x10)
+		end -= 10;
+	// unsynchronised tags are rare, skip them
+	if (ver < 2 || ver > 4 || (p[5] & 0x80))
+		return;
+	if (ver >= 3 && (p[5] & 0x40) && pos + 4 <= end) {
+		if (ver == 3)
+			pos += 4 + be32(p + pos);
+		else
+			pos += (p[pos] & 0x7f) << 21 | (p[pos + 1] & 0x7f) << 14 |
+				(p[pos + 2] & 0x7f) << 7 | (p[pos + 3] & 0x7f);
+	}
+
+	id_len = (ver == 2) ? 3 : 4;
+	hdr_len = (ver == 2) ? 6 : 10;
+	while (pos + hdr_len <= end && p[pos] != 0) {
+		if (ver == 2)
+			frame_len = be32(p + pos + 2) & 0xffffff;
+		else if (ver == 3)
+			frame_len = be32(p + pos + 4);
+		else
+			frame_len = (p[pos + 4] & 0x7f) << 21 |
+				(p[pos + 5] & 0x7f) << 14 |
+				(p[pos + 6] & 0x7f) << 7 | (p[pos + 7] & 0x7f);
+		if (frame_len > end - pos - hdr_len)
+			break;
+
+		dst = NULL;
+		if (memcmp(p + pos, "TIT2", id_len) == 0 ||
+				memcmp(p + pos, "TT2", id_len) == 0)
+			dst = tags->title;
+		else if (memcmp(p + pos, "TPE1", id_len) == 0 ||
+				memcmp(p + pos, "TP1", id_len) == 0)
+			dst = tags->artist;
+		else if (memcmp(p + pos, "TALB", id_len) == 0 ||
+				memcmp(p + pos, "TAL", id_len) == 0)
+			dst = tags->album;
+		if (dst != NULL && frame_len > 1)
+			copy_text(dst, MP3_TAG_MAX, p[pos + hdr_len],
+				p + pos + hdr_len + 1, frame_len - 1);
+		pos += hdr_len + frame_len;
+	}
+}
+
+static void
+id3v1_field(char *dst, const unsigned char *p)
+{
+	size_t n = 30;
+
+	if (dst[0] != '\0')
+		return;
+	while (n > 0 && (p[n - 1] == ' ' || p[n - 1] == '\0'))
+		n--;
+	copy_text(dst, MP3_TAG_MAX, 0, p, n);
+}
+
+/*
+ * Reads title, artist and album from ID3v2 tag, fields it doesn't have
+ * from ID3v1 tag at the end of file.  Missing fields are empty.
+ */
+void
+mp3_parse_tags(const unsigned char *p, size_t len, struct mp3_tags *tags)
+{
+	const unsigned char *v1;
+
+	memset(tags, 0, sizeof (*tags));
+	if (mp3_skip_id3v2(p, len) > 0)
+		parse_id3v2(p, len, tags);
+
+	if (len < 128)
+		return;
+	v1 = p + len - 128;
+	if (memcmp(v1, "TAG", 3) != 0)
+		return;
+	id3v1_field(tags->title, v1 + 3);
+	id3v1_field(tags->artist, v1 + 33);
+	id3v1_field(tags->album, v1 + 63);
+}
@@ -0,0 +1,55 @@
+#ifndef MP3_HEADER_H
+#define MP3_HEADER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Header-only parsing of MPEG audio frames, no decoding.
+ */
+
+// libmad output is delayed by this amount of samples
+#define	MP3_DECODER_DELAY 529
+
+// bytes of a tag field, UTF-8 with '\0'
+#define	MP3_TAG_MAX 64
+
+struct mp3_header {
+	int version;		/* 10 - MPEG1, 20 - MPEG2, 25 - MPEG2.5 */
+	int layer;
+	int bitrate;		/* kbps */
+	int samplerate;
+	int channels;
+	unsigned int frame_len;	/* bytes, including header */
+	unsigned int samples;	/* samples per channel in this frame */
+};
+
+/*
+ * Frame count of Xing/Info tag with optional LAME extension, VBRI tag
+ * sets only frames.
+ */
+struct mp3_xing {
+	unsigned int frames;	/* audio frames, without the tag frame */
+	bool has_lame;
+	unsigned int enc_delay;
+	unsigned int enc_padding;
+};
+
+struct mp3_tags {
+	char title[MP3_TAG_MAX];
+	char artist[MP3_TAG_MAX];
+	char album[MP3_TAG_MAX];
+};
+
+size_t mp3_skip_id3v2(const unsigned char *p, size_t len);
+int mp3_parse_header(const unsigned char *p, struct mp3_header *hdr);
+long mp3_find_frame(const unsigned char *p, size_t len, size_t offset,
+	struct mp3_header *hdr);
+int mp3_parse_xing(const unsigned char *frame, size_t len,
+	const struct mp3_header *hdr, struct mp3_xing *xing);
+int mp3_parse_vbri(const unsigned char *frame, size_t len,
+	const struct mp3_header *hdr, struct mp3_xing *xing);
+void mp3_parse_tags(const unsigned char *p, size_t len,
+	struct mp3_tags *tags);
+
+#endif
@@ -0,0 +1,111 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mp3_header.h"
+#include "mp3_index.h"
+
+static struct mp3_index cache[MP3_INDEX_CACHE];
+static unsigned int cache_next;
+
+static bool
+same_file(const struct mp3_index *idx, const struct stat *st)
+{
+	return (idx->offsets != NULL && idx->dev == st->st_dev &&
+		idx->ino == st->st_ino && idx->size == st->st_size &&
+		idx->mtime == st->st_mtime);
+}
+
+struct mp3_index *
+mp3_index_lookup(const struct stat *st)
+{
+	unsigned int i;
+
+	for (i = 0; i < MP3_INDEX_CACHE; i++) {
+		if (same_file(&cache[i], st))
+			return (&cache[i]);
+	}
+	return (NULL);
+}
+
+/*
+ * Walks frame headers from the first audio frame, data between frames
+ * is skipped by resyncing.  Frame count from Xing/VBRI tag sizes the
+ * table, so VBR files are indexed without reallocation.
+ */
+struct mp3_index *
+mp3_index_build(const struct stat *st, const unsigned char *data,
+	size_t first_frame, unsigned int tag_frames)
+{
+	struct mp3_index *idx;
+	struct mp3_header hdr;
+	size_t len = st->st_size;
+	size_t pos;
+	unsigned int size;
+	uint32_t *tmp;
+	long next;
+
+	// replace the oldest entry
+	idx = &cache[cache_next++ % MP3_INDEX_CACHE];
+	free(idx->offsets);
+	memset(idx, 0, sizeof (*idx));
+
+	size = tag_frames > 0 ? tag_frames + 1 : 1024;
+	idx->offsets = malloc(size * sizeof (uint32_t));
+	if (idx->offsets == NULL)
+		return (NULL);
+
+	pos = first_frame;
+	while (pos + 4 <= len) {
+		if (mp3_parse_header(data + pos, &hdr) == -1 ||
+				pos + hdr.frame_len > len) {
+			next = mp3_find_frame(data, len, pos + 1, &hdr);
+			if (next == -1)
+				break;
+			pos = next;
+			continue;
+		}
+		if (idx->frames == 0) {
+			idx->spf = hdr.samples;
+			idx->samplerate = hdr.samplerate;
+		}
+		if (idx->frames == size) {
+			size *= 2;
+			tmp = realloc(idx->offsets, size * sizeof (uint32_t));
+			if (tmp == NULL) {
+				free(idx->offsets);
+				idx->offsets = NULL;
+				return (NULL);
+			}
+			idx->offsets = tmp;
+		}
+		idx->offsets[idx->frames++] = pos;
+		pos += hdr.frame_len;
+	}
+
+	if (idx->frames == 0) {
+		free(idx->offsets);
+		idx->offsets = NULL;
+		return (NULL);
+	}
+
+	idx->dev = st->st_dev;
+	idx->ino = st->st_ino;
+	idx->size = st->st_size;
+	idx->mtime = st->st_mtime;
+	return (idx);
+}
+
+/*
+ * Frame containing the sample, all frames of a stream have the same
+ * number of samples.
+ */
+unsigned int
+mp3_index_frame(const struct mp3_index *idx, unsigned long long sample)
+{
+	unsigned long long frame = sample / idx->spf;
+
+	if (frame >= idx->frames)
+		return (idx->frames - 1);
+	return (frame);
+}
@@ -0,0 +1,35 @@
+#ifndef MP3_INDEX_H
+#define MP3_INDEX_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * Byte offsets of all audio frames of an MP3 file, built by a header-only
+ * scan.  Indexes of recently seeked files are cached.
+ */
+
+#define	MP3_INDEX_CACHE 8
+
+// frames decoded before the seek target to fill the bit reservoir
+#define	MP3_SEEK_PRIME 10
+
+struct mp3_index {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	unsigned int frames;
+	unsigned int spf;		/* samples per frame */
+	unsigned int samplerate;
+	uint32_t *offsets;
+};
+
+struct mp3_index *mp3_index_lookup(const struct stat *st);
+struct mp3_index *mp3_index_build(const struct stat *st,
+	const unsigned char *data, size_t first_frame, unsigned int tag_frames);
+unsigned int mp3_index_frame(const struct mp3_index *idx,
+	unsigned long long sample);
+
+#endif
@@ -0,0 +1,113 @@
+#include "mpsc_ring.h"
+
+void
+mpsc_ring_init(struct mpsc_ring *ring, atomic_uint *seq, void *elems,
+	size_t elem_size, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++)
+		atomic_init(&seq[i], i);
+	ring->seq = seq;
+	ring->elems = elems;
+	ring->elem_size = elem_size;
+	ring->mask = size - 1;
+	atomic_init(&ring->enqueue, 0);
+	ring->dequeue_pos = 0;
+}
+
+/*
+ * Returns the reserved element and its position, NULL if the ring is
+ * full.  ticket may be NULL.
+ */
+void *
+mpsc_ring_reserve(struct mpsc_ring *ring, unsigned int *pos,
+	unsigned int *ticket)
+{
+	unsigned long long e;
+	unsigned int p, seq;
+	int diff;
+
+	e = atomic_load_explicit(&ring->enqueue, memory_order_relaxed);
+	for (;;) {
+		p = (unsigned int)e;
+		seq = atomic_load_explicit(&ring->seq[p & ring->mask],
+			memory_order_acquire);
+		diff = (int)(seq - p);
+		if (diff == 0) {
+			// slot is free, try to reserve it
+			if (atomic_compare_exchange_weak_explicit(
+					&ring->enqueue, &e,
+					(e & ~0xffffffffULL) | (p + 1),
+					memory_order_relaxed,
+					memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			// full, the failure takes a ticket too
+			if (atomic_compare_exchange_weak_explicit(
+					&ring->enqueue, &e, e + (1ULL << 32),
+					memory_order_relaxed,
+					memory_order_relaxed))
+				return (NULL);
+		} else {
+			e = atomic_load_explicit(&ring->enqueue,
+				memory_order_relaxed);
+		}
+	}
+
+	*pos = p;
+	if (ticket != NULL)
+		*ticket = p + (unsigned int)(e >> 32);
+	return (ring->elems + (p & ring->mask) * ring->elem_size);
+}
+
+void
+mpsc_ring_publish(struct mpsc_ring *ring, unsigned int pos)
+{
+	atomic_store_explicit(&ring->seq[pos & ring->mask], pos + 1,
+		memory_order_release);
+}
+
+unsigned int
+mpsc_ring_failed(struct mpsc_ring *ring)
+{
+	return ((unsigned int)(atomic_load_explicit(&ring->enqueue,
+		memory_order_relaxed) >> 32));
+}
+
+/*
+ * Cheap check for the consumer - a single relaxed load.
+ */
+bool
+mpsc_ring_pending(struct mpsc_ring *ring)
+{
+	unsigned int pos = ring->dequeue_pos;
+
+	return (atomic_load_explicit(&ring->seq[pos & ring->mask],
+		memory_order_relaxed) == pos + 1);
+}
+
+/*
+ * Returns the oldest element, NULL if the ring is empty.  The element
+ * stays valid until mpsc_ring_release().
+ */
+void *
+mpsc_ring_peek(struct mpsc_ring *ring)
+{
+	unsigned int pos = ring->dequeue_pos;
+
+	if (atomic_load_explicit(&ring->seq[pos & ring->mask],
+			memory_order_acquire) != pos + 1)
+		return (NULL);
+	return (ring->elems + (pos & ring->mask) * ring->elem_size);
+}
+
+void
+mpsc_ring_release(struct mpsc_ring *ring)
+{
+	unsigned int pos = ring->dequeue_pos;
+
+	atomic_store_explicit(&ring->seq[pos & ring->mask],
+		pos + ring->mask + 1, memory_order_release);
+	ring->dequeue_pos++;
+}
@@ -0,0 +1,40 @@
+#ifndef MPSC_RING_H
+#define MPSC_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Bounded lock-free multi-producer/single-consumer ring of fixed size
+ * elements.  Every slot has a sequence number which tells whether it is
+ * free or holds an element, producers reserve slots with CAS.  Storage
+ * is given by the user, the number of slots must be a power of 2.
+ *
+ * Producer: mpsc_ring_reserve(), fill the element, mpsc_ring_publish().
+ * Consumer: mpsc_ring_peek(), copy the element, mpsc_ring_release().
+ *
+ * Reservations which find the ring full are counted.  Every reservation
+ * gets a ticket in the order of all attempts, failed ones included.
+ */
+
+struct mpsc_ring {
+	atomic_uint *seq;
+	char *elems;
+	size_t elem_size;
+	unsigned int mask;
+	atomic_ullong enqueue;		/* position, failures in high 32 bits */
+	unsigned int dequeue_pos;	/* used only by the consumer */
+};
+
+void mpsc_ring_init(struct mpsc_ring *ring, atomic_uint *seq, void *elems,
+	size_t elem_size, unsigned int size);
+void *mpsc_ring_reserve(struct mpsc_ring *ring, unsigned int *pos,
+	unsigned int *ticket);
+unsigned int mpsc_ring_failed(struct mpsc_ring *ring);
+void mpsc_ring_publish(struct mpsc_ring *ring, unsigned int pos);
+bool mpsc_ring_pending(struct mpsc_ring *ring);
+void *mpsc_ring_peek(struct mpsc_ring *ring);
+void mpsc_ring_release(struct mpsc_ring *ring);
+
+#endif
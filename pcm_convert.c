@@ -0,0 +1,272 @@
+#include <stddef.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pcm_convert.h"
+
+/*
+ * mad_fixed_t has MAD_F_FRACBITS fractional bits, 1.0 == MAD_F_ONE.
+ * Output LSB expressed in fixed point:
+ */
+#define	S16_SHIFT (MAD_F_FRACBITS + 1 - 16)
+#define	S24_SHIFT (MAD_F_FRACBITS + 1 - 24)
+
+#define	MAX_FRAME 1152
+
+/*
+ * Input is limited to +-2.0 before rounding, so adding noise can't
+ * overflow.  Anything above 1.0 is clipped anyway.
+ */
+#define	IN_MAX (2 * MAD_F_ONE)
+
+static uint32_t rng_state = 0x9e3779b9;
+
+void
+pcm_convert_seed(uint32_t seed)
+{
+	rng_state = seed ? seed : 0x9e3779b9;
+}
+
+static inline uint32_t
+xorshift32()
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return (rng_state);
+}
+
+/*
+ * Triangular noise in range (-LSB, LSB), generated in interleaved
+ * order so scalar and SIMD paths see the same sequence.
+ */
+static void
+make_noise(int *nl, int *nr, unsigned int n, int channels, int shift)
+{
+	unsigned int i;
+	uint32_t mask = (1U << shift) - 1;
+
+	for (i = 0; i < n; i++) {
+		nl[i] = (int)(xorshift32() & mask) - (int)(xorshift32() & mask);
+		if (channels == 2) {
+			nr[i] = (int)(xorshift32() & mask) -
+				(int)(xorshift32() & mask);
+		}
+	}
+}
+
+/*
+ * Scalar reference.
+ */
+static inline mad_fixed_t
+limit_in(mad_fixed_t s)
+{
+	if (s > IN_MAX)
+		return (IN_MAX);
+	if (s < -IN_MAX)
+		return (-IN_MAX);
+	return (s);
+}
+
+static inline int16_t
+to_s16(mad_fixed_t s, int noise)
+{
+	s = limit_in(s) + noise + (1 << (S16_SHIFT - 1));
+	s >>= S16_SHIFT;
+	if (s > 32767)
+		return (32767);
+	if (s < -32768)
+		return (-32768);
+	return (s);
+}
+
+static inline int32_t
+to_s24(mad_fixed_t s, int noise)
+{
+	s = limit_in(s) + noise + (1 << (S24_SHIFT - 1));
+	s >>= S24_SHIFT;
+	if (s > 8388607)
+		s = 8388607;
+	else if (s < -8388608)
+		s = -8388608;
+	return ((int32_t)((uint32_t)s << 8));
+}
+
+#ifdef __SSE2__
+/*
+ * SSE2 has no 32 bit min/max, clipping uses compare and select.
+ */
+static inline __m128i
+clip_epi32(__m128i v, int lo, int hi)
+{
+	const __m128i max = _mm_set1_epi32(hi);
+	const __m128i min = _mm_set1_epi32(lo);
+	__m128i m;
+
+	m = _mm_cmpgt_epi32(v, max);
+	v = _mm_or_si128(_mm_and_si128(m, max), _mm_andnot_si128(m, v));
+	m = _mm_cmplt_epi32(v, min);
+	return (_mm_or_si128(_mm_and_si128(m, min), _mm_andnot_si128(m, v)));
+}
+
+static inline __m128i
+load_in(const mad_fixed_t *p)
+{
+	return (clip_epi32(_mm_loadu_si128((const __m128i *)p), -IN_MAX,
+		IN_MAX));
+}
+
+static inline __m128i
+load_noise(const int *noise, unsigned int i)
+{
+	if (noise == NULL)
+		return (_mm_setzero_si128());
+	return (_mm_loadu_si128((const __m128i *)(noise + i)));
+}
+
+/*
+ * 8 frames per iteration, _mm_packs_epi32 saturates to 16 bits.
+ */
+static unsigned int
+convert_s16_sse2(const mad_fixed_t *l, const mad_fixed_t *r,
+	const int *nl, const int *nr, unsigned int n, int channels,
+	int16_t *out)
+{
+	const __m128i round = _mm_set1_epi32(1 << (S16_SHIFT - 1));
+	__m128i l0, l1, r0, r1, lw, rw;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		l0 = load_in(l + i);
+		l1 = load_in(l + i + 4);
+		l0 = _mm_add_epi32(_mm_add_epi32(l0, round), load_noise(nl, i));
+		l1 = _mm_add_epi32(_mm_add_epi32(l1, round),
+			load_noise(nl, i + 4));
+		lw = _mm_packs_epi32(_mm_srai_epi32(l0, S16_SHIFT),
+			_mm_srai_epi32(l1, S16_SHIFT));
+
+		if (channels == 1) {
+			_mm_storeu_si128((__m128i *)(out + i), lw);
+			continue;
+		}
+
+		r0 = load_in(r + i);
+		r1 = load_in(r + i + 4);
+		r0 = _mm_add_epi32(_mm_add_epi32(r0, round), load_noise(nr, i));
+		r1 = _mm_add_epi32(_mm_add_epi32(r1, round),
+			load_noise(nr, i + 4));
+		rw = _mm_packs_epi32(_mm_srai_epi32(r0, S16_SHIFT),
+			_mm_srai_epi32(r1, S16_SHIFT));
+
+		// interleave left and right
+		_mm_storeu_si128((__m128i *)(out + 2 * i),
+			_mm_unpacklo_epi16(lw, rw));
+		_mm_storeu_si128((__m128i *)(out + 2 * i + 8),
+			_mm_unpackhi_epi16(lw, rw));
+	}
+	return (i);
+}
+
+static inline __m128i
+clip_s24(__m128i v)
+{
+	return (_mm_slli_epi32(clip_epi32(v, -8388608, 8388607), 8));
+}
+
+static unsigned int
+convert_s24_sse2(const mad_fixed_t *l, const mad_fixed_t *r,
+	const int *nl, const int *nr, unsigned int n, int channels,
+	int32_t *out)
+{
+	const __m128i round = _mm_set1_epi32(1 << (S24_SHIFT - 1));
+	__m128i lv, rv;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		lv = load_in(l + i);
+		lv = _mm_add_epi32(_mm_add_epi32(lv, round), load_noise(nl, i));
+		lv = clip_s24(_mm_srai_epi32(lv, S24_SHIFT));
+
+		if (channels == 1) {
+			_mm_storeu_si128((__m128i *)(out + i), lv);
+			continue;
+		}
+
+		rv = load_in(r + i);
+		rv = _mm_add_epi32(_mm_add_epi32(rv, round), load_noise(nr, i));
+		rv = clip_s24(_mm_srai_epi32(rv, S24_SHIFT));
+
+		_mm_storeu_si128((__m128i *)(out + 2 * i),
+			_mm_unpacklo_epi32(lv, rv));
+		_mm_storeu_si128((__m128i *)(out + 2 * i + 4),
+			_mm_unpackhi_epi32(lv, rv));
+	}
+	return (i);
+}
+#endif
+
+void
+pcm_convert_s16(const struct mad_pcm *pcm, unsigned int start,
+	unsigned int n, bool dither, int16_t *out)
+{
+	int noise[2][MAX_FRAME];
+	const int *nl = NULL, *nr = NULL;
+	const mad_fixed_t *l, *r;
+	unsigned int i = 0;
+	int channels = pcm->channels;
+
+	l = pcm->samples[0] + start;
+	r = pcm->samples[1] + start;
+
+	if (dither) {
+		make_noise(noise[0], noise[1], n, channels, S16_SHIFT);
+		nl = noise[0];
+		nr = noise[1];
+	}
+
+#ifdef __SSE2__
+	i = convert_s16_sse2(l, r, nl, nr, n, channels, out);
+#endif
+	for (; i < n; i++) {
+		if (channels == 1) {
+			out[i] = to_s16(l[i], nl ? nl[i] : 0);
+		} else {
+			out[2 * i] = to_s16(l[i], nl ? nl[i] : 0);
+			out[2 * i + 1] = to_s16(r[i], nr ? nr[i] : 0);
+		}
+	}
+}
+
+void
+pcm_convert_s24(const struct mad_pcm *pcm, unsigned int start,
+	unsigned int n, bool dither, int32_t *out)
+{
+	int noise[2][MAX_FRAME];
+	const int *nl = NULL, *nr = NULL;
+	const mad_fixed_t *l, *r;
+	unsigned int i = 0;
+	int channels = pcm->channels;
+
+	l = pcm->samples[0] + start;
+	r = pcm->samples[1] + start;
+
+	if (dither) {
+		make_noise(noise[0], noise[1], n, channels, S24_SHIFT);
+		nl = noise[0];
+		nr = noise[1];
+	}
+
+#ifdef __SSE2__
+	i = convert_s24_sse2(l, r, nl, nr, n, channels, out);
+#endif
+	for (; i < n; i++) {
+		if (channels == 1) {
+			out[i] = to_s24(l[i], nl ? nl[i] : 0);
+		} else {
+			out[2 * i] = to_s24(l[i], nl ? nl[i] : 0);
+			out[2 * i + 1] = to_s24(r[i], nr ? nr[i] : 0);
+		}
+	}
+}
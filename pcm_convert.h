@@ -0,0 +1,24 @@
+#ifndef PCM_CONVERT_H
+#define PCM_CONVERT_H
+
+#include <mad.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Conversion of libmad fixed point samples to interleaved PCM with
+ * rounding, clipping and optional TPDF dither.  SSE2 is used when
+ * available, scalar code handles the rest with identical results.
+ */
+
+void pcm_convert_seed(uint32_t seed);
+
+// 16 bit samples
+void pcm_convert_s16(const struct mad_pcm *pcm, unsigned int start,
+	unsigned int n, bool dither, int16_t *out);
+
+// 24 bit precision, left aligned in 32 bit samples
+void pcm_convert_s24(const struct mad_pcm *pcm, unsigned int start,
+	unsigned int n, bool dither, int32_t *out);
+
+#endif
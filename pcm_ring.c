@@ -0,0 +1,250 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pcm_ring.h"
+
+/*
+ * head and tail are free running counters, only the producer moves head
+ * and only the consumer moves tail.  Flush requests are handled by the
+ * consumer, so tail is never written by two threads.
+ */
+static struct pcm_block *blocks = NULL;
+static atomic_uint head;
+static atomic_uint tail;
+
+// bytes buffered in the ring
+static atomic_uint fill;
+static atomic_uint limit;
+static unsigned int buffer_ms;
+
+// flags for the next committed block, producer only
+static unsigned int next_flags;
+static unsigned int next_position_ms, next_duration_ms;
+
+static atomic_bool paused;
+static atomic_bool flush_req;
+static atomic_bool streaming;
+
+// statistics, updated by consumer
+static atomic_uint min_fill;
+static atomic_uint underruns;
+static atomic_uint blocks_played;
+static bool was_empty = true;
+static bool primed = false;
+
+#define	RING_MASK (PCM_RING_BLOCKS - 1)
+#define	RING_BYTES (PCM_RING_BLOCKS * PCM_BLOCK_SIZE)
+
+int
+pcm_ring_init(unsigned int ms)
+{
+	blocks = malloc(sizeof (struct pcm_block) * PCM_RING_BLOCKS);
+	if (blocks == NULL)
+		return (-1);
+
+	buffer_ms = ms;
+	next_flags = 0;
+	atomic_init(&head, 0);
+	atomic_init(&tail, 0);
+	atomic_init(&fill, 0);
+	atomic_init(&limit, RING_BYTES);
+	atomic_init(&paused, false);
+	atomic_init(&flush_req, false);
+	atomic_init(&streaming, false);
+	atomic_init(&min_fill, RING_BYTES);
+	atomic_init(&underruns, 0);
+	atomic_init(&blocks_played, 0);
+	return (0);
+}
+
+void
+pcm_ring_destroy()
+{
+	free(blocks);
+	blocks = NULL;
+}
+
+/*
+ * Limits amount of buffered audio to buffer_ms for the current format.
+ */
+void
+pcm_ring_set_rate(unsigned int bytes_per_sec)
+{
+	unsigned long long bytes;
+
+	bytes = (unsigned long long)bytes_per_sec * buffer_ms / 1000;
+	if (bytes > RING_BYTES)
+		bytes = RING_BYTES;
+	if (bytes < PCM_BLOCK_SIZE)
+		bytes = PCM_BLOCK_SIZE;
+	atomic_store(&limit, (unsigned int)bytes);
+}
+
+/*
+ * Returns a free block or NULL if the ring is full.
+ */
+struct pcm_block *
+pcm_ring_write_block()
+{
+	unsigned int h, t;
+
+	h = atomic_load_explicit(&head, memory_order_relaxed);
+	t = atomic_load_explicit(&tail, memory_order_acquire);
+	if (h - t >= PCM_RING_BLOCKS)
+		return (NULL);
+	if (atomic_load_explicit(&fill, memory_order_relaxed) >=
+			atomic_load_explicit(&limit, memory_order_relaxed))
+		return (NULL);
+	return (&blocks[h & RING_MASK]);
+}
+
+/*
+ * Publishes block returned by pcm_ring_write_block().
+ */
+void
+pcm_ring_commit()
+{
+	unsigned int h;
+
+	h = atomic_load_explicit(&head, memory_order_relaxed);
+	blocks[h & RING_MASK].flags = next_flags;
+	if (next_flags & PCM_BLOCK_POSITION) {
+		blocks[h & RING_MASK].position_ms = next_position_ms;
+		blocks[h & RING_MASK].duration_ms = next_duration_ms;
+	}
+	next_flags = 0;
+	atomic_fetch_add_explicit(&fill, blocks[h & RING_MASK].len,
+		memory_order_relaxed);
+	atomic_store_explicit(&streaming, true, memory_order_relaxed);
+	atomic_store_explicit(&head, h + 1, memory_order_release);
+}
+
+/*
+ * Sets flags of the next committed block.
+ */
+void
+pcm_ring_set_next_flags(unsigned int flags)
+{
+	next_flags |= flags;
+}
+
+/*
+ * Position of the next committed block, after track start or seek.
+ */
+void
+pcm_ring_set_next_position(unsigned int position_ms, unsigned int duration_ms)
+{
+	next_position_ms = position_ms;
+	next_duration_ms = duration_ms;
+	next_flags |= PCM_BLOCK_POSITION;
+}
+
+/*
+ * Drops all buffered blocks, returns when consumer is no longer
+ * using the audio device.
+ */
+void
+pcm_ring_flush()
+{
+	atomic_store_explicit(&streaming, false, memory_order_relaxed);
+	atomic_store_explicit(&flush_req, true, memory_order_release);
+	while (atomic_load_explicit(&flush_req, memory_order_acquire))
+		usleep(PCM_RING_POLL_US / 5);
+}
+
+/*
+ * Waits until all buffered blocks are played.
+ */
+void
+pcm_ring_drain()
+{
+	atomic_store_explicit(&streaming, false, memory_order_relaxed);
+	while (atomic_load_explicit(&tail, memory_order_acquire) !=
+			atomic_load_explicit(&head, memory_order_relaxed))
+		usleep(PCM_RING_POLL_US);
+}
+
+/*
+ * Returns next block to play or NULL if there is nothing to play.
+ */
+struct pcm_block *
+pcm_ring_read_block()
+{
+	unsigned int h, t;
+
+	if (atomic_load_explicit(&flush_req, memory_order_acquire)) {
+		h = atomic_load_explicit(&head, memory_order_acquire);
+		atomic_store_explicit(&fill, 0, memory_order_relaxed);
+		atomic_store_explicit(&tail, h, memory_order_release);
+		atomic_store_explicit(&flush_req, false, memory_order_release);
+		was_empty = true;
+		primed = false;
+		return (NULL);
+	}
+
+	if (atomic_load_explicit(&paused, memory_order_relaxed))
+		return (NULL);
+
+	t = atomic_load_explicit(&tail, memory_order_relaxed);
+	h = atomic_load_explicit(&head, memory_order_acquire);
+	if (h == t) {
+		if (!was_empty && atomic_load_explicit(&streaming,
+				memory_order_relaxed))
+			atomic_fetch_add_explicit(&underruns, 1,
+				memory_order_relaxed);
+		was_empty = true;
+		return (NULL);
+	}
+	was_empty = false;
+	return (&blocks[t & RING_MASK]);
+}
+
+/*
+ * Returns block obtained by pcm_ring_read_block() to the producer.
+ */
+void
+pcm_ring_release()
+{
+	unsigned int t, f, len;
+
+	t = atomic_load_explicit(&tail, memory_order_relaxed);
+	len = blocks[t & RING_MASK].len;
+	f = atomic_fetch_sub_explicit(&fill, len, memory_order_relaxed);
+
+	// min_fill is meaningful only after the ring was filled up once
+	if (!atomic_load_explicit(&streaming, memory_order_relaxed))
+		primed = false;
+	else if (f + PCM_BLOCK_SIZE >=
+			atomic_load_explicit(&limit, memory_order_relaxed))
+		primed = true;
+	if (primed && f - len <
+			atomic_load_explicit(&min_fill, memory_order_relaxed))
+		atomic_store_explicit(&min_fill, f - len, memory_order_relaxed);
+	atomic_fetch_add_explicit(&blocks_played, 1, memory_order_relaxed);
+	atomic_store_explicit(&tail, t + 1, memory_order_release);
+}
+
+void
+pcm_ring_pause(bool pause)
+{
+	atomic_store(&paused, pause);
+}
+
+void
+pcm_ring_get_stats(struct pcm_ring_stats *stats)
+{
+	stats->fill = atomic_load(&fill);
+	stats->limit = atomic_load(&limit);
+	stats->min_fill = atomic_load(&min_fill);
+	stats->underruns = atomic_load(&underruns);
+	stats->blocks = atomic_load(&blocks_played);
+}
+
+void
+pcm_ring_reset_stats()
+{
+	atomic_store(&min_fill, atomic_load(&limit));
+	atomic_store(&underruns, 0);
+	atomic_store(&blocks_played, 0);
+}
@@ -0,0 +1,63 @@
+#ifndef PCM_RING_H
+#define PCM_RING_H
+
+#include <stdbool.h>
+
+/*
+ * Lock-free single-producer/single-consumer ring of PCM blocks.
+ *
+ * The producer is the decoding thread (engine_ao), the consumer is
+ * the output thread which only passes blocks to ao_play().
+ */
+
+/*
+ * Bytes of PCM data in one block, holds the largest MP3 frame
+ * (1152 samples, 2 channels, 32 bit containers).
+ */
+#define	PCM_BLOCK_SIZE 16384
+#define	PCM_RING_BLOCKS 128	/* must be a power of 2 */
+#define	PCM_RING_DEFAULT_MS 500	/* default amount of buffered audio */
+#define	PCM_RING_POLL_US 5000	/* sleep time when ring is full/empty */
+
+// pcm_block flags
+#define	PCM_BLOCK_TRACK_START 0x1	/* first block of a track */
+#define	PCM_BLOCK_POSITION 0x2		/* track position and duration set */
+
+struct pcm_block {
+	unsigned int len;
+	unsigned int flags;
+	unsigned int position_ms;	/* of the first sample in the block */
+	unsigned int duration_ms;
+	char data[PCM_BLOCK_SIZE];
+};
+
+struct pcm_ring_stats {
+	unsigned int fill;	/* bytes currently buffered */
+	unsigned int limit;	/* maximum bytes buffered for current format */
+	unsigned int min_fill;	/* lowest fill seen while streaming */
+	unsigned int underruns;	/* consumer found ring empty while streaming */
+	unsigned int blocks;	/* blocks played since last reset */
+};
+
+int pcm_ring_init(unsigned int buffer_ms);
+void pcm_ring_destroy();
+void pcm_ring_set_rate(unsigned int bytes_per_sec);
+
+// producer side
+struct pcm_block *pcm_ring_write_block();
+void pcm_ring_commit();
+void pcm_ring_set_next_flags(unsigned int flags);
+void pcm_ring_set_next_position(unsigned int position_ms,
+	unsigned int duration_ms);
+void pcm_ring_flush();
+void pcm_ring_drain();
+
+// consumer side
+struct pcm_block *pcm_ring_read_block();
+void pcm_ring_release();
+
+void pcm_ring_pause(bool pause);
+void pcm_ring_get_stats(struct pcm_ring_stats *stats);
+void pcm_ring_reset_stats();
+
+#endif
@@ -1,55 +1,200 @@
-#import "protocol.h"
+#include <stdatomic.h>
+#include <sys/uio.h>
 
-int
-send_packet(int fd, info_t info, char *s)
+#include "protocol.h"
+
+static atomic_uint next_seq;
+
+static void
+fill_header(struct pkt_header *pkt_hdr, info_t info, payload_t type,
+	size_t size, uint32_t seq)
 {
-	int len;
-	unsigned int str_size, buf_size;
-	const int MAX_STRING = 256;
-	char *p, *raw_buf;
+	pkt_hdr->version = PROTOCOL_VERSION;
+	pkt_hdr->type = type;
+	pkt_hdr->info = htons(info);
+	pkt_hdr->seq = htonl(seq);
+	pkt_hdr->size = htonl(size);
+}
 
+/*
+ * Stores packet to buf, which has room for header and size bytes.
+ * Returns packet length.
+ */
+size_t
+pkt_encode(char *buf, info_t info, payload_t type, const void *data,
+	size_t size, uint32_t seq)
+{
 	struct pkt_header pkt_hdr;
 
-	pkt_hdr.info = htonl(info);
+	fill_header(&pkt_hdr, info, type, size, seq);
+	memcpy(buf, &pkt_hdr, sizeof (pkt_hdr));
+	if (size > 0)
+		memcpy(buf + sizeof (pkt_hdr), data, size);
+	return (sizeof (pkt_hdr) + size);
+}
 
-	if (s) {
-		str_size = strnlen(s, MAX_STRING);
-		pkt_hdr.size = htonl(str_size + 1);
-		buf_size = sizeof (pkt_hdr) + str_size + 1;
-	} else {
-		str_size = 0;
-		pkt_hdr.size = htonl(0);
-		buf_size = sizeof (pkt_hdr);
-	}
+/*
+ * Sends header and payload with writev(), short writes are continued.
+ */
+int
+send_packet_payload(int fd, info_t info, payload_t type, const void *data,
+	size_t size)
+{
+	struct pkt_header pkt_hdr;
+	struct iovec iov[2];
+	int iovcnt = 1;
+	ssize_t len;
 
-	raw_buf = malloc(buf_size);
-	if (!raw_buf) {
-		printf("malloc error: %s\n", strerror(errno));
+	if (size > PKT_MAX_PAYLOAD) {
+		errno = EMSGSIZE;
 		return (-1);
 	}
 
-	// copy packet header
-	p = raw_buf;
-	memcpy(p, &pkt_hdr, sizeof (pkt_hdr));
+	fill_header(&pkt_hdr, info, type, size,
+		atomic_fetch_add(&next_seq, 1));
+
+	iov[0].iov_base = &pkt_hdr;
+	iov[0].iov_len = sizeof (pkt_hdr);
+	if (size > 0) {
+		iov[1].iov_base = (void *)data;
+		iov[1].iov_len = size;
+		iovcnt = 2;
+	}
+
+	while (iovcnt > 0) {
+		len = writev(fd, iov, iovcnt);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		while (iovcnt > 0 && (size_t)len >= iov[0].iov_len) {
+			len -= iov[0].iov_len;
+			iov[0] = iov[1];
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov[0].iov_base = (char *)iov[0].iov_base + len;
+			iov[0].iov_len -= len;
+		}
+	}
+	return (0);
+}
+
+int
+send_packet(int fd, info_t info, char *s)
+{
+	if (s == NULL)
+		return (send_packet_payload(fd, info, PAYLOAD_NONE, NULL, 0));
+	return (send_packet_payload(fd, info, PAYLOAD_STRING, s,
+		strlen(s) + 1));
+}
+
+void
+pkt_put_uint64(char *buf, uint64_t value)
+{
+	int i;
+
+	for (i = 7; i >= 0; i--) {
+		buf[i] = value & 0xff;
+		value >>= 8;
+	}
+}
+
+uint64_t
+pkt_get_uint64(const struct pkt *pkt)
+{
+	const unsigned char *p = (const unsigned char *)pkt->data;
+	uint64_t value = 0;
+	int i;
 
-	if (s) {
-		// copy command string
-		p += sizeof (pkt_hdr);
-		memcpy(p, s, str_size);
+	for (i = 0; i < 8; i++)
+		value = value << 8 | p[i];
+	return (value);
+}
 
-		// terminate string with 0
-		p += str_size;
-		memset(p, '\0', 1);
+void
+pkt_reader_init(struct pkt_reader *r)
+{
+	r->start = 0;
+	r->end = 0;
+	r->reads = 0;
+	r->packets = 0;
+}
+
+/*
+ * Reads as much as fits behind buffered data.  Returns number of bytes,
+ * 0 when the peer closed connection, -1 on error.
+ */
+ssize_t
+pkt_reader_fill(struct pkt_reader *r, int fd)
+{
+	ssize_t len;
+
+	// move the incomplete packet to the beginning
+	if (r->start > 0) {
+		memmove(r->buf, r->buf + r->start, r->end - r->start);
+		r->end -= r->start;
+		r->start = 0;
 	}
 
-	len = write(fd, raw_buf, buf_size);
-	if (len != buf_size) {
-		printf("write error: %s\n", strerror(errno));
-		printf("len: %d\n", len);
-		printf("buf_size: %d\n", (unsigned int) buf_size);
-		free(raw_buf);
+	do {
+		len = read(fd, r->buf + r->end, sizeof (r->buf) - r->end);
+	} while (len == -1 && errno == EINTR);
+
+	if (len > 0) {
+		r->end += len;
+		r->reads++;
+	}
+	return (len);
+}
+
+/*
+ * Returns 1 and the next complete packet, 0 if more data is needed,
+ * -1 if the stream is not a valid v2 stream.
+ */
+int
+pkt_reader_next(struct pkt_reader *r, struct pkt *pkt)
+{
+	struct pkt_header pkt_hdr;
+	size_t avail = r->end - r->start;
+
+	if (avail < sizeof (pkt_hdr))
+		return (0);
+
+	memcpy(&pkt_hdr, r->buf + r->start, sizeof (pkt_hdr));
+	if (pkt_hdr.version != PROTOCOL_VERSION)
+		return (-1);
+
+	pkt->info = ntohs(pkt_hdr.info);
+	pkt->type = pkt_hdr.type;
+	pkt->seq = ntohl(pkt_hdr.seq);
+	pkt->size = ntohl(pkt_hdr.size);
+	if (pkt->size > PKT_MAX_PAYLOAD)
+		return (-1);
+	if (avail < sizeof (pkt_hdr) + pkt->size)
+		return (0);
+
+	pkt->data = r->buf + r->start + sizeof (pkt_hdr);
+	switch (pkt->type) {
+	case PAYLOAD_NONE:
+		if (pkt->size != 0)
+			return (-1);
+		pkt->data = NULL;
+		break;
+	case PAYLOAD_STRING:
+		if (pkt->size == 0 || pkt->data[pkt->size - 1] != '\0')
+			return (-1);
+		break;
+	case PAYLOAD_UINT64:
+		if (pkt->size != 8)
+			return (-1);
+		break;
+	default:
 		return (-1);
 	}
-	free(raw_buf);
-	return (0);
+
+	r->start += sizeof (pkt_hdr) + pkt->size;
+	r->packets++;
+	return (1);
 }
@@ -20,19 +20,77 @@ typedef enum {
 	CMD_PAUSE,
 	CMD_FF,
 	CMD_REV,
+	CMD_QUEUE,
+	CMD_SEEK,	/* absolute position in milliseconds */
+	CMD_SUBSCRIBE,	/* client receives status packets */
 	STATUS_UNKNOWN,
 	STATUS_ACK,
 	STATUS_STOP,
 	STATUS_PAUSE,
 	STATUS_EXIT,
-	STATUS_ERROR
+	STATUS_ERROR,
+	STATUS_POSITION,	/* ms, PAYLOAD_UINT64 */
+	STATUS_DURATION,	/* ms, PAYLOAD_UINT64 */
+	STATUS_BUFFER		/* PCM ring fill in percent, PAYLOAD_UINT64 */
 } info_t;
 
+/*
+ * Wire format v2: header in network byte order followed by size bytes
+ * of payload.  Several packets may arrive in one read.  Commands are
+ * numbered by the sender.  Status transitions carry the number of the
+ * event, a gap means the engine dropped events, coalesced updates
+ * (position, duration, buffer) carry 0.
+ */
+#define	PROTOCOL_VERSION 2
+#define	PKT_MAX_PAYLOAD 4096
+
+typedef enum {
+	PAYLOAD_NONE,
+	PAYLOAD_STRING,		/* terminated with 0 */
+	PAYLOAD_UINT64		/* 8 bytes, network byte order */
+} payload_t;
+
 struct pkt_header {
-	uint32_t info;
+	uint8_t version;
+	uint8_t type;		/* payload_t */
+	uint16_t info;		/* info_t */
+	uint32_t seq;
+	uint32_t size;
+};
+
+struct pkt {
+	info_t info;
+	payload_t type;
+	uint32_t seq;
 	uint32_t size;
+	char *data;		/* valid until the next pkt_reader_fill() */
+};
+
+/*
+ * Incremental parser, buffered data holds complete packets and the
+ * beginning of the next one.
+ */
+#define	PKT_READER_SIZE (2 * (sizeof (struct pkt_header) + PKT_MAX_PAYLOAD))
+
+struct pkt_reader {
+	char buf[PKT_READER_SIZE];
+	size_t start;
+	size_t end;
+	unsigned long reads;
+	unsigned long packets;
 };
 
 int send_packet(int fd, info_t info, char *s);
+int send_packet_payload(int fd, info_t info, payload_t type,
+	const void *data, size_t size);
+size_t pkt_encode(char *buf, info_t info, payload_t type,
+	const void *data, size_t size, uint32_t seq);
+
+void pkt_put_uint64(char *buf, uint64_t value);
+uint64_t pkt_get_uint64(const struct pkt *pkt);
+
+void pkt_reader_init(struct pkt_reader *r);
+ssize_t pkt_reader_fill(struct pkt_reader *r, int fd);
+int pkt_reader_next(struct pkt_reader *r, struct pkt *pkt);
 
 #endif
@@ -0,0 +1,369 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcm_ring.h"
+#include "resample.h"
+#include "utils.h"
+
+/*
+ * Input is kept in planar float buffers, so every kernel works on
+ * contiguous memory.  Position in the input is 32.32 fixed point,
+ * which doesn't drift over long files like a double would.
+ */
+
+#define	MAX_CHANNELS 8
+#define	SINC_HALF 16		/* sinc kernel has 2 * SINC_HALF taps */
+#define	SINC_PHASES 256
+
+static resample_quality_t quality;
+static unsigned int out_rate;
+static unsigned int in_rate;
+static int channels;
+static int bits;
+
+// taps on each side of the current position
+static unsigned int half;
+
+static float *buf[MAX_CHANNELS];
+static unsigned int cap;	/* frames */
+static unsigned int avail;	/* frames */
+
+static uint64_t pos;
+static uint64_t step;
+
+// SINC_PHASES + 1 rows of 2 * SINC_HALF coefficients
+static float *sinc_tab = NULL;
+
+static struct resample_stats stats;
+
+static const char *quality_names[] = {
+	"linear",
+	"cubic",
+	"sinc"
+};
+
+const char *
+resample_quality_name(resample_quality_t q)
+{
+	return (quality_names[q]);
+}
+
+int
+resample_quality_from_name(const char *name)
+{
+	int i;
+
+	for (i = 0; i <= RESAMPLE_SINC; i++) {
+		if (strcmp(name, quality_names[i]) == 0)
+			return (i);
+	}
+	return (-1);
+}
+
+int
+resample_init(resample_quality_t q, unsigned int rate)
+{
+	quality = q;
+	out_rate = rate;
+	in_rate = 0;
+	channels = 0;
+	bits = 0;
+	cap = 0;
+	memset(buf, 0, sizeof (buf));
+	memset(&stats, 0, sizeof (stats));
+
+	switch (quality) {
+	case RESAMPLE_LINEAR:
+		half = 1;
+		break;
+	case RESAMPLE_CUBIC:
+		half = 2;
+		break;
+	default:
+		half = SINC_HALF;
+		sinc_tab = malloc(sizeof (float) * (SINC_PHASES + 1) *
+			2 * SINC_HALF);
+		if (sinc_tab == NULL)
+			return (-1);
+	}
+	return (0);
+}
+
+void
+resample_destroy()
+{
+	int c;
+
+	for (c = 0; c < MAX_CHANNELS; c++) {
+		free(buf[c]);
+		buf[c] = NULL;
+	}
+	free(sinc_tab);
+	sinc_tab = NULL;
+}
+
+/*
+ * Blackman windowed sinc, cutoff relative to input Nyquist frequency.
+ */
+static void
+build_sinc_table(double cutoff)
+{
+	int p, k;
+	double frac, x, w, c, sum;
+	float *row;
+
+	for (p = 0; p <= SINC_PHASES; p++) {
+		frac = (double)p / SINC_PHASES;
+		row = sinc_tab + p * 2 * SINC_HALF;
+		sum = 0;
+		for (k = 0; k < 2 * SINC_HALF; k++) {
+			x = (k - (SINC_HALF - 1)) - frac;
+			w = 0.42 + 0.5 * cos(M_PI * x / SINC_HALF) +
+				0.08 * cos(2 * M_PI * x / SINC_HALF);
+			if (fabs(x) < 1e-9)
+				c = cutoff;
+			else
+				c = sin(M_PI * cutoff * x) / (M_PI * x);
+			row[k] = c * w;
+			sum += row[k];
+		}
+		for (k = 0; k < 2 * SINC_HALF; k++)
+			row[k] /= sum;
+	}
+}
+
+/*
+ * Drops history, keeps format.
+ */
+void
+resample_reset()
+{
+	int c;
+
+	// history before the first sample is silence
+	for (c = 0; c < channels; c++)
+		memset(buf[c], 0, sizeof (float) * (half - 1));
+	avail = half - 1;
+	pos = (uint64_t)(half - 1) << 32;
+}
+
+/*
+ * Prepares converter for the input format, history is kept if
+ * the format didn't change (gapless playback).
+ */
+int
+resample_set_format(unsigned int rate, int ch, int b)
+{
+	int c;
+	double cutoff;
+
+	if (rate == in_rate && ch == channels && b == bits)
+		return (0);
+	if (ch > MAX_CHANNELS || (b != 16 && b != 32))
+		return (-1);
+
+	in_rate = rate;
+	channels = ch;
+	bits = b;
+	step = ((uint64_t)in_rate << 32) / out_rate;
+
+	// room for the largest PCM block (16 bit mono) and history
+	cap = PCM_BLOCK_SIZE / 2 + 4 * half;
+	for (c = 0; c < MAX_CHANNELS; c++) {
+		free(buf[c]);
+		buf[c] = NULL;
+	}
+	for (c = 0; c < channels; c++) {
+		buf[c] = malloc(sizeof (float) * cap);
+		if (buf[c] == NULL)
+			return (-1);
+	}
+
+	if (quality == RESAMPLE_SINC) {
+		cutoff = (out_rate < in_rate) ? (double)out_rate / in_rate : 1.0;
+		build_sinc_table(cutoff * 0.97);
+	}
+
+	resample_reset();
+	return (0);
+}
+
+/*
+ * Appends input frames, returns -1 if there is no memory for them.
+ */
+int
+resample_push(const void *in, unsigned int frames)
+{
+	unsigned long long start;
+	unsigned int drop, f, i, new_cap;
+	int c;
+	const int16_t *in16 = in;
+	const int32_t *in32 = in;
+	float *p;
+
+	start = get_time_us();
+
+	// drop frames not needed by the next output sample
+	drop = 0;
+	if ((pos >> 32) > half - 1)
+		drop = (pos >> 32) - (half - 1);
+	if (drop > 0) {
+		for (c = 0; c < channels; c++) {
+			memmove(buf[c], buf[c] + drop,
+				sizeof (float) * (avail - drop));
+		}
+		avail -= drop;
+		pos -= (uint64_t)drop << 32;
+	}
+
+	if (avail + frames > cap) {
+		new_cap = avail + frames;
+		for (c = 0; c < channels; c++) {
+			p = realloc(buf[c], sizeof (float) * new_cap);
+			if (p == NULL)
+				return (-1);
+			buf[c] = p;
+		}
+		cap = new_cap;
+	}
+
+	i = 0;
+	for (f = 0; f < frames; f++) {
+		for (c = 0; c < channels; c++, i++) {
+			if (bits == 16)
+				buf[c][avail + f] = in16[i] * (1.0f / 32768);
+			else
+				buf[c][avail + f] = in32[i] * (1.0f / 2147483648.0f);
+		}
+	}
+	avail += frames;
+
+	stats.cpu_us += get_time_us() - start;
+	return (0);
+}
+
+static inline float
+kernel_linear(const float *b, unsigned int i, float frac)
+{
+	return (b[i] + (b[i + 1] - b[i]) * frac);
+}
+
+static inline float
+kernel_cubic(const float *b, unsigned int i, float t)
+{
+	float p0 = b[i - 1], p1 = b[i], p2 = b[i + 1], p3 = b[i + 2];
+
+	return (p1 + 0.5f * t * (p2 - p0 + t * (2 * p0 - 5 * p1 + 4 * p2 -
+		p3 + t * (3 * (p1 - p2) + p3 - p0))));
+}
+
+static inline float
+dot_product(const float *x, const float *coef)
+{
+	float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	int k;
+
+	// four independent sums, the compiler keeps them in a vector register
+	for (k = 0; k < 2 * SINC_HALF; k += 4) {
+		s0 += x[k] * coef[k];
+		s1 += x[k + 1] * coef[k + 1];
+		s2 += x[k + 2] * coef[k + 2];
+		s3 += x[k + 3] * coef[k + 3];
+	}
+	return ((s0 + s1) + (s2 + s3));
+}
+
+/*
+ * Interpolates between two nearest phases of the sinc table.
+ */
+static inline float
+kernel_sinc(const float *b, unsigned int i, float frac)
+{
+	const float *x, *coef;
+	float phase, t, d0, d1;
+	int p;
+
+	phase = frac * SINC_PHASES;
+	p = (int)phase;
+	t = phase - p;
+
+	coef = sinc_tab + p * 2 * SINC_HALF;
+	x = b + i - (SINC_HALF - 1);
+	d0 = dot_product(x, coef);
+	d1 = dot_product(x, coef + 2 * SINC_HALF);
+	return (d0 + (d1 - d0) * t);
+}
+
+/*
+ * Produces up to max_frames of output, returns 0 if more input
+ * is needed.
+ */
+unsigned int
+resample_pull(void *out, unsigned int max_frames)
+{
+	unsigned long long start;
+	unsigned int n, i;
+	int c;
+	float frac, v;
+	int16_t *out16 = out;
+	int32_t *out32 = out;
+	double d;
+
+	start = get_time_us();
+
+	for (n = 0; n < max_frames; n++) {
+		i = pos >> 32;
+		if (i + half >= avail)
+			break;
+		frac = (float)(uint32_t)pos * (1.0f / 4294967296.0f);
+
+		for (c = 0; c < channels; c++) {
+			switch (quality) {
+			case RESAMPLE_LINEAR:
+				v = kernel_linear(buf[c], i, frac);
+				break;
+			case RESAMPLE_CUBIC:
+				v = kernel_cubic(buf[c], i, frac);
+				break;
+			default:
+				v = kernel_sinc(buf[c], i, frac);
+			}
+
+			if (bits == 16) {
+				v = v * 32768;
+				if (v > 32767)
+					v = 32767;
+				else if (v < -32768)
+					v = -32768;
+				*out16++ = lrintf(v);
+			} else {
+				d = (double)v * 2147483648.0;
+				if (d > 2147483647.0)
+					d = 2147483647.0;
+				else if (d < -2147483648.0)
+					d = -2147483648.0;
+				*out32++ = lrint(d);
+			}
+		}
+		pos += step;
+	}
+
+	stats.frames_out += n;
+	stats.cpu_us += get_time_us() - start;
+	return (n);
+}
+
+void
+resample_get_stats(struct resample_stats *s)
+{
+	*s = stats;
+	if (stats.cpu_us > 0 && out_rate > 0) {
+		s->realtime_x = stats.frames_out * 1000000 /
+			((unsigned long long)out_rate * stats.cpu_us);
+	} else {
+		s->realtime_x = 0;
+	}
+	memset(&stats, 0, sizeof (stats));
+}
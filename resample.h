@@ -0,0 +1,31 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+/*
+ * Sample rate converter, used to keep the audio device at one rate.
+ * Works on interleaved 16 or 32 bit native endian PCM.
+ */
+
+typedef enum {
+	RESAMPLE_LINEAR,	/* 2 taps, fastest */
+	RESAMPLE_CUBIC,		/* 4 taps, Catmull-Rom */
+	RESAMPLE_SINC		/* 32 taps, windowed sinc */
+} resample_quality_t;
+
+struct resample_stats {
+	unsigned long long frames_out;
+	unsigned long long cpu_us;	/* time spent in push/pull */
+	unsigned int realtime_x;	/* times faster than realtime */
+};
+
+int resample_init(resample_quality_t quality, unsigned int out_rate);
+void resample_destroy();
+int resample_set_format(unsigned int in_rate, int channels, int bits);
+void resample_reset();
+int resample_push(const void *in, unsigned int frames);
+unsigned int resample_pull(void *out, unsigned int max_frames);
+void resample_get_stats(struct resample_stats *stats);
+const char *resample_quality_name(resample_quality_t quality);
+int resample_quality_from_name(const char *name);
+
+#endif
@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../logger.h"
+#include "../utils.h"
+
+/*
+ * Cost of logger() calls on the calling thread with the writer running,
+ * and of messages disabled at runtime.  Calls are made in bursts the
+ * writer can drain, so no message is dropped.
+ */
+
+#define	BENCH_BURSTS 200
+#define	BENCH_BURST 100
+
+int
+main()
+{
+	char dir[] = "/tmp/bench_logger.XXXXXX";
+	unsigned long long ns = 0, start;
+	unsigned int b, i;
+
+	if (mkdtemp(dir) == NULL || chdir(dir) == -1) {
+		perror("bench_logger");
+		return (1);
+	}
+	if (logger_init() == -1)
+		return (1);
+
+	for (b = 0; b < BENCH_BURSTS; b++) {
+		start = get_time_ns();
+		for (i = 0; i < BENCH_BURST; i++)
+			logger("read_cnt %u count %u\n", b, i);
+		ns += get_time_ns() - start;
+		usleep(20000);
+	}
+	printf("logger enabled   %6.1f ns/call\n",
+		(double)ns / (BENCH_BURSTS * BENCH_BURST));
+
+	start = get_time_ns();
+	for (i = 0; i < 10000000; i++)
+		log_debug("read_cnt %u\n", i);
+	printf("logger disabled  %6.1f ns/call\n",
+		(double)(get_time_ns() - start) / 10000000);
+
+	logger_stop();
+	unlink("engine.log");
+	rmdir(dir);
+	return (0);
+}
@@ -0,0 +1,108 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "../mailbox.h"
+#include "../protocol.h"
+#include "../utils.h"
+
+/*
+ * Latency of a command from the UI thread to the audio thread: pushed
+ * to the mailbox directly (single-process mode), or sent over a
+ * socketpair, parsed by the loop thread and then pushed.  One command
+ * is in flight at a time, it carries the time it was sent.
+ */
+
+#define	BENCH_COMMANDS 100000
+
+static atomic_uint popped;
+static unsigned long long total_us, max_us;
+static int loop_fd = -1;
+
+// audio thread - polls the mailbox
+static void *
+audio_thread(void *arg)
+{
+	struct engine_cmd cmd;
+	unsigned long long us;
+	unsigned int n;
+
+	for (n = 0; n < BENCH_COMMANDS; n++) {
+		while (mailbox_pop(&cmd) == -1)
+			sched_yield();
+		us = get_time_us() - strtoull(cmd.str, NULL, 10);
+		total_us += us;
+		if (us > max_us)
+			max_us = us;
+		atomic_store(&popped, n + 1);
+	}
+	return (NULL);
+}
+
+// event loop thread - packets from the socket go to the mailbox
+static void *
+loop_thread(void *arg)
+{
+	static struct pkt_reader r;
+	struct pkt pkt;
+	unsigned int n = 0;
+
+	pkt_reader_init(&r);
+	while (n < BENCH_COMMANDS) {
+		if (pkt_reader_fill(&r, loop_fd) <= 0)
+			break;
+		while (pkt_reader_next(&r, &pkt) == 1) {
+			(void) mailbox_push(pkt.info, pkt.data);
+			n++;
+		}
+	}
+	return (NULL);
+}
+
+static int
+run(const char *name, int fd)
+{
+	pthread_t audio_tid, loop_tid;
+	char stamp[32];
+	unsigned int n;
+
+	mailbox_init();
+	atomic_store(&popped, 0);
+	total_us = max_us = 0;
+	pthread_create(&audio_tid, NULL, audio_thread, NULL);
+	if (fd != -1)
+		pthread_create(&loop_tid, NULL, loop_thread, NULL);
+
+	for (n = 0; n < BENCH_COMMANDS; n++) {
+		snprintf(stamp, sizeof (stamp), "%llu", get_time_us());
+		if (fd == -1)
+			(void) mailbox_push(CMD_PAUSE, stamp);
+		else if (send_packet(fd, CMD_PAUSE, stamp) == -1)
+			return (-1);
+		while (atomic_load(&popped) != n + 1)
+			sched_yield();
+	}
+
+	pthread_join(audio_tid, NULL);
+	if (fd != -1)
+		pthread_join(loop_tid, NULL);
+	printf("command latency %-10s avg %.2f us, max %llu us\n", name,
+		(double)total_us / BENCH_COMMANDS, max_us);
+	return (0);
+}
+
+int
+main()
+{
+	int fds[2];
+
+	if (run("mailbox", -1) == -1)
+		return (1);
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+		return (1);
+	loop_fd = fds[0];
+	if (run("socketpair", fds[1]) == -1)
+		return (1);
+	return (0);
+}
@@ -0,0 +1,205 @@
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../mp3_decoder.h"
+#include "../mp3_header.h"
+
+/*
+ * CPU time per second of audio, decode and synthesis of a whole stream:
+ * the pull decoder against mad_decoder_run() with an empty output
+ * callback.  Uses the MP3 file given as argument, or BENCH_MIN minutes
+ * of silent CBR frames built in memory.  Skipped without libmad.
+ */
+
+#define	BENCH_MIN 10
+#define	BENCH_RUNS 3
+
+typedef void (*decoder_init_t)(struct mad_decoder *, void *,
+	enum mad_flow (*)(void *, struct mad_stream *),
+	enum mad_flow (*)(void *, struct mad_header const *),
+	enum mad_flow (*)(void *, struct mad_stream const *,
+	struct mad_frame *),
+	enum mad_flow (*)(void *, struct mad_header const *, struct mad_pcm *),
+	enum mad_flow (*)(void *, struct mad_stream *, struct mad_frame *),
+	enum mad_flow (*)(void *, void *, unsigned int *));
+
+static struct {
+	decoder_init_t init;
+	int (*run)(struct mad_decoder *, enum mad_decoder_mode);
+	int (*finish)(struct mad_decoder *);
+	void (*stream_buffer)(struct mad_stream *, unsigned char const *,
+		unsigned long);
+} run_api;
+
+static const unsigned char *data;
+static size_t data_len;
+static unsigned long long samples;
+static unsigned int rate;
+
+static unsigned long long
+cpu_time_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+static unsigned char *
+make_cbr(size_t *len)
+{
+	struct mp3_header hdr;
+	unsigned char h[4] = { 0xff, 0xfb, 0x90, 0x64 };
+	unsigned char *buf;
+	unsigned int i, n;
+
+	n = BENCH_MIN * 60 * 44100 / 1152;
+	if (mp3_parse_header(h, &hdr) == -1)
+		return (NULL);
+	buf = calloc(n, hdr.frame_len);
+	if (buf == NULL)
+		return (NULL);
+	for (i = 0; i < n; i++)
+		memcpy(buf + (size_t)i * hdr.frame_len, h, 4);
+	*len = (size_t)n * hdr.frame_len;
+	return (buf);
+}
+
+static void
+run_pull()
+{
+	struct mp3_decoder d;
+	struct mad_pcm *pcm;
+
+	mp3_decoder_init(&d, data, data_len, 0);
+	while (mp3_decoder_frame(&d) == 1) {
+		pcm = mp3_decoder_synth(&d);
+		samples += pcm->length;
+		rate = pcm->samplerate;
+	}
+	mp3_decoder_finish(&d);
+}
+
+static enum mad_flow
+input(void *arg, struct mad_stream *stream)
+{
+	int *done = arg;
+
+	if (*done)
+		return (MAD_FLOW_STOP);
+	*done = 1;
+	run_api.stream_buffer(stream, data, data_len);
+	return (MAD_FLOW_CONTINUE);
+}
+
+static enum mad_flow
+output(void *arg, struct mad_header const *header, struct mad_pcm *pcm)
+{
+	samples += pcm->length;
+	rate = pcm->samplerate;
+	return (MAD_FLOW_CONTINUE);
+}
+
+static enum mad_flow
+error(void *arg, struct mad_stream *stream, struct mad_frame *frame)
+{
+	return (MAD_FLOW_CONTINUE);
+}
+
+static void
+run_callback()
+{
+	struct mad_decoder decoder;
+	int done = 0;
+
+	run_api.init(&decoder, &done, input, NULL, NULL, output, error, NULL);
+	run_api.run(&decoder, MAD_DECODER_MODE_SYNC);
+	run_api.finish(&decoder);
+}
+
+static void
+bench(const char *name, void (*run)())
+{
+	unsigned long long start, best = ~0ULL;
+	unsigned int i;
+
+	for (i = 0; i < BENCH_RUNS; i++) {
+		samples = 0;
+		start = cpu_time_us();
+		run();
+		start = cpu_time_us() - start;
+		if (start < best)
+			best = start;
+	}
+	printf("mp3 decoder %-9s %llu s of audio, %.1f us CPU per second\n",
+		name, samples / (rate ? rate : 1),
+		best * (double)(rate ? rate : 1) / (samples ? samples : 1));
+}
+
+static int
+load_run_api(void *lib)
+{
+	void *sym[4];
+
+	sym[0] = dlsym(lib, "mad_decoder_init");
+	sym[1] = dlsym(lib, "mad_decoder_run");
+	sym[2] = dlsym(lib, "mad_decoder_finish");
+	sym[3] = dlsym(lib, "mad_stream_buffer");
+	if (sym[0] == NULL || sym[1] == NULL || sym[2] == NULL ||
+			sym[3] == NULL)
+		return (-1);
+	// function pointers from void *
+	memcpy(&run_api.init, &sym[0], sizeof (sym[0]));
+	memcpy(&run_api.run, &sym[1], sizeof (sym[1]));
+	memcpy(&run_api.finish, &sym[2], sizeof (sym[2]));
+	memcpy(&run_api.stream_buffer, &sym[3], sizeof (sym[3]));
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct stat st;
+	void *lib;
+	int fd;
+
+	lib = dlopen("libmad.so.0", RTLD_NOW);
+	if (lib == NULL)
+		lib = dlopen("libmad.0.dylib", RTLD_NOW);
+	if (lib == NULL || mp3_decoder_load(lib) == -1 ||
+			load_run_api(lib) == -1) {
+		printf("mp3 decoder: libmad not found, skipped\n");
+		return (0);
+	}
+
+	if (argc > 1) {
+		fd = open(argv[1], O_RDONLY);
+		if (fd == -1 || fstat(fd, &st) == -1) {
+			perror(argv[1]);
+			return (1);
+		}
+		data_len = st.st_size;
+		data = mmap(NULL, data_len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			perror("mmap");
+			return (1);
+		}
+	} else {
+		data = make_cbr(&data_len);
+		if (data == NULL) {
+			fprintf(stderr, "can't build the stream\n");
+			return (1);
+		}
+	}
+
+	bench("pull", run_pull);
+	bench("callback", run_callback);
+	return (0);
+}
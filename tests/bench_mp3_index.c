@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../mp3_header.h"
+#include "../mp3_index.h"
+#include "../utils.h"
+
+/*
+ * Index build time for a VBR stream of BENCH_MIN minutes, MPEG1 layer III
+ * 44.1 kHz with a random bitrate in every frame.  The stream is built in
+ * memory, so only the header scan is measured.
+ */
+
+#define	BENCH_MIN 60
+#define	BENCH_RUNS 5
+
+static unsigned char *
+make_vbr(size_t *len, unsigned int *frames)
+{
+	struct mp3_header hdr;
+	unsigned char h[4] = { 0xff, 0xfb, 0, 0x64 };
+	unsigned char *data;
+	size_t pos = 0, size;
+	unsigned int i, n;
+
+	n = BENCH_MIN * 60 * 44100 / 1152;
+	// 320 kbps frames are the longest
+	size = (size_t)n * 1045;
+	data = malloc(size);
+	if (data == NULL)
+		return (NULL);
+	for (i = 0; i < n; i++) {
+		// bitrate index 1 - 14, padding bit set in every other frame
+		h[2] = (1 + rand() % 14) << 4 | (i & 1) << 1;
+		if (mp3_parse_header(h, &hdr) == -1)
+			return (NULL);
+		memset(data + pos, 0, hdr.frame_len);
+		memcpy(data + pos, h, 4);
+		pos += hdr.frame_len;
+	}
+	*len = pos;
+	*frames = n;
+	return (data);
+}
+
+int
+main()
+{
+	struct mp3_index *idx;
+	struct stat st;
+	unsigned long long start, best = ~0ULL, sum = 0;
+	unsigned char *data;
+	unsigned int frames, i, probe;
+	size_t len;
+
+	data = make_vbr(&len, &frames);
+	if (data == NULL) {
+		fprintf(stderr, "can't build the stream\n");
+		return (1);
+	}
+	memset(&st, 0, sizeof (st));
+	st.st_size = len;
+
+	for (i = 0; i < BENCH_RUNS; i++) {
+		st.st_ino = i;
+		start = get_time_us();
+		idx = mp3_index_build(&st, data, 0, 0);
+		start = get_time_us() - start;
+		if (idx == NULL || idx->frames != frames) {
+			fprintf(stderr, "index has %u frames, want %u\n",
+				idx ? idx->frames : 0, frames);
+			return (1);
+		}
+		if (start < best)
+			best = start;
+	}
+
+	start = get_time_ns();
+	for (i = 0; i < 1000000; i++) {
+		probe = mp3_index_frame(idx, (unsigned long long)i * 7919 %
+			((unsigned long long)frames * 1152));
+		sum += idx->offsets[probe];
+	}
+	start = get_time_ns() - start;
+
+	printf("mp3_index %u min VBR, %u frames, %zu MB: build %llu us "
+		"(%.1f ns/frame), lookup %.1f ns\n", BENCH_MIN, frames,
+		len >> 20, best, best * 1000.0 / frames, start / 1000000.0);
+	return (sum == 0);
+}
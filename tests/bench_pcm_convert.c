@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../pcm_convert.h"
+#include "../utils.h"
+
+/*
+ * ns per sample of pcm_convert and of the per-sample loop it replaced
+ * (shift without rounding or clipping, bytes written one by one).
+ */
+
+#define	BENCH_FRAMES 20000
+
+static struct mad_pcm pcm;
+static int32_t out[2 * 1152];
+
+static void
+old_s16(const struct mad_pcm *p, unsigned char *ptr)
+{
+	unsigned int i;
+	int sample;
+
+	for (i = 0; i < p->length; i++) {
+		sample = p->samples[0][i] >> (MAD_F_FRACBITS + 1 - 16);
+		*ptr++ = sample & 0xff;
+		*ptr++ = (sample >> 8) & 0xff;
+		if (p->channels == 2) {
+			sample = p->samples[1][i] >> (MAD_F_FRACBITS + 1 - 16);
+			*ptr++ = sample & 0xff;
+			*ptr++ = (sample >> 8) & 0xff;
+		}
+	}
+}
+
+static void
+report(const char *name, unsigned long long ns)
+{
+	printf("pcm_convert %-12s %5.2f ns/sample\n", name,
+		(double)ns / BENCH_FRAMES / 1152 / 2);
+}
+
+int
+main()
+{
+	unsigned long long start;
+	unsigned int i;
+	int dither;
+
+	pcm.channels = 2;
+	pcm.length = 1152;
+	for (i = 0; i < 1152; i++) {
+		pcm.samples[0][i] = (rand() % (2 * MAD_F_ONE)) - MAD_F_ONE;
+		pcm.samples[1][i] = (rand() % (2 * MAD_F_ONE)) - MAD_F_ONE;
+	}
+
+	start = get_time_ns();
+	for (i = 0; i < BENCH_FRAMES; i++)
+		old_s16(&pcm, (unsigned char *)out);
+	report("old s16", get_time_ns() - start);
+
+	for (dither = 0; dither <= 1; dither++) {
+		start = get_time_ns();
+		for (i = 0; i < BENCH_FRAMES; i++)
+			pcm_convert_s16(&pcm, 0, 1152, dither, (int16_t *)out);
+		report(dither ? "s16 dither" : "s16", get_time_ns() - start);
+
+		start = get_time_ns();
+		for (i = 0; i < BENCH_FRAMES; i++)
+			pcm_convert_s24(&pcm, 0, 1152, dither, out);
+		report(dither ? "s24 dither" : "s24", get_time_ns() - start);
+	}
+	return (0);
+}
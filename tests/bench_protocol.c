@@ -0,0 +1,114 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "../protocol.h"
+#include "../utils.h"
+
+/*
+ * Packets per second from a sender thread to a pkt_reader, over a
+ * socketpair (UI and engine created by fork) and over TCP loopback.
+ * Every other packet is a position status, the rest carry a file path.
+ */
+
+#define	BENCH_PACKETS 1000000
+
+static const char path[] = "/home/user/music/some artist/some album/"
+	"07 - some track.mp3";
+
+static void *
+sender(void *arg)
+{
+	char value[8];
+	unsigned int i;
+	int fd = *(int *)arg;
+
+	for (i = 0; i < BENCH_PACKETS; i++) {
+		if (i & 1) {
+			pkt_put_uint64(value, i);
+			send_packet_payload(fd, STATUS_POSITION, PAYLOAD_UINT64,
+				value, sizeof (value));
+		} else {
+			send_packet(fd, CMD_PLAY, (char *)path);
+		}
+	}
+	return (NULL);
+}
+
+static int
+run(const char *name, int rfd, int wfd)
+{
+	static struct pkt_reader r;
+	unsigned long long start;
+	unsigned int n = 0;
+	uint32_t seq = 0;
+	struct pkt pkt;
+	pthread_t tid;
+	int ret;
+
+	pkt_reader_init(&r);
+	start = get_time_us();
+	pthread_create(&tid, NULL, sender, &wfd);
+	while (n < BENCH_PACKETS) {
+		if (pkt_reader_fill(&r, rfd) <= 0)
+			break;
+		while ((ret = pkt_reader_next(&r, &pkt)) == 1) {
+			if (n > 0 && pkt.seq != seq + 1) {
+				fprintf(stderr, "%s: seq %u after %u\n", name,
+					pkt.seq, seq);
+				return (-1);
+			}
+			seq = pkt.seq;
+			n++;
+		}
+		if (ret == -1)
+			return (-1);
+	}
+	pthread_join(tid, NULL);
+	start = get_time_us() - start;
+	printf("protocol %-10s %u packets in %llu us, %llu packets/s, "
+		"%.1f packets per read\n", name, n, start,
+		n * 1000000ULL / (start ? start : 1), (double)n / r.reads);
+	return (n == BENCH_PACKETS ? 0 : -1);
+}
+
+static int
+tcp_pair(int *rfd, int *wfd)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof (addr);
+	int lfd;
+
+	memset(&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (lfd == -1 || bind(lfd, (struct sockaddr *)&addr, len) == -1 ||
+			listen(lfd, 1) == -1 ||
+			getsockname(lfd, (struct sockaddr *)&addr, &len) == -1)
+		return (-1);
+	*wfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (*wfd == -1 ||
+			connect(*wfd, (struct sockaddr *)&addr, len) == -1)
+		return (-1);
+	*rfd = accept(lfd, NULL, NULL);
+	close(lfd);
+	return (*rfd == -1 ? -1 : 0);
+}
+
+int
+main()
+{
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1 ||
+			run("socketpair", fds[0], fds[1]) == -1)
+		return (1);
+	close(fds[0]);
+	close(fds[1]);
+	if (tcp_pair(&fds[0], &fds[1]) == -1 ||
+			run("tcp", fds[0], fds[1]) == -1)
+		return (1);
+	return (0);
+}
@@ -0,0 +1,66 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../resample.h"
+#include "../utils.h"
+
+/*
+ * Converts BENCH_SEC of 44.1 kHz stereo to 48 kHz with every quality
+ * tier, reports how many times faster than realtime each one runs.
+ */
+
+#define	BENCH_SEC 60
+#define	IN_RATE 44100
+#define	OUT_RATE 48000
+#define	BLOCK_FRAMES 1024
+
+static int16_t in[BLOCK_FRAMES * 2];
+static int16_t out[BLOCK_FRAMES * 4];
+
+static unsigned long long
+run(resample_quality_t q)
+{
+	unsigned long long start, frames = 0, total;
+
+	if (resample_init(q, OUT_RATE) == -1 ||
+			resample_set_format(IN_RATE, 2, 16) == -1) {
+		fprintf(stderr, "%s: can't init\n", resample_quality_name(q));
+		return (0);
+	}
+	total = (unsigned long long)BENCH_SEC * IN_RATE;
+	start = get_thread_cpu_us();
+	while (frames < total) {
+		if (resample_push(in, BLOCK_FRAMES) == -1)
+			break;
+		frames += BLOCK_FRAMES;
+		while (resample_pull(out, BLOCK_FRAMES * 2) > 0)
+			;
+	}
+	start = get_thread_cpu_us() - start;
+	resample_destroy();
+	return (start);
+}
+
+int
+main()
+{
+	unsigned long long us;
+	unsigned int i;
+	int q;
+
+	for (i = 0; i < BLOCK_FRAMES; i++) {
+		in[2 * i] = 16000 * sin(2 * M_PI * 1000 * i / IN_RATE);
+		in[2 * i + 1] = in[2 * i];
+	}
+
+	for (q = RESAMPLE_LINEAR; q <= RESAMPLE_SINC; q++) {
+		us = run(q);
+		if (us == 0)
+			us = 1;
+		printf("resample %-6s %4u s of audio in %6llu us CPU, "
+			"%llux realtime\n", resample_quality_name(q), BENCH_SEC,
+			us, BENCH_SEC * 1000000ULL / us);
+	}
+	return (0);
+}
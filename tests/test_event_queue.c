@@ -0,0 +1,103 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "../event_queue.h"
+
+/*
+ * Several threads post state transitions and position updates while
+ * the consumer pops, posting waits while the queue could be full.  The
+ * consumer must see every transition of every thread in order, with
+ * increasing sequence numbers.  Then the queue is flooded, the dropped
+ * events must show up as a sequence gap after the queued ones.
+ */
+
+#define	TEST_THREADS 8
+#define	TEST_EVENTS 100000
+
+static atomic_uint in_flight;
+static atomic_int running;
+
+static void *
+post_events(void *arg)
+{
+	unsigned long long id = (unsigned long)arg, i;
+
+	for (i = 0; i < TEST_EVENTS; i++) {
+		while (atomic_load(&in_flight) >=
+				EVENT_QUEUE_SIZE - TEST_THREADS)
+			sched_yield();
+		atomic_fetch_add(&in_flight, 1);
+		(void) event_queue_post(STATUS_PAUSE, id << 32 | i, false);
+		(void) event_queue_post(STATUS_POSITION, id << 32 | i, true);
+	}
+	atomic_fetch_sub(&running, 1);
+	return (NULL);
+}
+
+int
+main()
+{
+	unsigned long long next[TEST_THREADS] = { 0 };
+	unsigned long long received = 0, id, i;
+	unsigned int last_seq = 0, errors = 0;
+	pthread_t tids[TEST_THREADS];
+	struct status_event ev;
+	long t;
+	int done;
+
+	event_queue_init();
+	atomic_init(&in_flight, 0);
+	atomic_init(&running, TEST_THREADS);
+	for (t = 0; t < TEST_THREADS; t++) {
+		if (pthread_create(&tids[t], NULL, post_events,
+				(void *)t) != 0) {
+			perror("pthread_create");
+			return (1);
+		}
+	}
+
+	do {
+		done = atomic_load(&running) == 0;
+		while (event_queue_pop(&ev) == 0) {
+			id = ev.value >> 32;
+			i = ev.value & 0xffffffff;
+			if (id >= TEST_THREADS) {
+				errors++;
+			} else if (ev.status == STATUS_POSITION) {
+				if (ev.seq != 0)
+					errors++;
+			} else {
+				if (i != next[id] || ev.seq != last_seq + 1)
+					errors++;
+				next[id] = i + 1;
+				last_seq = ev.seq;
+				received++;
+				atomic_fetch_sub(&in_flight, 1);
+			}
+		}
+	} while (!done);
+
+	for (t = 0; t < TEST_THREADS; t++)
+		pthread_join(tids[t], NULL);
+	if (received != TEST_THREADS * TEST_EVENTS ||
+			event_queue_dropped() != 0)
+		errors++;
+
+	// nobody pops, the newer half of the events doesn't fit
+	for (i = 0; i < 2 * EVENT_QUEUE_SIZE; i++)
+		(void) event_queue_post(STATUS_STOP, 0, false);
+	for (i = 0; i < EVENT_QUEUE_SIZE; i++) {
+		if (event_queue_pop(&ev) != 0 || ev.seq != ++last_seq)
+			errors++;
+	}
+	(void) event_queue_post(STATUS_STOP, 0, false);
+	if (event_queue_pop(&ev) != 0 ||
+			ev.seq != last_seq + 1 + EVENT_QUEUE_SIZE)
+		errors++;
+
+	printf("event queue: %llu transitions received, %u dropped, "
+		"%u errors\n", received, event_queue_dropped(), errors);
+	return (errors > 0);
+}
@@ -0,0 +1,65 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../logger.h"
+
+/*
+ * Many short-lived threads log one message each, rings of exited threads
+ * must be reused so no message is lost.  Runs in a temporary directory,
+ * the logger writes to ./engine.log.
+ */
+
+#define	TEST_THREADS 200
+
+static void *
+log_once(void *arg)
+{
+	logger("thread %d\n", (int)(long)arg);
+	return (NULL);
+}
+
+int
+main()
+{
+	char dir[] = "/tmp/test_logger.XXXXXX", line[256];
+	pthread_t tid;
+	unsigned int found = 0, lost = 0;
+	long i;
+	FILE *f;
+
+	if (mkdtemp(dir) == NULL || chdir(dir) == -1) {
+		perror("test_logger");
+		return (1);
+	}
+	if (logger_init() == -1)
+		return (1);
+	for (i = 0; i < TEST_THREADS; i++) {
+		if (pthread_create(&tid, NULL, log_once, (void *)i) != 0) {
+			perror("pthread_create");
+			return (1);
+		}
+		pthread_join(tid, NULL);
+	}
+	logger_stop();
+
+	f = fopen("engine.log", "r");
+	if (f == NULL)
+		return (1);
+	while (fgets(line, sizeof (line), f) != NULL) {
+		if (strncmp(line, "thread ", 7) == 0)
+			found++;
+		else if (strstr(line, "lost") != NULL &&
+				strstr(line, " 0 lost") == NULL)
+			lost++;
+	}
+	fclose(f);
+	unlink("engine.log");
+	rmdir(dir);
+
+	printf("logger: %u of %d thread messages written\n", found,
+		TEST_THREADS);
+	return (found != TEST_THREADS || lost > 0);
+}
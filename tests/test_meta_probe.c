@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../meta_probe.h"
+
+/*
+ * Header parsers of the file browser on crafted buffers: huge and odd
+ * chunk sizes, truncated headers, a WAV data chunk without size.  A
+ * parser stuck in a loop is killed by the alarm.
+ */
+
+static unsigned char head[1024], tail[64];
+static unsigned int errors;
+
+static void
+put_le32(unsigned char *p, unsigned int v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void
+put_be32(unsigned char *p, unsigned int v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/*
+ * Parses len bytes of head in a file of size bytes, ret and duration
+ * must match.
+ */
+static void
+check(const char *name, const char *ext, size_t len, unsigned long long size,
+	size_t tail_len, int ret, unsigned int duration_ms)
+{
+	struct probe_buf b = { head, len, tail, tail_len, size };
+	struct meta_col col;
+	int r;
+
+	r = meta_probe_parse(ext, &b, &col);
+	if (r != ret || (r == 0 && col.duration_ms != duration_ms)) {
+		printf("%s: returned %d, %u ms\n", name, r, col.duration_ms);
+		errors++;
+	}
+}
+
+/*
+ * RIFF WAVE with a chunk of junk_size before fmt and data, 16 bit
+ * stereo 44.1 kHz.  Returns length of the headers.
+ */
+static size_t
+make_wav(unsigned int junk_size, unsigned int data_size)
+{
+	size_t pos = 12;
+
+	memset(head, 0, sizeof (head));
+	memcpy(head, "RIFF\0\0\0\0WAVE", 12);
+	memcpy(head + pos, "junk", 4);
+	put_le32(head + pos + 4, junk_size);
+	if (junk_size > 64)
+		return (pos + 8);
+	pos += 8 + junk_size + (junk_size & 1);
+	memcpy(head + pos, "fmt ", 4);
+	put_le32(head + pos + 4, 16);
+	put_le32(head + pos + 12, 44100);
+	put_le32(head + pos + 16, 176400);
+	pos += 8 + 16;
+	memcpy(head + pos, "data", 4);
+	put_le32(head + pos + 4, data_size);
+	return (pos + 8);
+}
+
+/*
+ * AIFF with a chunk of junk_size before COMM, 44.1 kHz, 1 s.
+ */
+static size_t
+make_aiff(unsigned int junk_size)
+{
+	size_t pos = 12;
+
+	memset(head, 0, sizeof (head));
+	memcpy(head, "FORM\0\0\0\0AIFF", 12);
+	memcpy(head + pos, "junk", 4);
+	put_be32(head + pos + 4, junk_size);
+	if (junk_size > 64)
+		return (pos + 8);
+	pos += 8 + junk_size + (junk_size & 1);
+	memcpy(head + pos, "COMM", 4);
+	put_be32(head + pos + 4, 18);
+	head[pos + 9] = 2;
+	put_be32(head + pos + 10, 44100);
+	head[pos + 15] = 16;
+	// 44100 as 80 bit extended float
+	head[pos + 16] = 0x40;
+	head[pos + 17] = 0x0e;
+	head[pos + 18] = 0xac;
+	head[pos + 19] = 0x44;
+	return (pos + 8 + 18);
+}
+
+static void
+test_riff()
+{
+	unsigned int huge[] = { 0xfffffff7, 0xfffffff8, 0xffffffff };
+	size_t len;
+	unsigned int i;
+
+	for (i = 0; i < sizeof (huge) / sizeof (huge[0]); i++) {
+		len = make_wav(huge[i], 0);
+		check("wav huge chunk", "wav", len, 1ULL << 32, 0, -1, 0);
+		len = make_aiff(huge[i]);
+		check("aiff huge chunk", "aiff", len, 1ULL << 32, 0, -1, 0);
+	}
+
+	len = make_wav(3, 176400);
+	check("wav odd chunk", "wav", len, len + 176400, 0, 0, 1000);
+	len = make_wav(4, 0);
+	check("wav data without size", "wav", len, len + 352800, 0, 0, 2000);
+	len = make_wav(4, 0xffffffff);
+	check("wav streamed data", "wav", len, len + 352800, 0, 0, 2000);
+	len = make_wav(4, 176400);
+	check("wav truncated fmt", "wav", 12 + 8 + 4 + 10, 1000, 0, -1, 0);
+
+	len = make_aiff(3);
+	check("aiff odd chunk", "aiff", len, len, 0, 0, 1000);
+	check("aiff truncated COMM", "aiff", len - 1, len, 0, -1, 0);
+}
+
+static void
+test_flac()
+{
+	memset(head, 0, sizeof (head));
+	memcpy(head, "fLaC", 4);
+	head[7] = 34;
+	// 44100 Hz in 20 bits, 88200 samples
+	head[8 + 10] = 0x0a;
+	head[8 + 11] = 0xc4;
+	head[8 + 12] = 0x40;
+	put_be32(head + 8 + 14, 88200);
+	check("flac", "flac", 8 + 34, 100000, 0, 0, 2000);
+	check("flac truncated STREAMINFO", "flac", 8 + 17, 100000, 0, -1, 0);
+}
+
+static void
+test_ogg()
+{
+	memset(head, 0, sizeof (head));
+	memcpy(head, "OggS", 4);
+	head[26] = 1;
+	head[27] = 30;
+	memcpy(head + 28, "\001vorbis", 7);
+	put_le32(head + 28 + 12, 44100);
+
+	memset(tail, 0, sizeof (tail));
+	memcpy(tail + 10, "OggS", 4);
+	put_le32(tail + 10 + 6, 3 * 44100);
+
+	check("ogg", "ogg", 58, 100000, sizeof (tail), 0, 3000);
+	check("ogg truncated page", "ogg", 30, 100000, sizeof (tail), -1, 0);
+	check("ogg without tail", "ogg", 58, 100000, 0, 0, 0);
+}
+
+static void
+test_mp3()
+{
+	// MPEG1 layer III 128 kbps 44.1 kHz, frames of 417 bytes
+	static const unsigned char h[4] = { 0xff, 0xfb, 0x90, 0x64 };
+
+	memset(head, 0, sizeof (head));
+	memcpy(head + 10, h, 4);
+	memcpy(head + 10 + 417, h, 4);
+	check("mp3", "mp3", sizeof (head), 16000 + 10, 0, 0, 1000);
+	check("mp3 no frame", "mp3", 10, 16000, 0, -1, 0);
+}
+
+int
+main()
+{
+	alarm(10);
+	test_riff();
+	test_flac();
+	test_ogg();
+	test_mp3();
+	printf("meta_probe: %u parser errors\n", errors);
+	return (errors > 0);
+}
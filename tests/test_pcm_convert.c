@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../pcm_convert.h"
+
+/*
+ * Compares pcm_convert output (SSE2 where available) with a plain 64 bit
+ * reference: round half up, clip, TPDF noise from the same xorshift32
+ * sequence.  Output must be bit-exact for every length, channel count
+ * and sample value, including values far beyond full scale.
+ */
+
+static uint32_t rng;
+
+static uint32_t
+next()
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return (rng);
+}
+
+static int
+tpdf(int shift)
+{
+	uint32_t mask = (1U << shift) - 1;
+	int a = next() & mask;
+
+	return (a - (int)(next() & mask));
+}
+
+static long long
+ref(mad_fixed_t s, int noise, int bits, long long max)
+{
+	int shift = MAD_F_FRACBITS + 1 - bits;
+	long long v;
+
+	v = ((long long)s + noise + (1LL << (shift - 1))) >> shift;
+	if (v > max)
+		return (max);
+	if (v < -max - 1)
+		return (-max - 1);
+	return (v);
+}
+
+static mad_fixed_t
+sample()
+{
+	// mostly in range, some at the limits of mad_fixed_t
+	switch (rand() % 8) {
+	case 0:
+		return (0x7fffffff - (rand() % 16384));
+	case 1:
+		return (-0x7fffffff - 1 + (rand() % 16384));
+	case 2:
+		return (MAD_F_ONE - 1 - (rand() % 16384));
+	default:
+		return ((mad_fixed_t)((rand() % (2 * MAD_F_ONE)) - MAD_F_ONE));
+	}
+}
+
+static unsigned int
+check(struct mad_pcm *pcm, unsigned int start, unsigned int n, bool dither,
+	int bits)
+{
+	static int16_t out16[2 * 1152];
+	static int32_t out32[2 * 1152];
+	unsigned int i, c, errors = 0;
+	long long want, got;
+	int noise[2];
+
+	pcm_convert_seed(12345);
+	rng = 12345;
+	if (bits == 16)
+		pcm_convert_s16(pcm, start, n, dither, out16);
+	else
+		pcm_convert_s24(pcm, start, n, dither, out32);
+
+	for (i = 0; i < n; i++) {
+		for (c = 0; c < pcm->channels; c++)
+			noise[c] = dither ? tpdf(MAD_F_FRACBITS + 1 - bits) : 0;
+		for (c = 0; c < pcm->channels; c++) {
+			want = ref(pcm->samples[c][start + i], noise[c], bits,
+				bits == 16 ? 32767 : 8388607);
+			if (bits == 16)
+				got = out16[i * pcm->channels + c];
+			else
+				got = out32[i * pcm->channels + c] >> 8;
+			if (got != want && errors++ < 5) {
+				printf("s%d ch %u/%u n %u frame %u: %lld, want "
+					"%lld\n", bits, c, pcm->channels, n, i,
+					got, want);
+			}
+		}
+	}
+	return (errors);
+}
+
+int
+main()
+{
+	static struct mad_pcm pcm;
+	unsigned int i, n, errors = 0, runs = 0;
+	int ch, dither, bits;
+
+	srand(1);
+	for (i = 0; i < 1152; i++) {
+		pcm.samples[0][i] = sample();
+		pcm.samples[1][i] = sample();
+	}
+
+	for (ch = 1; ch <= 2; ch++) {
+		pcm.channels = ch;
+		for (bits = 16; bits <= 24; bits += 8) {
+			for (dither = 0; dither <= 1; dither++) {
+				for (n = 1; n <= 40; n++, runs++)
+					errors += check(&pcm, n % 5, n, dither,
+						bits);
+				errors += check(&pcm, 0, 1152, dither, bits);
+				runs++;
+			}
+		}
+	}
+	printf("pcm_convert: %u runs, %u mismatches\n", runs, errors);
+	return (errors > 0);
+}
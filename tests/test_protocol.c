@@ -0,0 +1,153 @@
+#include <stdio.h>
+
+#include "../mailbox.h"
+#include "../protocol.h"
+
+/*
+ * Paths up to the payload limit go through a packet and the command
+ * mailbox unchanged, longer ones are refused by send_packet().  The
+ * reader must join a packet written one byte at a time, split several
+ * packets of one read and refuse a header with a too long payload.
+ */
+
+static char path[PKT_MAX_PAYLOAD + 1];
+
+static int
+round_trip(int *fds, size_t len)
+{
+	static struct pkt_reader r;
+	struct engine_cmd cmd;
+	struct pkt pkt;
+
+	memset(path, 'a', len);
+	path[0] = '/';
+	path[len] = '\0';
+	if (send_packet(fds[1], CMD_PLAY, path) == -1)
+		return (-1);
+
+	pkt_reader_init(&r);
+	while (pkt_reader_next(&r, &pkt) == 0) {
+		if (pkt_reader_fill(&r, fds[0]) <= 0)
+			return (-1);
+	}
+	if (pkt.info != CMD_PLAY || strcmp(pkt.data, path) != 0)
+		return (-1);
+	if (mailbox_push(pkt.info, pkt.data) == -1 ||
+			mailbox_pop(&cmd) == -1)
+		return (-1);
+	return (strcmp(cmd.str, path) == 0 ? 0 : -1);
+}
+
+static int
+split_packet(int *fds)
+{
+	static struct pkt_reader r;
+	char buf[sizeof (struct pkt_header) + 300];
+	struct pkt pkt;
+	size_t len, i;
+
+	memset(path, 'b', 299);
+	path[299] = '\0';
+	len = pkt_encode(buf, CMD_PLAY, PAYLOAD_STRING, path, 300, 7);
+	pkt_reader_init(&r);
+	for (i = 0; i < len; i++) {
+		if (write(fds[1], buf + i, 1) != 1 ||
+				pkt_reader_fill(&r, fds[0]) != 1)
+			return (-1);
+		if (pkt_reader_next(&r, &pkt) != (i == len - 1 ? 1 : 0))
+			return (-1);
+	}
+	return (pkt.info == CMD_PLAY && pkt.seq == 7 &&
+		strcmp(pkt.data, path) == 0 ? 0 : -1);
+}
+
+static int
+packets_in_one_read(int *fds)
+{
+	static struct pkt_reader r;
+	char buf[3 * sizeof (struct pkt_header) + 32], value[8];
+	struct pkt pkt;
+	size_t len;
+
+	pkt_put_uint64(value, 123456);
+	len = pkt_encode(buf, CMD_PLAY, PAYLOAD_STRING, "/a.mp3", 7, 1);
+	len += pkt_encode(buf + len, STATUS_POSITION, PAYLOAD_UINT64, value,
+		sizeof (value), 2);
+	len += pkt_encode(buf + len, STATUS_STOP, PAYLOAD_NONE, NULL, 0, 3);
+	pkt_reader_init(&r);
+	if (write(fds[1], buf, len) != len ||
+			pkt_reader_fill(&r, fds[0]) != len)
+		return (-1);
+
+	if (pkt_reader_next(&r, &pkt) != 1 || pkt.info != CMD_PLAY ||
+			strcmp(pkt.data, "/a.mp3") != 0)
+		return (-1);
+	if (pkt_reader_next(&r, &pkt) != 1 || pkt.info != STATUS_POSITION ||
+			pkt_get_uint64(&pkt) != 123456)
+		return (-1);
+	if (pkt_reader_next(&r, &pkt) != 1 || pkt.info != STATUS_STOP ||
+			pkt.seq != 3)
+		return (-1);
+	return (pkt_reader_next(&r, &pkt) == 0 && r.reads == 1 ? 0 : -1);
+}
+
+static int
+oversized_header(int *fds)
+{
+	static struct pkt_reader r;
+	struct pkt_header hdr;
+	struct pkt pkt;
+
+	memset(&hdr, 0, sizeof (hdr));
+	hdr.version = PROTOCOL_VERSION;
+	hdr.type = PAYLOAD_STRING;
+	hdr.info = htons(CMD_PLAY);
+	hdr.size = htonl(PKT_MAX_PAYLOAD + 1);
+	pkt_reader_init(&r);
+	if (write(fds[1], &hdr, sizeof (hdr)) != sizeof (hdr) ||
+			pkt_reader_fill(&r, fds[0]) != sizeof (hdr))
+		return (-1);
+	return (pkt_reader_next(&r, &pkt) == -1 ? 0 : -1);
+}
+
+int
+main()
+{
+	size_t lens[] = { 1, 255, 256, 1024, PKT_MAX_PAYLOAD - 1 };
+	unsigned int i, errors = 0;
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+		return (1);
+	mailbox_init();
+	for (i = 0; i < sizeof (lens) / sizeof (lens[0]); i++) {
+		if (round_trip(fds, lens[i]) == -1) {
+			printf("path of %zu bytes changed\n", lens[i]);
+			errors++;
+		}
+	}
+
+	// terminating 0 doesn't fit
+	memset(path, 'a', PKT_MAX_PAYLOAD);
+	path[PKT_MAX_PAYLOAD] = '\0';
+	if (send_packet(fds[1], CMD_PLAY, path) != -1) {
+		printf("path of %d bytes was sent\n", PKT_MAX_PAYLOAD);
+		errors++;
+	}
+
+	if (split_packet(fds) == -1) {
+		printf("packet written by bytes not joined\n");
+		errors++;
+	}
+	if (packets_in_one_read(fds) == -1) {
+		printf("packets of one read not split\n");
+		errors++;
+	}
+	if (oversized_header(fds) == -1) {
+		printf("too long payload accepted\n");
+		errors++;
+	}
+
+	printf("protocol: %u errors\n", errors);
+	return (errors > 0);
+}
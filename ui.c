@@ -1,15 +1,25 @@
 #include <ncurses.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <sys/param.h>
 
+#include "audio_engine.h"
+#include "dir_cache.h"
+#include "dir_watch.h"
+#include "library.h"
+#include "meta_probe.h"
 #include "protocol.h"
 #include "utils.h"
 
 #define	status_win_width 30
+// duration, bitrate and sample rate right of file names
+#define	META_COL_WIDTH 24
 
 int sock_fd;
+unsigned long long ui_start_us;
+bool ui_engine_local = false;
 WINDOW *main_win, *status_win;
 
 struct window_dimensions {
@@ -25,6 +35,9 @@ struct window_dimensions *status_win_dimensions = NULL;
 static struct ui_file_list {
 	struct dir_contents *contents;
 	char *dir_name;
+	// directory stat before reading, see dir_cache
+	struct stat dir_st;
+	time_t scanned;
 	// first file to show
 	unsigned int head_idx;
 	// last file to show
@@ -33,6 +46,18 @@ static struct ui_file_list {
 	unsigned int cur_idx;
 } file_list;
 
+/*
+ * Commands go to the engine thread directly when it runs in this
+ * process, status still comes over the socket.
+ */
+static int
+send_command(int fd, info_t cmd, char *str)
+{
+	if (ui_engine_local)
+		return (engine_command(cmd, str));
+	return (send_packet(fd, cmd, str));
+}
+
 /*
  * Saved status of audio engine.
  * Used by status_win when doing window resize.
@@ -40,6 +65,11 @@ static struct ui_file_list {
 volatile info_t ui_status_cache = STATUS_UNKNOWN;
 pthread_mutex_t ui_status_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// latest position updates, protected by ui_status_cache_mutex
+unsigned long long ui_position_ms, ui_duration_ms, ui_buffer_fill;
+const char *ui_receiver_error = NULL;
+bool ui_status_changed = false;
+
 // socket receiver thread
 pthread_t receiver_thread = NULL;
 pthread_attr_t *rcv_attr = NULL;
@@ -49,48 +79,99 @@ void show_files(WINDOW *w);
 void free_dir_list();
 int init_list_for_dir();
 void show_status();
+void show_position();
 void handle_resize(WINDOW *w);
+static void set_cursor(unsigned int idx);
+
+
+
+/*
+ * Queues files of the listing for metadata columns, the visible ones
+ * first.
+ */
+static void
+probe_dir_list()
+{
+	meta_probe_dir(file_list.dir_name, file_list.contents,
+		file_list.head_idx, file_list.tail_idx);
+}
+
+/*
+ * Reads a directory, its stat is taken first so changes made while
+ * reading invalidate the listing.
+ */
+static int
+read_listing(char *dir, struct dir_listing *l)
+{
+	memset(l, 0, sizeof (*l));
+	if (stat(dir, &l->st) == -1)
+		return (-1);
+	l->scanned = time(NULL);
 
+	l->contents = malloc(sizeof (*l->contents));
+	if (!l->contents) {
+		return (-1);
+	}
 
+	if (scan_dir(dir, l->contents, false, false) <= 0) {
+		free(l->contents);
+		return (-1);
+	}
+	return (0);
+}
 
+/*
+ * Listing of the directory being left goes to dir_cache, going back to
+ * it restores the listing and the cursor while the directory is
+ * unchanged.  Nothing changes if the new directory can't be read.
+ */
 int
 change_directory(char *dir)
 {
-	int err, y, x;
+	struct dir_listing old, l;
+	char new_dir[MAXPATHLEN];
+	int y, x;
 
 	if (chdir(dir) == -1) {
 		mvwprintw(status_win, 3, 1, "can't change dir: %s", dir);
 		return (-1);
 	}
 
-	if (getcwd(file_list.dir_name, MAXPATHLEN) == 0) {
+	if (getcwd(new_dir, sizeof (new_dir)) == 0) {
 		mvwprintw(status_win, 3, 1, "can't get current directory");
+		(void) chdir(file_list.dir_name);
 		return (-1);
 	}
 
-	// reset cursor/file position after changing directory
-	file_list.cur_idx = 0;
-
-	// clean up old list
-	free_dir_list();
-
-	// allocate new list
-	init_list_for_dir();
-
-	//populate list with file/directory names
-	err = scan_dir(file_list.contents, false, false);
-	if (err == -1) {
+	// populate new list with file/directory names
+	if (dir_cache_get(new_dir, &l) == -1 && read_listing(".", &l) == -1) {
 		mvwprintw(status_win, 1, 1, "ERROR in change_directory()");
 		wrefresh(status_win);
+		(void) chdir(file_list.dir_name);
 		return (-1);
 	}
 
+	old.contents = file_list.contents;
+	old.st = file_list.dir_st;
+	old.scanned = file_list.scanned;
+	old.head_idx = file_list.head_idx;
+	old.cur_idx = file_list.cur_idx;
+	dir_cache_put(file_list.dir_name, &old);
+
+	snprintf(file_list.dir_name, MAXPATHLEN, "%s", new_dir);
+	file_list.contents = l.contents;
+	file_list.dir_st = l.st;
+	file_list.scanned = l.scanned;
+
 	getmaxyx(main_win, y, x);
 
-	file_list.head_idx = 0;
-	file_list.tail_idx = y - 3;
-	file_list.cur_idx = 0;
+	file_list.head_idx = MIN(l.head_idx, l.contents->amount - 1);
+	file_list.tail_idx = file_list.head_idx + y - 3;
+	file_list.cur_idx = file_list.head_idx;
+	set_cursor(MIN(l.cur_idx, l.contents->amount - 1));
 
+	dir_watch_start(file_list.dir_name);
+	probe_dir_list();
 	show_files(main_win);
 	return (0);
 }
@@ -98,35 +179,14 @@ change_directory(char *dir)
 int
 init_list_for_dir(char *dir)
 {
-	int i, amount;
-	struct dir_contents *contents;
-	fileobj **list;
+	struct dir_listing l;
 
-	amount = count_dir_entries(".", false, false);
-	if (amount == 0)
+	if (read_listing(dir, &l) == -1)
 		return (-1);
 
-	contents = malloc(sizeof (contents));
-	if (!contents) {
-		return (-1);
-	}
-
-	list = malloc(sizeof (contents->list) * amount);
-	if (!list) {
-		return (-1);
-	}
-
-	for (i = 0; i < amount; i++) {
-		list[i] = malloc(NAME_MAX + 1);
-		if (!list[i]) {
-			return (-1);
-		}
-	}
-
-	contents->list = list;
-	contents->amount = amount;
-
-	file_list.contents = contents;
+	file_list.contents = l.contents;
+	file_list.dir_st = l.st;
+	file_list.scanned = l.scanned;
 
 	return (0);
 }
@@ -134,13 +194,7 @@ init_list_for_dir(char *dir)
 void
 free_dir_list()
 {
-	int i;
-
-	for (i = 0; i < file_list.contents->amount; i++) {
-		free(file_list.contents->list[i]);
-	}
-
-	free(file_list.contents->list);
+	free_dir_contents(file_list.contents);
 	free(file_list.contents);
 }
 
@@ -149,16 +203,12 @@ first_run_file_list(WINDOW *w)
 {
 	int y, x, err;
 
-	if (init_list_for_dir(".") == -1) {
-		return (-1);
-	}
-
 	if (getcwd(file_list.dir_name, MAXPATHLEN) == 0) {
 		mvwprintw(status_win, 3, 1, "can't get current directory");
 		return (-1);
 	}
 
-	err = scan_dir(file_list.contents, false, false);
+	err = init_list_for_dir(".");
 	if (err == -1) {
 		mvwprintw(w, 1, 1, "ERROR - CAN'T LOAD FILES");
 		wrefresh(w);
@@ -171,15 +221,136 @@ first_run_file_list(WINDOW *w)
 	file_list.tail_idx = y - 3;
 	file_list.cur_idx = 0;
 
+	dir_watch_start(file_list.dir_name);
+	probe_dir_list();
 	return (0);
 }
 
+/*
+ * Moves the cursor to idx, scrolls as little as possible.
+ */
+static void
+set_cursor(unsigned int idx)
+{
+	unsigned int rows;
+
+	rows = file_list.tail_idx - file_list.head_idx;
+	file_list.cur_idx = idx;
+	if (idx < file_list.head_idx) {
+		file_list.head_idx = idx;
+		file_list.tail_idx = idx + rows;
+	} else if (idx > file_list.tail_idx) {
+		file_list.tail_idx = idx;
+		file_list.head_idx = idx - rows;
+	}
+}
+
+/*
+ * Applies one change of the current directory.  Added files go to the
+ * end, the cursor stays on the same file.  Columns of written files are
+ * read again.
+ */
+static void
+apply_dir_event(dir_event_t event, const char *name, void *arg)
+{
+	struct dir_contents *contents = file_list.contents;
+	int idx;
+
+	idx = dir_contents_find(contents, name);
+	if (event == DIR_WATCH_ADD || event == DIR_WATCH_CHANGE) {
+		if (idx == -1)
+			dir_contents_insert(contents, name, false, false);
+		else if (event == DIR_WATCH_CHANGE)
+			meta_probe_changed(name);
+		return;
+	}
+
+	// ".." is never removed, the list is never empty
+	if (idx <= 0)
+		return;
+	dir_contents_remove(contents, idx);
+	if (idx < file_list.head_idx) {
+		file_list.head_idx--;
+		file_list.tail_idx--;
+	}
+	if (idx < file_list.cur_idx)
+		file_list.cur_idx--;
+	if (file_list.cur_idx >= contents->amount)
+		set_cursor(contents->amount - 1);
+}
+
+/*
+ * Reads the directory again, the cursor stays on the same file if it
+ * still exists.
+ */
+static void
+rescan_dir_list()
+{
+	struct dir_contents *old = file_list.contents;
+	char name[NAME_MAX + 1];
+	int idx;
+
+	snprintf(name, sizeof (name), "%s",
+		dir_entry_name(old, file_list.cur_idx));
+	if (init_list_for_dir(".") == -1) {
+		file_list.contents = old;
+		return;
+	}
+	free_dir_contents(old);
+	free(old);
+
+	idx = dir_contents_find(file_list.contents, name);
+	if (idx == -1)
+		idx = MIN(file_list.cur_idx, file_list.contents->amount - 1);
+	set_cursor(idx);
+	probe_dir_list();
+}
+
+/*
+ * Brings the listing up to date with changes of the directory, returns
+ * true if it changed.
+ */
+static bool
+refresh_dir_list()
+{
+	int ret;
+
+	ret = dir_watch_read(apply_dir_event, NULL);
+	if (ret == DIR_WATCH_RESCAN)
+		rescan_dir_list();
+	return (ret != 0);
+}
+
+/*
+ * Returns full path for a file in current directory, caller frees it.
+ */
+char *
+get_file_path(char *name)
+{
+	char *buf, *p;
+	unsigned int buf_size;
+
+	buf_size = strlen(file_list.dir_name) + 1 + strlen(name) + 1;
+	buf = malloc(buf_size);
+	if (!buf)
+		return (NULL);
+
+	p = buf;
+	strncpy(p, file_list.dir_name, strlen(file_list.dir_name));
+	p += strlen(file_list.dir_name);
+	*p++ = '/';
+	strncpy(p, name, strlen(name));
+	p += strlen(name);
+	*p = '\0';
+	return (buf);
+}
+
 int
 key_enter()
 {
 	info_t cmd = CMD_PLAY;
 	struct dir_contents *contents;
-	char *name, *buf, *p;
+	char *name, *buf;
 	unsigned int buf_size;
 	int ret = 0;
 	bool is_dir;
@@ -187,22 +358,17 @@ key_enter()
 	contents = file_list.contents;
 
 	// file or directory name
-	name = (char *)&contents->list[file_list.cur_idx]->name;
+	name = dir_entry_name(contents, file_list.cur_idx);
 
-	is_dir = is_directory(name);
-
-	if (is_dir)
-		buf_size = strlen(name) + 1;
-	else
-		buf_size = strlen(file_list.dir_name) + 1 + strlen(name) + 1;
-
-	buf = malloc(buf_size);
-	if (!buf) {
-		mvwprintw(status_win, 3, 5, "MALLOC ERROR");
-		return (-1);
-	}
+	is_dir = (contents->list[file_list.cur_idx].type == F_DIR);
 
 	if (is_dir) {
+		buf_size = strlen(name) + 1;
+		buf = malloc(buf_size);
+		if (!buf) {
+			mvwprintw(status_win, 3, 5, "MALLOC ERROR");
+			return (-1);
+		}
 		mvwprintw(status_win, 1, 5, "CHDIR  ");
 		strncpy(buf, name, strlen(name));
 		buf[buf_size - 1] = '\0';
@@ -212,15 +378,13 @@ key_enter()
 		}
 		free(buf);
 		return (ret);
-	} else {
-		// creating a full path for selected file
-		p = buf;
-		strncpy(p, file_list.dir_name, strlen(file_list.dir_name));
-		p += strlen(file_list.dir_name);
-		*p++ = '/';
-		strncpy(p, name, strlen(name));
-		p += strlen(name);
-		*p = '\0';
+	}
+
+	// creating a full path for selected file
+	buf = get_file_path(name);
+	if (!buf) {
+		mvwprintw(status_win, 3, 5, "MALLOC ERROR");
+		return (-1);
 	}
 
 	mvwprintw(status_win, 1, 5, "CMD: PLAY ");
@@ -229,12 +393,106 @@ key_enter()
 	pthread_mutex_unlock(&ui_status_cache_mutex);
 
 	// send full path
-	ret = send_packet(sock_fd, cmd, buf);
+	ret = send_command(sock_fd, cmd, buf);
 	free(buf);
 
 	return (ret);
 }
 
+/*
+ * Adds selected file to the play queue of audio engine.
+ */
+int
+key_queue()
+{
+	char *name, *buf;
+	int ret;
+
+	if (file_list.contents->list[file_list.cur_idx].type == F_DIR)
+		return (0);
+	name = dir_entry_name(file_list.contents, file_list.cur_idx);
+
+	buf = get_file_path(name);
+	if (!buf) {
+		mvwprintw(status_win, 3, 5, "MALLOC ERROR");
+		return (-1);
+	}
+
+	mvwprintw(status_win, 1, 5, "CMD: QUEUE");
+	ret = send_command(sock_fd, CMD_QUEUE, buf);
+	free(buf);
+	return (ret);
+}
+
+/*
+ * Library scan started by 'L', runs in its own thread.  curses_loop()
+ * queues the tracks when the scan is done.
+ */
+static struct {
+	pthread_t tid;
+	bool running;
+	atomic_bool done;
+	int err;
+	char root[MAXPATHLEN];
+	struct library lib;
+} scan;
+
+static void *
+scan_thread(void *arg)
+{
+	scan.err = library_scan(scan.root, 0, &scan.lib);
+	atomic_store_explicit(&scan.done, true, memory_order_release);
+	return (NULL);
+}
+
+/*
+ * Adds all tracks under the current directory to the play queue, in
+ * path order.
+ */
+int
+key_queue_all()
+{
+	if (scan.running) {
+		mvwprintw(status_win, 3, 5, "SCAN RUNNING");
+		return (0);
+	}
+	mvwprintw(status_win, 1, 5, "CMD: QUEUE ALL");
+	snprintf(scan.root, sizeof (scan.root), "%s", file_list.dir_name);
+	atomic_store(&scan.done, false);
+	if (pthread_create(&scan.tid, NULL, scan_thread, NULL) != 0) {
+		mvwprintw(status_win, 3, 5, "SCAN ERROR");
+		return (-1);
+	}
+	scan.running = true;
+	return (0);
+}
+
+/*
+ * Queues tracks of a finished scan.
+ */
+void
+scan_collect()
+{
+	unsigned int i, queued = 0;
+
+	if (!scan.running ||
+			!atomic_load_explicit(&scan.done, memory_order_acquire))
+		return;
+	pthread_join(scan.tid, NULL);
+	scan.running = false;
+
+	for (i = 0; i < scan.lib.amount; i++) {
+		if (send_command(sock_fd, CMD_QUEUE,
+				(char *)scan.lib.tracks[i].path) == -1)
+			break;
+		queued++;
+	}
+	// tracks found before an error are still queued
+	mvwprintw(status_win, 3, 5, "%s%u of %u tracks queued in %llu ms",
+		scan.err == -1 ? "SCAN ERROR, " : "", queued, scan.lib.amount,
+		scan.lib.time_us / 1000);
+	library_free(&scan.lib);
+}
 
 void
 key_down()
@@ -279,35 +537,47 @@ int
 send_pause_command(int sock_fd)
 {
 	info_t cmd = CMD_PAUSE;
-	return (send_packet(sock_fd, cmd, NULL));
+	return (send_command(sock_fd, cmd, NULL));
 }
 
 int
 send_quit_command(int sock_fd)
 {
 	info_t cmd = CMD_QUIT;
-	return (send_packet(sock_fd, cmd, NULL));
+	return (send_command(sock_fd, cmd, NULL));
 }
 
 int
 send_stop_command(int sock_fd)
 {
 	info_t cmd = CMD_STOP;
-	return (send_packet(sock_fd, cmd, NULL));
+	return (send_command(sock_fd, cmd, NULL));
 }
 
 int
 send_ff_command(int sock_fd)
 {
 	info_t cmd = CMD_FF;
-	return (send_packet(sock_fd, cmd, NULL));
+	return (send_command(sock_fd, cmd, NULL));
 }
 
 int
 send_rev_command(int sock_fd)
 {
 	info_t cmd = CMD_REV;
-	return (send_packet(sock_fd, cmd, NULL));
+	return (send_command(sock_fd, cmd, NULL));
+}
+
+/*
+ * Seeks to position in milliseconds.
+ */
+int
+send_seek_command(int sock_fd, unsigned int ms)
+{
+	char buf[16];
+
+	snprintf(buf, sizeof (buf), "%u", ms);
+	return (send_command(sock_fd, CMD_SEEK, buf));
 }
 
 void
@@ -440,97 +710,108 @@ received_status_stop()
 {
 	pthread_mutex_lock(&ui_status_cache_mutex);
 	ui_status_cache = STATUS_STOP;
+	ui_status_changed = true;
+	pthread_mutex_unlock(&ui_status_cache_mutex);
+}
+
+void
+received_position(info_t info, unsigned long long value)
+{
+	pthread_mutex_lock(&ui_status_cache_mutex);
+	switch (info) {
+	case STATUS_POSITION:
+		ui_position_ms = value;
+		break;
+	case STATUS_DURATION:
+		ui_duration_ms = value;
+		break;
+	default:
+		ui_buffer_fill = value;
+	}
+	ui_status_changed = true;
+	pthread_mutex_unlock(&ui_status_cache_mutex);
+}
+
+void
+received_error(const char *error)
+{
+	pthread_mutex_lock(&ui_status_cache_mutex);
+	ui_receiver_error = error;
+	ui_status_changed = true;
 	pthread_mutex_unlock(&ui_status_cache_mutex);
-	show_status();
 }
 
 /*
- * Thread - receives status packets from audio engine.
+ * Thread - receives status packets from audio engine.  It only stores
+ * them, curses_loop() draws.
  */
 void *
 ui_socket_receiver()
 {
-	int len;
-	char *str_buf;
-	bool has_content = false;
-
-	struct pkt_header pkt_hdr, host_pkt_hdr;
-	host_pkt_hdr.info = CMD_UNKNOWN;
+	static struct pkt_reader reader;
+	struct pkt pkt;
+	ssize_t len;
+	int ret;
 
+	pkt_reader_init(&reader);
 	for (;;) {
-		len = read(sock_fd, &pkt_hdr, sizeof (pkt_hdr));
-
-		//printw("read %d bytes from socket\n", len);
+		len = pkt_reader_fill(&reader, sock_fd);
 		if (len == 0) {
-			printw("ERROR: - connection closed (initial read)\n");
+			received_error("connection closed");
 			break;
 		}
-		if (len < sizeof (pkt_hdr)) {
-			printw("ERROR: - received less bytes from socket\n");
+		if (len == -1) {
+			received_error("read error");
 			break;
 		}
 
-		host_pkt_hdr.info = ntohl(pkt_hdr.info);
-		host_pkt_hdr.size = ntohl(pkt_hdr.size);
-		//printw("receiver host_pkg_hdr.info: %d\n",
-		//	(unsigned int)host_pkt_hdr.info);
-		//printw("receiver host_pkg_hdr.size: %d\n",
-		//	(unsigned int)host_pkt_hdr.size);
-		//refresh();
-
-		if (host_pkt_hdr.size > 0) {
-			str_buf = malloc(host_pkt_hdr.size);
-			if (!str_buf) {
-				printw("ERROR: ui_socket_receiver() - malloc error: %s\n",
-					strerror(errno));
+		while ((ret = pkt_reader_next(&reader, &pkt)) == 1) {
+			switch (pkt.info) {
+			case STATUS_STOP:
+				received_status_stop();
 				break;
-			}
-			has_content = true;
-
-			len = read(sock_fd, str_buf, host_pkt_hdr.size);
-			if (len == 0) {
-				printw("ERROR: socket_daemon() - connection closed\n");
-				break;
-			} else if (len < sizeof (str_buf)) {
-				printw("ERROR: read less then buffer\n");
+			case STATUS_EXIT:
+				return (NULL);
+			case STATUS_POSITION:
+			case STATUS_DURATION:
+			case STATUS_BUFFER:
+				received_position(pkt.info, pkt_get_uint64(&pkt));
 				break;
+			default:
+				;;
 			}
-		} else {
-			has_content = false;
 		}
-
-		//printw("received command: %d\n", host_pkt_hdr.info);
-		if (has_content) {
-			printw("received string: %s\n", str_buf);
-		}
-
-		switch (host_pkt_hdr.info) {
-		case STATUS_STOP:
-			received_status_stop();
+		if (ret == -1) {
+			received_error("invalid packet");
 			break;
-		case STATUS_EXIT:
-			if (has_content)
-				free(str_buf);
-			return (NULL);
-		default:
-			;;
 		}
-		if (has_content) {
-			free(str_buf);
-			has_content = false;
-		}
-	}
-	refresh();
-	// we are here if error occurred
-	if (has_content) {
-		free(str_buf);
-		has_content = false;
 	}
-	printw("ui_socket_receiver ERROR, exiting thread..\n");
-	refresh();
 	return (NULL);
 }
 
+/*
+ * Redraws status_win if the receiver thread stored anything new.
+ */
+void
+show_received()
+{
+	const char *error;
+	bool changed;
+
+	pthread_mutex_lock(&ui_status_cache_mutex);
+	changed = ui_status_changed;
+	ui_status_changed = false;
+	error = ui_receiver_error;
+	pthread_mutex_unlock(&ui_status_cache_mutex);
+
+	if (!changed)
+		return;
+	if (error != NULL)
+		mvwprintw(status_win, 3, 5, "ERROR: %s", error);
+	show_status();
+	show_position();
+}
+
 void
 show_status()
 {
@@ -553,6 +834,33 @@ show_status()
 	wrefresh(status_win);
 }
 
+/*
+ * Redraws only the position lines of status_win.
+ */
+void
+show_position()
+{
+	unsigned long long pos, dur, fill;
+	int width, bar, i;
+
+	pthread_mutex_lock(&ui_status_cache_mutex);
+	pos = ui_position_ms / 1000;
+	dur = ui_duration_ms / 1000;
+	fill = ui_buffer_fill;
+	pthread_mutex_unlock(&ui_status_cache_mutex);
+
+	mvwprintw(status_win, 8, 1, "%02llu:%02llu / %02llu:%02llu buf %3llu%%",
+		pos / 60, pos % 60, dur / 60, dur % 60, fill);
+
+	width = status_win_width - 2;
+	bar = (dur > 0 && pos < dur) ? (int)(pos * width / dur) : 0;
+	if (dur > 0 && pos >= dur)
+		bar = width;
+	for (i = 0; i < width; i++)
+		mvwaddch(status_win, 9, 1 + i, i < bar ? '=' : ' ');
+	wrefresh(status_win);
+}
+
 void
 resize_windows()
 {
@@ -565,6 +873,7 @@ resize_windows()
 	wclear(status_win);
 	box(status_win, 0, 0);
 	show_status();
+	show_position();
 	wrefresh(status_win);
 
 	set_main_window_size();
@@ -578,15 +887,31 @@ void
 curses_loop()
 {
 	int key, w_height, w_width;
+	bool changed;
 
 	notimeout(main_win, true);
 
 	for (;;) {
 		getmaxyx(status_win, w_height, w_width);
+		mvwprintw(status_win, w_height - 4 , 1, "L - add all files below");
+		mvwprintw(status_win, w_height - 3 , 1, "a - add to queue, r - restart");
 		mvwprintw(status_win, w_height - 2 , 1, "p - play, s - stop, q - quit");
+		show_received();
 		wrefresh(status_win);
 
+		// no key for a while, look for changes of the directory,
+		// finished probes and scans, all of them are shown by one
+		// redraw
+		wtimeout(main_win, meta_probe_busy() || scan.running ?
+			META_PROBE_POLL_MS : DIR_WATCH_POLL_MS);
 		key = wgetch(main_win);
+		if (key == ERR) {
+			scan_collect();
+			changed = refresh_dir_list();
+			if (meta_probe_update() || changed)
+				show_files(main_win);
+			continue;
+		}
 		switch (key) {
 		case KEY_UP:
 			break;
@@ -594,6 +919,12 @@ curses_loop()
 		case 'p':
 			key_enter();
 			break;
+		case 'a':
+			key_queue();
+			break;
+		case 'L':
+			key_queue_all();
+			break;
 		case ' ':
 			mvwprintw(status_win, 1, 5, "CMD: PAUSE");
 			send_pause_command(sock_fd);
@@ -603,6 +934,10 @@ curses_loop()
 			send_quit_command(sock_fd);
 			wrefresh(status_win);
 			return;
+		case 'r':
+			mvwprintw(status_win, 1, 5, "CMD: SEEK ");
+			send_seek_command(sock_fd, 0);
+			break;
 		case 's':
 			mvwprintw(status_win, 1, 5, "CMD: STOP ");
 			send_stop_command(sock_fd);
@@ -741,18 +1076,52 @@ handle_resize(WINDOW *w)
 	}
 }
 
+/*
+ * Duration, bitrate and sample rate of a file, empty until its probe
+ * is finished.
+ */
+static void
+show_meta_col(WINDOW *w, int y, int x, const struct dir_contents *contents,
+	unsigned int idx)
+{
+	struct meta_col col;
+	unsigned int sec;
+
+	if (contents->list[idx].type != F_NORMAL ||
+			!(contents->list[idx].flags & DE_SUPPORTED) ||
+			meta_probe_show(dir_entry_name(contents, idx), &col) == -1)
+		return;
+
+	sec = col.duration_ms / 1000;
+	if (sec >= 3600)
+		mvwprintw(w, y, x, "%2u:%02u:%02u", sec / 3600, sec / 60 % 60,
+			sec % 60);
+	else if (col.duration_ms > 0)
+		mvwprintw(w, y, x, "   %2u:%02u", sec / 60, sec % 60);
+	if (col.bitrate > 0)
+		mvwprintw(w, y, x + 8, " %5uk", col.bitrate);
+	if (col.rate > 0)
+		mvwprintw(w, y, x + 15, " %3u.%ukHz", col.rate / 1000,
+			col.rate % 1000 / 100);
+}
+
 void
 show_files(WINDOW *w)
 {
 	unsigned int idx, y_pos, win_y, win_x, files_amt;
 	struct dir_contents *contents;
+	int name_w;
 
 	contents = file_list.contents;
 	files_amt = contents->amount;
 
 	getmaxyx(w, win_y, win_x);
+	// columns only if names still have half of the window
+	name_w = win_x - 2;
+	if (win_x - 2 >= 2 * (META_COL_WIDTH + 6))
+		name_w = win_x - 2 - META_COL_WIDTH - 6;
 
-	wclear(w);
+	werase(w);
 	box(w, 0, 0);
 
 	// show directory name
@@ -770,10 +1139,15 @@ show_files(WINDOW *w)
 		mvwprintw(w, y_pos, 1, "%*s", win_x - 2, " ");
 
 		if (file_list.cur_idx == idx) {
-			mvwprintw(w, y_pos, 1, "%s  <--", &contents->list[idx]->name);
+			mvwprintw(w, y_pos, 1, "%.*s  <--", name_w,
+				dir_entry_name(contents, idx));
 		} else {
-			mvwprintw(w, y_pos, 1, "%s", &contents->list[idx]->name);
+			mvwprintw(w, y_pos, 1, "%.*s", name_w,
+				dir_entry_name(contents, idx));
 		}
+		if (name_w < win_x - 2)
+			show_meta_col(w, y_pos, win_x - 1 - META_COL_WIDTH,
+				contents, idx);
 		y_pos++;
 	}
 	wrefresh(w);
@@ -821,8 +1195,11 @@ ui_init()
 }
 
 
+/*
+ * engine_fd is the UI end of a socketpair, or -1 to connect over TCP.
+ */
 int
-curses_ui()
+curses_ui(int engine_fd)
 {
 	int err;
 
@@ -830,6 +1207,7 @@ curses_ui()
 	if (err == -1) {
 		return (-1);
 	}
+	meta_probe_start();
 
 	file_list.dir_name = malloc(MAXPATHLEN + 1);
 	if (!file_list.dir_name) {
@@ -844,7 +1222,11 @@ curses_ui()
 		return (-1);
 	}
 
-	sock_fd = get_client_socket();
+	if (engine_fd != -1)
+		sock_fd = engine_fd;
+	else
+		sock_fd = get_client_socket();
+	send_packet(sock_fd, CMD_SUBSCRIBE, NULL);
 
 	err = pthread_create(&receiver_thread, rcv_attr, ui_socket_receiver, rcv_arg);
 	if (err != 0) {
@@ -854,6 +1236,9 @@ curses_ui()
 	}
 
 	show_files(main_win);
+	mvwprintw(status_win, 7, 1, "startup: %llu us",
+		get_time_us() - ui_start_us);
+	wrefresh(status_win);
 	curses_loop();
 
 	// wait for receiver_thread if alive
@@ -863,6 +1248,13 @@ curses_ui()
 		pthread_join(receiver_thread, NULL);
 	}
 
+	if (scan.running) {
+		pthread_join(scan.tid, NULL);
+		library_free(&scan.lib);
+	}
+	dir_watch_stop();
+	meta_probe_stop();
+	dir_cache_clear();
 	free_dir_list();
 	free(file_list.dir_name);
 
@@ -1 +1,7 @@
-int curses_ui();
+// time of program start, startup time is shown after first render
+extern unsigned long long ui_start_us;
+
+// engine runs as a thread of this process, commands skip the socket
+extern bool ui_engine_local;
+
+int curses_ui(int engine_fd);
@@ -1,115 +1,223 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mp3_header.h"
 #include "utils.h"
 
-bool
-is_directory(char *file)
+const char *const supported_files[] = {
+	"aiff",
+	"flac",
+	"wav",
+	"ogg",
+	"mp3"
+};
+const int supported_files_num =
+	sizeof (supported_files) / sizeof (supported_files[0]);
+
+/*
+ * Monotonic time in microseconds, used for latency measurements.
+ */
+unsigned long long
+get_time_us()
 {
-	int err;
-	struct stat file_stat;
+	struct timespec ts;
 
-	err = stat(file, &file_stat);
-	if (err == -1) {
-		// TODO
-		return (false);
-	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
 
-	if (file_stat.st_mode & S_IFDIR)
-		return (true);
+unsigned long long
+get_time_ns()
+{
+	struct timespec ts;
 
-	return (false);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec);
 }
 
-int
-count_dir_entries(char *dir_path, bool hidden, bool unsupported)
+/*
+ * CPU time of the calling thread in microseconds, sleeping doesn't count.
+ */
+unsigned long long
+get_thread_cpu_us()
 {
-	DIR *dirp = NULL;
-	struct dirent *ent = NULL;
-	char *n;
+	struct timespec ts;
 
-	unsigned int amount = 0;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ((unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
 
-	dirp = opendir(dir_path);
-	if (!dirp) {
-		return (0);
-	}
+/*
+ * Extension packed into 32 bits, lowercase, first character in the
+ * lowest byte.  Slots of the table are (key * EXT_HASH_MUL) >> 29 for
+ * supported_files[], check for collisions when adding a format.
+ */
+#define	EXT_KEY(a, b, c, d) \
+	((uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 | \
+	(uint32_t)(d) << 24)
+#define	EXT_HASH_MUL 0x01000193U
 
-	while ((ent = readdir(dirp)) != NULL) {
-		n = ent->d_name;
-		// ".." - always add
-		if (n[0] == '.' && n[1] == '.' && n[2] == 0) {
-			amount++;
-			continue;
-		}
+static const struct {
+	uint32_t key;
+	int type;	/* index to supported_files[] */
+} ext_table[8] = {
+	{ EXT_KEY('o', 'g', 'g', 0), 3 },
+	{ EXT_KEY('w', 'a', 'v', 0), 2 },
+	{ 0, -1 },
+	{ 0, -1 },
+	{ EXT_KEY('a', 'i', 'f', 'f'), 0 },
+	{ EXT_KEY('m', 'p', '3', 0), 4 },
+	{ EXT_KEY('f', 'l', 'a', 'c'), 1 },
+	{ 0, -1 }
+};
 
-		// skip "."
-		if (n[0] == '.' && n[1] == 0)
-			continue;
+static inline uint32_t
+ext_lower(unsigned char c)
+{
+	return (c | ((unsigned int)(c - 'A') < 26) << 5);
+}
 
-		// filter hidden files and directories
-		if (!hidden) {
-			if (n[0] == '.')
-				continue;
-		}
+/*
+ * Returns index to supported_files[] by file extension.
+ */
+static int
+get_extension_type(const char *filename)
+{
+	const char *dot;
+	uint32_t key = 0;
+	size_t i, len;
+	int match;
 
-		if (!unsupported && !is_directory(n)) {
-			if (!is_supported(n))
-				continue;
-		}
-		amount++;
-	}
+	// hidden files without a name are not audio files
+	dot = strrchr(filename, '.');
+	if (dot == NULL || dot == filename)
+		return (-1);
+	len = strlen(++dot);
+	if (len == 0 || len > 4)
+		return (-1);
+	for (i = 0; i < len; i++)
+		key |= ext_lower(dot[i]) << (8 * i);
 
-	(void) closedir(dirp);
-	return (amount);
+	// empty slots never match, key is never 0
+	i = (key * EXT_HASH_MUL) >> 29;
+	match = -(ext_table[i].key == key);
+	return (ext_table[i].type | ~match);
 }
 
-int
-get_file_type(char *filename)
+/*
+ * Content sniffing.  Results are cached by file identity, so listing
+ * a directory again reads no file data.
+ */
+bool sniff_file_types = false;
+
+#define	SNIFF_PAGE 4096
+#define	SNIFF_CACHE 1024	/* must be a power of 2 */
+
+static struct sniff_entry {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	int type;
+	bool valid;
+} sniff_cache[SNIFF_CACHE];
+static pthread_mutex_t sniff_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool
+sniff_mp3(const unsigned char *p, size_t len)
 {
-	int i, j, ext_type, len;
-	char uppercase, *extp, *ext_idx = NULL;
-	const int max_ext_len = 4; // maximum file extension length
-	const char *cmp_type;
+	struct mp3_header hdr, next;
+	size_t offset;
 
-	// don't support bad (short) file names
-	len = strnlen(filename, NAME_MAX);
-	if (len < 3)
-		return (-1);
+	offset = mp3_skip_id3v2(p, len);
+	// tag is bigger than the page, trust it
+	if (offset > 0 && offset + 4 > len)
+		return (true);
+	if (offset + 4 > len || mp3_parse_header(p + offset, &hdr) == -1)
+		return (false);
+	if (offset + hdr.frame_len + 4 > len)
+		return (true);
+	return (mp3_parse_header(p + offset + hdr.frame_len, &next) == 0 &&
+		next.samplerate == hdr.samplerate && next.layer == hdr.layer);
+}
 
-	// start from the end of file
-	for (i = len; i > 1 ; i--) {
-		if (filename[i] == '.') { // this is the last '.' in the name
-			ext_idx = &filename[i + 1];
-			break;
-		}
-	}
+/*
+ * Returns index to supported_files[] by magic bytes of the first page.
+ */
+static int
+sniff_page(const unsigned char *p, size_t len)
+{
+	if (len >= 12 && memcmp(p, "FORM", 4) == 0 &&
+			(memcmp(p + 8, "AIFF", 4) == 0 ||
+			memcmp(p + 8, "AIFC", 4) == 0))
+		return (0);
+	if (len >= 4 && memcmp(p, "fLaC", 4) == 0)
+		return (1);
+	if (len >= 12 && memcmp(p, "RIFF", 4) == 0 &&
+			memcmp(p + 8, "WAVE", 4) == 0)
+		return (2);
+	if (len >= 4 && memcmp(p, "OggS", 4) == 0)
+		return (3);
+	if (sniff_mp3(p, len))
+		return (4);
+	return (-1);
+}
 
-	// no file extension found
-	if (ext_idx == NULL)
+static int
+sniff_file_type(const char *filename)
+{
+	unsigned char page[SNIFF_PAGE];
+	struct sniff_entry *e;
+	struct stat st;
+	ssize_t len;
+	int fd, type;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return (-1);
+	if (fstat(fd, &st) == -1) {
+		close(fd);
 		return (-1);
+	}
 
-	for (ext_type = 0; ext_type < supported_files_num; ext_type++) {
-		cmp_type = supported_files[ext_type];
+	e = &sniff_cache[(st.st_ino ^ st.st_dev) & (SNIFF_CACHE - 1)];
+	pthread_mutex_lock(&sniff_mutex);
+	if (e->valid && e->dev == st.st_dev && e->ino == st.st_ino &&
+			e->size == st.st_size && e->mtime == st.st_mtime) {
+		type = e->type;
+		pthread_mutex_unlock(&sniff_mutex);
+		close(fd);
+		return (type);
+	}
+	pthread_mutex_unlock(&sniff_mutex);
 
-		// skip different extension length
-		len = strnlen(ext_idx, max_ext_len);
-		if (len != strnlen(cmp_type, max_ext_len))
-			continue;
+	len = read(fd, page, sizeof (page));
+	close(fd);
+	type = (len > 0) ? sniff_page(page, len) : -1;
 
-		extp = ext_idx;
-		for (j = 0; extp[j] != '\0'; j++) {
-			if (extp[j] != cmp_type[j]) {
-				// check upper case letter
-				uppercase = cmp_type[j];
-				uppercase = toupper(uppercase);
-				if (extp[j] != uppercase) {
-					break; // check another file
-				}
-			}
-			if (j == len - 1)
-				// return index to supported_files[]
-				return (ext_type);
-		}
-	}
-	return (-1);
+	pthread_mutex_lock(&sniff_mutex);
+	e->dev = st.st_dev;
+	e->ino = st.st_ino;
+	e->size = st.st_size;
+	e->mtime = st.st_mtime;
+	e->type = type;
+	e->valid = true;
+	pthread_mutex_unlock(&sniff_mutex);
+	return (type);
+}
+
+/*
+ * Returns index to supported_files[] or -1.  With sniff_file_types the
+ * content decides, files with a wrong extension get the real type.
+ */
+int
+get_file_type(char *filename)
+{
+	if (!sniff_file_types)
+		return (get_extension_type(filename));
+	return (sniff_file_type(filename));
 }
 
 bool
@@ -121,54 +229,242 @@ is_supported(char *filename)
 		return (true);
 }
 
+/*
+ * Directory bit of an entry.  d_type is trusted, the entry is stat'ed
+ * only if the file system doesn't fill it or it is a symlink.  Systems
+ * without d_type (illumos) always stat.
+ */
+static int
+name_type(int dfd, const char *name)
+{
+	struct stat st;
+
+	if (fstatat(dfd, name, &st, 0) == -1)
+		return (F_UNDEFINED);
+	return (S_ISDIR(st.st_mode) ? F_DIR : F_NORMAL);
+}
+
+static int
+entry_type(int dfd, struct dirent *ent)
+{
+#ifdef DT_UNKNOWN
+	switch (ent->d_type) {
+	case DT_DIR:
+		return (F_DIR);
+	case DT_UNKNOWN:
+	case DT_LNK:
+		break;
+	default:
+		return (F_NORMAL);
+	}
+#endif
+	return (name_type(dfd, ent->d_name));
+}
+
+static int
+add_entry(struct dir_contents *contents, const char *name, int type,
+	int flags)
+{
+	struct dir_entry *list, *e;
+	size_t len, size;
+	char *names;
+
+	if (contents->amount == contents->size) {
+		list = realloc(contents->list,
+			sizeof (*list) * contents->size * 2);
+		if (list == NULL)
+			return (-1);
+		contents->list = list;
+		contents->size *= 2;
+	}
+
+	len = strnlen(name, NAME_MAX);
+	size = contents->names_size;
+	while (contents->names_len + len + 1 > size)
+		size *= 2;
+	if (size != contents->names_size) {
+		names = realloc(contents->names, size);
+		if (names == NULL)
+			return (-1);
+		contents->names = names;
+		contents->names_size = size;
+	}
+
+	e = &contents->list[contents->amount++];
+	e->name_off = contents->names_len;
+	e->name_len = len;
+	e->type = type;
+	e->flags = flags;
+	memcpy(contents->names + contents->names_len, name, len);
+	contents->names[contents->names_len + len] = '\0';
+	contents->names_len += len + 1;
+	return (0);
+}
+
+/*
+ * "." is never listed, ".." always.
+ */
+static bool
+name_listed(const char *n, bool hidden)
+{
+	if (n[0] != '.')
+		return (true);
+	if (n[1] == 0)
+		return (false);
+	if (n[1] == '.' && n[2] == 0)
+		return (true);
+	return (hidden);
+}
+
+/*
+ * Adds the entry unless it is filtered out.  Returns 1 if added, 0 if
+ * filtered, -1 on error.
+ */
+static int
+list_entry(struct dir_contents *contents, const char *name, int type,
+	bool unsupported)
+{
+	int flags = 0;
+
+	if (type != F_DIR && is_supported((char *)name))
+		flags |= DE_SUPPORTED;
+	if (!unsupported && type != F_DIR && !(flags & DE_SUPPORTED))
+		return (0);
+	return ((add_entry(contents, name, type, flags) == -1) ? -1 : 1);
+}
+
+void
+free_dir_contents(struct dir_contents *contents)
+{
+	free(contents->list);
+	free(contents->names);
+	memset(contents, 0, sizeof (*contents));
+}
+
+/*
+ * Reads the directory in one pass, the list and names grow as needed.
+ * Type of every entry is stored, so callers don't stat it again.  Returns the
+ * number of entries or -1.
+ */
 int
-scan_dir(struct dir_contents *contents, bool hidden, bool unsupported)
+scan_dir(const char *path, struct dir_contents *contents, bool hidden,
+	bool unsupported)
 {
-	int idx = 0;
-	int amount = contents->amount;
+	DIR *dirp;
+	struct dirent *ent;
+	int dfd;
 
-	DIR *dirp = NULL;
-	struct dirent *ent = NULL;
-	char *p, *n;
+	memset(contents, 0, sizeof (*contents));
+	contents->size = SCAN_DIR_SIZE;
+	contents->list = malloc(sizeof (*contents->list) * contents->size);
+	contents->names_size = SCAN_DIR_NAMES;
+	contents->names = malloc(contents->names_size);
+	if (contents->list == NULL || contents->names == NULL) {
+		free_dir_contents(contents);
+		return (-1);
+	}
 
-	dirp = opendir(".");
+	dirp = opendir(path);
 	if (!dirp) {
+		free_dir_contents(contents);
 		return (-1);
 	}
+	dfd = dirfd(dirp);
 
 	while ((ent = readdir(dirp)) != NULL) {
-		if (idx == amount)
-			break;
-
-		n = ent->d_name;
-		// ".." - always add
-		if (n[0] == '.' && n[1] == '.' && n[2] == 0) {
-			p = contents->list[idx]->name;
-			snprintf(p, NAME_MAX, "%s", n);
-			idx++;
+		if (!name_listed(ent->d_name, hidden))
 			continue;
+		if (list_entry(contents, ent->d_name, entry_type(dfd, ent),
+				unsupported) == -1) {
+			(void) closedir(dirp);
+			free_dir_contents(contents);
+			return (-1);
 		}
+	}
 
-		// skip "."
-		if (n[0] == '.' && n[1] == 0)
-			continue;
-
-		// filter hidden files and directories
-		if (!hidden) {
-			if (n[0] == '.')
-				continue;
-		}
+	(void) closedir(dirp);
+	return (contents->amount);
+}
 
-		p = contents->list[idx]->name;
+/*
+ * Returns index of the entry or -1.
+ */
+int
+dir_contents_find(const struct dir_contents *contents, const char *name)
+{
+	size_t len;
+	unsigned int i;
 
-		if (!unsupported && !is_directory(n)) {
-			if (!is_supported(n))
-				continue;
-		}
-		snprintf(p, NAME_MAX, "%s", n);
-		idx++;
+	len = strlen(name);
+	for (i = 0; i < contents->amount; i++) {
+		if (contents->list[i].name_len == len &&
+				memcmp(dir_entry_name(contents, i), name, len) == 0)
+			return (i);
 	}
+	return (-1);
+}
 
-	(void) closedir(dirp);
+/*
+ * Adds a file of the current directory at the end of the list, filters
+ * like scan_dir().  Returns 1 if added, 0 if filtered out or gone, -1 on
+ * error.
+ */
+int
+dir_contents_insert(struct dir_contents *contents, const char *name,
+	bool hidden, bool unsupported)
+{
+	int type;
+
+	if (!name_listed(name, hidden))
+		return (0);
+	type = name_type(AT_FDCWD, name);
+	if (type == F_UNDEFINED)
+		return (0);
+	return (list_entry(contents, name, type, unsupported));
+}
+
+/*
+ * Copies live names to a new arena, removed entries leave holes.
+ */
+static int
+compact_names(struct dir_contents *contents)
+{
+	size_t len, size = SCAN_DIR_NAMES;
+	unsigned int i;
+	char *names;
+
+	len = contents->names_len - contents->names_dead;
+	while (size < len)
+		size *= 2;
+	names = malloc(size);
+	if (names == NULL)
+		return (-1);
+
+	len = 0;
+	for (i = 0; i < contents->amount; i++) {
+		memcpy(names + len, dir_entry_name(contents, i),
+			contents->list[i].name_len + 1);
+		contents->list[i].name_off = len;
+		len += contents->list[i].name_len + 1;
+	}
+	free(contents->names);
+	contents->names = names;
+	contents->names_len = len;
+	contents->names_size = size;
+	contents->names_dead = 0;
 	return (0);
 }
+
+void
+dir_contents_remove(struct dir_contents *contents, unsigned int idx)
+{
+	contents->names_dead += contents->list[idx].name_len + 1;
+	memmove(&contents->list[idx], &contents->list[idx + 1],
+		sizeof (*contents->list) * (contents->amount - idx - 1));
+	contents->amount--;
+
+	// keeps the old arena if there is no memory
+	if (contents->names_dead > SCAN_DIR_NAMES &&
+			contents->names_dead > contents->names_len / 2)
+		(void) compact_names(contents);
+}
@@ -1,24 +1,25 @@
+#ifndef UTILS_H
+#define UTILS_H
+
 #include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #define	NAME_MAX 255
+// initial capacity of scan_dir() list and names, doubled when full
+#define	SCAN_DIR_SIZE 64
+#define	SCAN_DIR_NAMES (SCAN_DIR_SIZE * 16)
 
-static const int supported_files_num = 5;
-/* used by audio codecs - don't change order */
-static const char *supported_files[] = {
-	"aiff",
-	"flac",
-	"wav",
-	"ogg",
-	"mp3"	/* index == 4 */
-};
+/* shown by the file browser, codec_find() picks the decoder */
+extern const int supported_files_num;
+extern const char *const supported_files[];
 
 
 typedef enum {
@@ -27,20 +28,56 @@ typedef enum {
 	F_DIR
 } file_type_t;
 
-typedef struct fileobj_t {
-	unsigned short int type;
-	char name[NAME_MAX];
-} fileobj;
+// dir_entry flags
+#define	DE_SUPPORTED	0x01	/* get_file_type() knows it */
+
+/*
+ * Entry of a directory listing, the name is stored in the names arena
+ * of its dir_contents.
+ */
+struct dir_entry {
+	uint32_t name_off;
+	uint16_t name_len;
+	uint8_t type;		/* file_type_t */
+	uint8_t flags;
+};
 
+/*
+ * Directory listing in two blocks: packed entries and NUL terminated
+ * names one after another.
+ */
 struct dir_contents {
 	unsigned int amount;
-	fileobj **list;
+	unsigned int size;
+	struct dir_entry *list;
+	char *names;
+	size_t names_len;
+	size_t names_size;
+	size_t names_dead;	/* bytes of removed entries */
 };
 
+static inline char *
+dir_entry_name(const struct dir_contents *contents, unsigned int idx)
+{
+	return (contents->names + contents->list[idx].name_off);
+}
+
 
 void show_dir_content(struct dir_contents *contents);
-int scan_dir(struct dir_contents *contents, bool hidden, bool unsupported);
-bool is_directory(char *name);
-int count_dir_entries(char *dir_path, bool hidden, bool unsupported);
+int scan_dir(const char *path, struct dir_contents *contents, bool hidden,
+	bool unsupported);
+void free_dir_contents(struct dir_contents *contents);
+int dir_contents_find(const struct dir_contents *contents, const char *name);
+int dir_contents_insert(struct dir_contents *contents, const char *name,
+	bool hidden, bool unsupported);
+void dir_contents_remove(struct dir_contents *contents, unsigned int idx);
 bool is_supported(char *name);
-int get_file_type(char *filename);
\ No newline at end of file
+int get_file_type(char *filename);
+
+// get_file_type() reads magic bytes instead of trusting extensions
+extern bool sniff_file_types;
+unsigned long long get_time_us();
+unsigned long long get_time_ns();
+unsigned long long get_thread_cpu_us();
+
+#endif